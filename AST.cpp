@@ -1,270 +1,929 @@
 #include "AST.h"
+#include "Instrumentation.h"
+#include "Cancellation.h"
 #include <iostream>
 #include <sstream>
-#include <stack>
 #include <cmath>
 #include <algorithm>
 #include <format>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
 
-void AST::StringArray::add(string s) {
-    string* newData = new string[size + 1];
+// Long loops poll for cancellation once every INTERVAL iterations.
+static inline void checkpointEvery(size_t& count, size_t total) {
+    if ((++count & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(count, total);
+}
 
-    for (int i = 0; i < size; ++i) {
-        newData[i] = data[i];
-    }
-    newData[size] = s;
+AST::TokenArray::~TokenArray() {
+    delete[] data;
+}
 
+void AST::TokenArray::reserve(size_t n) {
+    if (n <= capacity) return;
+    Token* newData = new Token[n];
+    if (size) memcpy(newData, data, size * sizeof(Token));
     delete[] data;
     data = newData;
-    size++;
+    capacity = n;
 }
 
-void AST::StringArray::clear() {
+void AST::TokenArray::clear() {
     delete[] data;
     data = nullptr;
     size = 0;
+    capacity = 0;
 }
 
 
-AST::BNode::BNode(string val, BNode *l, BNode *r)
-    : data(val), left(l), right(r) {}
-
-AST::BNode::~BNode() {
-    delete left;
-    delete right;
+AST::NodeArena::~NodeArena() {
+    delete[] block;
 }
 
-AST::AST(const AST& other) : head(nullptr) {
-    if (other.head) head = copyTree(other.head);
+AST::NodeArena::NodeArena(const NodeArena& other) : block(nullptr), count(0), capacity(0) {
+    *this = other;
 }
 
-AST& AST::operator=(const AST& other) {
-    if (this != &other) {
-        delete head;
-        head = other.head ? copyTree(other.head) : nullptr;
+AST::NodeArena& AST::NodeArena::operator=(const NodeArena& other) {
+    if (this == &other) return *this;
+    if (capacity < other.count) {
+        delete[] block;
+        block = nullptr;
+        capacity = 0;
+        count = 0;
+        grow(other.count);
+    }
+    count = other.count;
+    if (count) {
+        memcpy(valueColumn(), other.valueColumn(), count * sizeof(double));
+        memcpy(leftColumn(), other.leftColumn(), count * sizeof(NodeId));
+        memcpy(rightColumn(), other.rightColumn(), count * sizeof(NodeId));
+        memcpy(labelBeginColumn(), other.labelBeginColumn(), count * sizeof(uint32_t));
+        memcpy(labelLengthColumn(), other.labelLengthColumn(), count * sizeof(uint32_t));
+        memcpy(sizeColumn(), other.sizeColumn(), count * sizeof(uint32_t));
+        memcpy(opColumn(), other.opColumn(), count * sizeof(OpCode));
     }
     return *this;
 }
 
-AST::BNode* AST::copyTree(BNode* node) {
-    if (!node) return nullptr;
-    return new BNode(node->data, copyTree(node->left), copyTree(node->right));
+void AST::NodeArena::grow(size_t newCapacity) {
+    unsigned char* newBlock = new unsigned char[newCapacity * BYTES_PER_NODE];
+    if (count) {
+        memcpy(newBlock, valueColumn(), count * sizeof(double));
+        memcpy(newBlock + newCapacity * 8, leftColumn(), count * sizeof(NodeId));
+        memcpy(newBlock + newCapacity * 12, rightColumn(), count * sizeof(NodeId));
+        memcpy(newBlock + newCapacity * 16, labelBeginColumn(), count * sizeof(uint32_t));
+        memcpy(newBlock + newCapacity * 20, labelLengthColumn(), count * sizeof(uint32_t));
+        memcpy(newBlock + newCapacity * 24, sizeColumn(), count * sizeof(uint32_t));
+        memcpy(newBlock + newCapacity * 28, opColumn(), count * sizeof(OpCode));
+    }
+    delete[] block;
+    block = newBlock;
+    capacity = newCapacity;
 }
 
-int AST::getPrecedence(const string &op) {
-    if (op == "_NEG_") return 3;
-    if (op == "*" || op == "/") return 2;
-    if (op == "+" || op == "-") return 1;
-    return 0;
+void AST::NodeArena::reserve(size_t n) {
+    if (n > capacity) grow(n);
 }
 
-bool AST::isOperator(const string &part) {
-    return part == "+" || part == "-" || part == "*" || part == "/" || part == "_NEG_";
+void AST::NodeArena::clear() {
+    delete[] block;
+    block = nullptr;
+    count = 0;
+    capacity = 0;
 }
 
-AST::StringArray AST::tokenize(const string& expression) {
-    StringArray parts;
-    string current_part;
-    for (char c : expression) {
-        string op_str(1, c);
-        if (op_str == "+" || op_str == "-" || op_str == "*" || op_str == "/" || op_str == "(" || op_str == ")") {
-            if (!current_part.empty()) {
-                parts.add(current_part);
-                current_part.clear();
-            }
-            parts.add(op_str);
-        } else {
-             current_part += c;
-        }
-    }
-    if (!current_part.empty()) parts.add(current_part);
-    return parts;
+AST::NodeId AST::NodeArena::add(OpCode op, NodeId left, NodeId right, double value,
+                                uint32_t labelBegin, uint32_t labelLength) {
+    if (count >= NO_NODE) throw runtime_error("Error: Expression has too many nodes.");
+    if (count == capacity) grow(capacity ? capacity * 2 : 16);
+    NodeId id = static_cast<NodeId>(count++);
+    valueColumn()[id] = value;
+    leftColumn()[id] = left;
+    rightColumn()[id] = right;
+    labelBeginColumn()[id] = labelBegin;
+    labelLengthColumn()[id] = labelLength;
+    // Saturates: a DAG from optimize() can stand for a tree of any size.
+    uint64_t size = uint64_t(1) + (left != NO_NODE ? sizeColumn()[left] : 0) + (right != NO_NODE ? sizeColumn()[right] : 0);
+    sizeColumn()[id] = static_cast<uint32_t>(min<uint64_t>(size, UINT32_MAX));
+    opColumn()[id] = op;
+    return id;
 }
 
-AST::StringArray AST::handleUnaryOperators(const StringArray& tokens) {
-    StringArray processed;
+// Copies share the node arena, source text and variable table. Nodes are
+// never modified once added, so versions only ever append to the arena.
+AST::AST(const AST& other)
+    : nodes(other.nodes), head(other.head), source(other.source), variables(other.variables),
+      maxDepth(other.maxDepth), postfixLayout(other.postfixLayout), interned(other.interned) {}
 
-    for (int i = 0; i < tokens.size; ++i) {
-        processed.add(tokens.data[i]);
-    }
+AST::AST(const AST& base, shared_ptr<NodeArena> arena, NodeId root)
+    : nodes(move(arena)), head(root), source(base.source), variables(base.variables),
+      maxDepth(base.maxDepth), postfixLayout(false), interned(false) {}
 
-    if (processed.size == 0) return processed;
+AST::AST(shared_ptr<NodeArena> arena, NodeId root, shared_ptr<const string> source,
+         shared_ptr<const vector<string>> variables, size_t maxDepth, bool postfix)
+    : nodes(move(arena)), head(root), source(move(source)), variables(move(variables)),
+      maxDepth(maxDepth), postfixLayout(postfix && root != NO_NODE), interned(false) {}
 
-    if (processed.data[0] == "-") processed.data[0] = "_NEG_";
+AST& AST::operator=(const AST& other) {
+    if (this != &other) {
+        nodes = other.nodes;
+        head = other.head;
+        source = other.source;
+        variables = other.variables;
+        maxDepth = other.maxDepth;
+        postfixLayout = other.postfixLayout;
+        interned = other.interned;
+        postfixContainer.clear();
+    }
+    return *this;
+}
 
-    for (int i = 1; i < processed.size; ++i) {
-        if (processed.data[i] == "-") {
-            const string &prev_part = processed.data[i - 1];
-            if (isOperator(prev_part) || prev_part == "(") {
-                processed.data[i] = "_NEG_";
-            }
-        }
+void AST::handleUnaryOperators(TokenArray& tokens) {
+    STC_TRACE_SCOPE("handleUnaryOperators");
+    // Calls are only marked here; infixToPostfix() looks them up.
+    TokenClassifier classifier;
+    for (size_t i = 0; i < tokens.size; ++i) {
+        Token &t = tokens.data[i];
+        t.kind = classifier.read(t.kind, t.op, i + 1 < tokens.size && tokens.data[i + 1].kind == TokenKind::LParen);
     }
-    return processed;
 }
 
-void AST::infixToPostfix(const StringArray& tokens) {
-    stack<string> opStack;
+const shared_ptr<const vector<string>>& AST::noVariables() {
+    static const shared_ptr<const vector<string>> empty = make_shared<const vector<string>>();
+    return empty;
+}
+
+string AST::depthError(size_t maxDepth) {
+    return "Error: Expression nests deeper than " + to_string(maxDepth) + " levels.";
+}
+
+void AST::infixToPostfix(const TokenArray& tokens) {
+    STC_TRACE_SCOPE("infixToPostfix");
+    OperatorStack opStack(maxDepth);
     postfixContainer.clear();
-    for (int i = 0; i < tokens.size; ++i) {
-        string part = tokens.data[i];
+    postfixContainer.reserve(tokens.size + 1);
+    auto emit = [this](OpCode op) { postfixContainer.add({TokenKind::Operator, op, string_view(), 0.0}); };
+    for (size_t i = 0; i < tokens.size; ++i) {
+        if ((i & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(i, tokens.size);
+        const Token &part = tokens.data[i];
 
-        if (!isOperator(part) && part != "(" && part != ")") {
+        if (part.kind == TokenKind::Number || part.kind == TokenKind::Variable) {
             postfixContainer.add(part);
-        } else if (part == "(") {
-            opStack.push(part);
-        } else if (part == ")") {
-            while (!opStack.empty() && opStack.top() != "(") {
-                postfixContainer.add(opStack.top());
-                opStack.pop();
-            }
-            if (!opStack.empty()) opStack.pop();
-        } else if (isOperator(part)) {
-            while (!opStack.empty() && opStack.top() != "(" && getPrecedence(opStack.top()) >= getPrecedence(part)) {
-                postfixContainer.add(opStack.top());
-                opStack.pop();
-            }
-            opStack.push(part);
+        } else if (part.kind == TokenKind::Function) {
+            opStack.read(part.kind, functionCode(part.text), emit);
+        } else {
+            opStack.read(part.kind, part.op, emit);
         }
     }
-    while (!opStack.empty()) {
-        if (opStack.top() == "(") throw runtime_error("Error: Unmatched left parenthesis.");
-        postfixContainer.add(opStack.top());
-        opStack.pop();
-    }
+    opStack.finish(emit);
 }
 
-AST::AST(string expression) : head(nullptr) {
-    StringArray raw_tokens = tokenize(expression);
-    StringArray processed_tokens = handleUnaryOperators(raw_tokens);
-    infixToPostfix(processed_tokens);
+AST::AST(string expression, size_t maxDepth)
+    : nodes(make_shared<NodeArena>()), head(NO_NODE), source(make_shared<const string>(move(expression))),
+      variables(noVariables()), maxDepth(maxDepth), postfixLayout(false), interned(false) {
+    STC_TRACE_SCOPE("parse");
+    // Leaf labels are 32-bit offsets into the source.
+    if (source->size() > NodeArena::NO_LABEL) throw runtime_error("Error: Expression is too large.");
+    TokenArray tokens;
+    tokenize(*source, tokens);
+    handleUnaryOperators(tokens);
+    infixToPostfix(tokens);
     buildTree();
-
-    raw_tokens.clear();
-    processed_tokens.clear();
 }
 
 AST::~AST() {
-    delete head;
     postfixContainer.clear();
 }
 
+int AST::variableIndex(string_view name) const {
+    for (size_t i = 0; i < variables->size(); ++i) {
+        if ((*variables)[i] == name) return static_cast<int>(i);
+    }
+    return -1;
+}
+
 void AST::buildTree() {
-    if (head) { delete head; head = nullptr; }
-    if (postfixContainer.size == 0) return;
-
-    stack<BNode *> nodeStack;
-
-    for (int i = 0; i < postfixContainer.size; ++i) {
-        string part = postfixContainer.data[i];
-
-        if (part == "_NEG_") {
-            if (nodeStack.empty()) throw runtime_error("Missing operand for unary -");
-            BNode *right = nodeStack.top(); nodeStack.pop();
-            nodeStack.push(new BNode(part, nullptr, right));
-        } else if (isOperator(part)) {
-            if (nodeStack.size() < 2) throw runtime_error("Missing operands for " + part);
-            BNode *right = nodeStack.top(); nodeStack.pop();
-            BNode *left = nodeStack.top(); nodeStack.pop();
-            nodeStack.push(new BNode(part, left, right));
+    STC_TRACE_SCOPE("buildTree");
+    // Other versions may still share the old arena, so start a fresh one.
+    nodes = make_shared<NodeArena>();
+    head = NO_NODE;
+    postfixLayout = false;
+    interned = false;
+    if (postfixContainer.size == 0) {
+        variables = noVariables();
+        return;
+    }
+
+    nodes->reserve(postfixContainer.size);
+    TreeBuilder tree(maxDepth);
+    vector<string> names;
+    unordered_map<string_view, int> variableIds;
+
+    for (size_t i = 0; i < postfixContainer.size; ++i) {
+        if ((i & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(i, postfixContainer.size);
+        const Token &part = postfixContainer.data[i];
+
+        if (part.kind == TokenKind::Operator) {
+            tree.apply(*nodes, part.op);
         } else {
-            nodeStack.push(new BNode(part));
+            uint32_t begin = static_cast<uint32_t>(part.text.data() - source->data());
+            uint32_t length = static_cast<uint32_t>(part.text.size());
+            if (part.kind == TokenKind::Variable) {
+                auto [it, inserted] = variableIds.try_emplace(part.text, static_cast<int>(names.size()));
+                if (inserted) names.emplace_back(part.text);
+                int index = it->second;
+                tree.leaf(nodes->add(OpCode::Variable, NO_NODE, NO_NODE, index, begin, length));
+            } else {
+                tree.leaf(nodes->add(OpCode::Number, NO_NODE, NO_NODE, part.value, begin, length));
+            }
         }
     }
-    if (nodeStack.size() != 1) throw runtime_error("Error: Malformed expression.");
-    head = nodeStack.top();
+    if (tree.size() != 1) throw runtime_error("Error: Malformed expression.");
+    head = tree.top();
+    postfixLayout = true;
+    STC_TRACE_COUNTER("nodes", nodes->size());
+    STC_TRACE_COUNTER("depth", tree.height());
+    variables = names.empty() ? noVariables() : make_shared<const vector<string>>(move(names));
 }
 
-double AST::calculateOp(const string& op, double leftVal, double rightVal) {
-    if (op == "+") return leftVal + rightVal;
-    if (op == "-") return leftVal - rightVal;
-    if (op == "*") return leftVal * rightVal;
-    if (op == "/") {
-        if (rightVal == 0) throw runtime_error("Div by zero");
-        return leftVal / rightVal;
+double AST::calculateOp(OpCode op, double leftVal, double rightVal) {
+    switch (op) {
+        case OpCode::Add: return leftVal + rightVal;
+        case OpCode::Sub: return leftVal - rightVal;
+        case OpCode::Mul: return leftVal * rightVal;
+        case OpCode::Div:
+            if (rightVal == 0) throw runtime_error("Div by zero");
+            return leftVal / rightVal;
+        case OpCode::Neg: return -rightVal;
+        case OpCode::Mod: return fmod(leftVal, rightVal);
+        case OpCode::Pow: return pow(leftVal, rightVal);
+        case OpCode::Number:
+        case OpCode::Variable: return 0;
+        default: {
+            // Functions, which take their only argument on the right.
+            const Operator& entry = getOperator(op);
+            return entry.arity == 1 ? entry.unary(rightVal) : entry.binary(leftVal, rightVal);
+        }
     }
-    return 0;
 }
 
+// LIFO buffer that lives on the native stack until it outgrows N entries,
+// so shallow evaluations stay allocation-free.
+template <typename T, size_t N>
+class SmallStack {
+public:
+    SmallStack() : items(local), count(0), capacity(N) {}
+
+    bool empty() const { return count == 0; }
+    T& back() { return items[count - 1]; }
+    void pop_back() { --count; }
+    void push_back(const T& value) {
+        if (count == capacity) spill();
+        items[count++] = value;
+    }
+
+private:
+    T local[N];
+    vector<T> heap;
+    T* items;
+    size_t count;
+    size_t capacity;
+
+    void spill() {
+        if (items == local) heap.assign(local, local + count);
+        heap.resize(capacity * 2);
+        items = heap.data();
+        capacity = heap.size();
+    }
+};
+
 string formatNumber(double val) {
     return format("{:.2f}", val);
 }
 
-int AST::getMaxDepth(BNode* node) {
-    if (!node) return 0;
-    if (!node->left && !node->right) return 1;
+string AST::getLabel(NodeId node) const {
+    OpCode op = nodes->op(node);
+    if (!isLeaf(op)) return getOperator(op).name;
+    if (nodes->labelBegin(node) == NodeArena::NO_LABEL) return formatNumber(nodes->value(node));
+    return source->substr(nodes->labelBegin(node), nodes->labelLength(node));
+}
+
+bool AST::simplifyLowestLevel() {
+    STC_TRACE_SCOPE("simplifyLowestLevel");
+    if (head == NO_NODE || isLeaf(nodes->op(head))) return false;
+
+    // One step folds every operator whose operands are all number leaves.
+    // Post-order walk with an explicit stack; `rebuilt` holds the id each
+    // finished subtree maps to in the new version.
+    vector<pair<NodeId, bool>> pending;
+    vector<NodeId> rebuilt;
+    bool changed = false;
+    size_t visits = 0, total = 2 * size_t(nodes->subtreeSize(head));
+    pending.push_back({head, false});
+
+    while (!pending.empty()) {
+        checkpointEvery(visits, total);
+        auto [node, expanded] = pending.back();
+        pending.pop_back();
+        OpCode op = nodes->op(node);
+        NodeId left = nodes->left(node);
+        NodeId right = nodes->right(node);
+
+        if (isLeaf(op)) {
+            rebuilt.push_back(node);
+            continue;
+        }
+        if (!expanded) {
+            pending.push_back({node, true});
+            pending.push_back({right, false});
+            if (left != NO_NODE) pending.push_back({left, false});
+            continue;
+        }
+
+        NodeId newRight = rebuilt.back(); rebuilt.pop_back();
+        NodeId newLeft = NO_NODE;
+        if (left != NO_NODE) { newLeft = rebuilt.back(); rebuilt.pop_back(); }
+
+        // Only constant operands fold; a variable operand keeps its parent.
+        bool ready = nodes->op(right) == OpCode::Number && (left == NO_NODE || nodes->op(left) == OpCode::Number);
+        if (ready) {
+            double res = calculateOp(op, left != NO_NODE ? nodes->value(left) : 0, nodes->value(right));
+            // Folded values keep full precision; only their labels are rounded.
+            rebuilt.push_back(nodes->add(OpCode::Number, NO_NODE, NO_NODE, res));
+            changed = true;
+        } else if (newLeft != left || newRight != right) {
+            // Path copying: untouched subtrees stay shared with the previous version.
+            rebuilt.push_back(nodes->add(op, newLeft, newRight));
+        } else {
+            rebuilt.push_back(node);
+        }
+    }
 
-    int leftDepth = getMaxDepth(node->left);
-    int rightDepth = getMaxDepth(node->right);
-    return 1 + max(leftDepth, rightDepth);
+    head = rebuilt.back();
+    if (changed) postfixLayout = interned = false;
+    return changed;
 }
 
-bool AST::simplifyAtDepth(BNode* node, int currentDepth, int targetDepth) {
-    if (!node) return false;
+AST::ReductionSchedule AST::reductionSchedule() const {
+    STC_TRACE_SCOPE("reductionSchedule");
+    ReductionSchedule schedule;
+    const size_t NEVER = ReductionSchedule::NEVER;
+    schedule.height.assign(nodes->size(), 0);
+    schedule.foldStep.assign(nodes->size(), NEVER);
+    schedule.foldedValue.assign(nodes->size(), 0.0);
+    schedule.stepBegin.push_back(0);
+    if (head == NO_NODE) return schedule;
+
+    // Single post-order pass: heights, fold steps and folded values.
+    size_t lastStep = 0;
+    vector<pair<NodeId, bool>> pending;
+    size_t visits = 0, total = 2 * size_t(nodes->subtreeSize(head));
+    pending.push_back({head, false});
+    while (!pending.empty()) {
+        checkpointEvery(visits, total);
+        auto [node, expanded] = pending.back();
+        pending.pop_back();
+        if (!expanded && schedule.height[node] != 0) continue;   // shared subtree
+        OpCode op = nodes->op(node);
+        NodeId left = nodes->left(node);
+        NodeId right = nodes->right(node);
+
+        if (isLeaf(op)) {
+            schedule.height[node] = 1;
+            if (op == OpCode::Number) {
+                schedule.foldStep[node] = 0;
+                schedule.foldedValue[node] = nodes->value(node);
+            }
+            continue;
+        }
+        if (!expanded) {
+            pending.push_back({node, true});
+            pending.push_back({right, false});
+            if (left != NO_NODE) pending.push_back({left, false});
+            continue;
+        }
+
+        uint32_t leftHeight = left != NO_NODE ? schedule.height[left] : 0;
+        schedule.height[node] = 1 + max(leftHeight, schedule.height[right]);
+
+        uint32_t rightStep = schedule.foldStep[right];
+        uint32_t leftStep = left != NO_NODE ? schedule.foldStep[left] : 0;
+        if (rightStep == NEVER || leftStep == NEVER) continue;
+
+        uint32_t step = max(leftStep, rightStep) + 1;
+        try {
+            double res = calculateOp(op, left != NO_NODE ? schedule.foldedValue[left] : 0, schedule.foldedValue[right]);
+            schedule.foldStep[node] = step;
+            schedule.foldedValue[node] = res;
+            lastStep = max<size_t>(lastStep, step);
+        } catch (const runtime_error&) {
+            if (schedule.failingStep == 0 || step < schedule.failingStep) schedule.failingStep = step;
+        }
+    }
+
+    // Nothing at or after a failing step ever happens.
+    if (schedule.failingStep) lastStep = min(lastStep, schedule.failingStep - 1);
 
-    bool changed = false;
+    // Counting sort of the folded operators by step.
+    vector<size_t> counts(lastStep + 2, 0);
+    for (size_t id = 0; id < schedule.foldStep.size(); ++id) {
+        uint32_t step = schedule.foldStep[id];
+        if (step == NEVER || step == 0) continue;
+        if (step > lastStep) { schedule.foldStep[id] = NEVER; continue; }
+        ++counts[step];
+    }
+    schedule.stepBegin.assign(lastStep + 1, 0);
+    for (size_t step = 1; step <= lastStep; ++step) {
+        schedule.stepBegin[step] = schedule.stepBegin[step - 1] + counts[step];
+    }
+    schedule.order.resize(schedule.stepBegin[lastStep]);
+    vector<size_t> cursor(schedule.stepBegin.begin(), schedule.stepBegin.end());
+    for (size_t id = 0; id < schedule.foldStep.size(); ++id) {
+        uint32_t step = schedule.foldStep[id];
+        if (step == NEVER || step == 0) continue;
+        schedule.order[cursor[step - 1]++] = static_cast<NodeId>(id);
+    }
+    STC_TRACE_COUNTER("steps", schedule.steps());
+    return schedule;
+}
+
+AST AST::treeAtStep(const ReductionSchedule& schedule, size_t step) const {
+    STC_TRACE_SCOPE("treeAtStep");
+    if (schedule.failingStep && step >= schedule.failingStep) throw runtime_error("Div by zero");
+    step = min(step, schedule.steps());
+    if (head == NO_NODE) return *this;
+
+    auto arena = make_shared<NodeArena>();
+    arena->reserve(nodes->size());
+    vector<pair<NodeId, bool>> pending;
+    vector<NodeId> rebuilt;
+    size_t visits = 0, total = 2 * size_t(nodes->subtreeSize(head));
+    pending.push_back({head, false});
+
+    while (!pending.empty()) {
+        checkpointEvery(visits, total);
+        auto [node, expanded] = pending.back();
+        pending.pop_back();
+        OpCode op = nodes->op(node);
+        uint32_t folded = schedule.foldStep[node];
+
+        if (isLeaf(op)) {
+            rebuilt.push_back(arena->add(op, NO_NODE, NO_NODE, nodes->value(node),
+                                         nodes->labelBegin(node), nodes->labelLength(node)));
+        } else if (folded != ReductionSchedule::NEVER && folded <= step) {
+            rebuilt.push_back(arena->add(OpCode::Number, NO_NODE, NO_NODE, schedule.foldedValue[node]));
+        } else if (!expanded) {
+            pending.push_back({node, true});
+            pending.push_back({nodes->right(node), false});
+            if (nodes->left(node) != NO_NODE) pending.push_back({nodes->left(node), false});
+        } else {
+            NodeId right = rebuilt.back(); rebuilt.pop_back();
+            NodeId left = NO_NODE;
+            if (nodes->left(node) != NO_NODE) { left = rebuilt.back(); rebuilt.pop_back(); }
+            rebuilt.push_back(arena->add(op, left, right));
+        }
+    }
+    AST result(*this, move(arena), rebuilt.back());
+    result.postfixLayout = true;
+    return result;
+}
+
+double AST::calculatePostfixRange(NodeId first, NodeId last, const double* values) const {
+    // The subtree is laid out in postfix order, so one forward sweep with an
+    // operand stack evaluates it.
+    // It runs in chunks so the inner loop stays free of cancellation polls.
+    SmallStack<double, 64> results;
+    for (NodeId chunk = first; chunk <= last; chunk += CancellationScope::INTERVAL) {
+        CancellationScope::checkpoint(chunk - first, last - first + 1);
+        NodeId stop = last - chunk < CancellationScope::INTERVAL ? last : chunk + (CancellationScope::INTERVAL - 1);
+        for (NodeId node = chunk; node <= stop; ++node) {
+            switch (nodes->op(node)) {
+                case OpCode::Number: results.push_back(nodes->value(node)); break;
+                case OpCode::Variable: results.push_back(values[static_cast<size_t>(nodes->value(node))]); break;
+                case OpCode::Neg: results.back() = -results.back(); break;
+                default: {
+                    OpCode op = nodes->op(node);
+                    if (isUnary(op)) {
+                        results.back() = calculateOp(op, 0, results.back());
+                        break;
+                    }
+                    double right = results.back();
+                    results.pop_back();
+                    results.back() = calculateOp(op, results.back(), right);
+                    break;
+                }
+            }
+        }
+        if (stop == last) break;
+    }
+    return results.back();
+}
 
-    if (node->left) {
-        bool childChanged = simplifyAtDepth(node->left, currentDepth + 1, targetDepth);
-        if (childChanged) changed = true;
+double AST::calculateInterned(const double* values) const {
+    // Children precede parents, so one forward sweep over the arena computes
+    // every distinct subexpression exactly once.
+    vector<double> result(head + 1);
+    for (NodeId node = 0; node <= head; ++node) {
+        if ((node & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(node, size_t(head) + 1);
+        OpCode op = nodes->op(node);
+        switch (op) {
+            case OpCode::Number: result[node] = nodes->value(node); break;
+            case OpCode::Variable: result[node] = values[static_cast<size_t>(nodes->value(node))]; break;
+            case OpCode::Neg: result[node] = -result[nodes->right(node)]; break;
+            default: {
+                NodeId left = nodes->left(node);
+                result[node] = calculateOp(op, left != NO_NODE ? result[left] : 0, result[nodes->right(node)]);
+                break;
+            }
+        }
     }
-    if (node->right) {
-        bool childChanged = simplifyAtDepth(node->right, currentDepth + 1, targetDepth);
-        if (childChanged) changed = true;
+    return result[head];
+}
+
+double AST::calculateFrom(NodeId root, const double* values) const {
+    if (interned && root == head) return calculateInterned(values);
+    // In a postfix layout every subtree is the contiguous run ending at its root.
+    if (postfixLayout) return calculatePostfixRange(root + 1 - nodes->subtreeSize(root), root, values);
+
+    // Explicit-stack post-order evaluation; safe for arbitrarily deep trees.
+    SmallStack<pair<NodeId, bool>, 64> pending;
+    SmallStack<double, 64> results;
+    size_t visits = 0, total = 2 * size_t(nodes->subtreeSize(root));
+    pending.push_back({root, false});
+
+    while (!pending.empty()) {
+        checkpointEvery(visits, total);
+        auto [node, expanded] = pending.back();
+        pending.pop_back();
+        OpCode op = nodes->op(node);
+
+        if (op == OpCode::Number) {
+            results.push_back(nodes->value(node));
+        } else if (op == OpCode::Variable) {
+            results.push_back(values[static_cast<size_t>(nodes->value(node))]);
+        } else if (!expanded) {
+            pending.push_back({node, true});
+            pending.push_back({nodes->right(node), false});
+            if (nodes->left(node) != NO_NODE) pending.push_back({nodes->left(node), false});
+        } else if (nodes->left(node) == NO_NODE) {
+            results.back() = calculateOp(op, 0, results.back());
+        } else {
+            double right = results.back();
+            results.pop_back();
+            results.back() = calculateOp(op, results.back(), right);
+        }
     }
+    return results.back();
+}
 
-    if (changed) return true;
+double AST::calculate() {
+    if (!variables->empty()) throw runtime_error("Error: Unbound variable '" + (*variables)[0] + "'.");
+    return calculate(nullptr);
+}
+
+double AST::calculate(const double* values) {
+    STC_TRACE_SCOPE("calculate");
+    if (head == NO_NODE) throw runtime_error("Tree not built.");
+    return calculateFrom(head, values);
+}
 
-    if (!isOperator(node->data)) return false;
-    bool leftReady = (!node->left) || (!isOperator(node->left->data));
-    bool rightReady = (!node->right) || (!isOperator(node->right->data));
+double AST::calculateParallel(ThreadPool& pool, const double* values, size_t grain) {
+    STC_TRACE_SCOPE("calculateParallel");
+    if (!values && !variables->empty()) throw runtime_error("Error: Unbound variable '" + (*variables)[0] + "'.");
+    if (head == NO_NODE) throw runtime_error("Tree not built.");
+    grain = max<size_t>(grain, 2);   // leaves are never worth a task
+    // An optimized DAG is already a single linear sweep.
+    if (interned || nodes->subtreeSize(head) < 2 * grain || pool.threadCount() == 1) return calculateFrom(head, values);
+
+    // Split the tree into a skeleton of "big" nodes (subtree >= grain) and
+    // the small subtrees hanging off it. Small subtrees are evaluated in
+    // parallel in batches of about `grain` nodes; the skeleton, which holds
+    // only the operators joining them, is then folded bottom-up. Walking the
+    // skeleton iteratively keeps this safe for long chains.
+    struct Join {
+        NodeId node;
+        int32_t leftJob;    // index into jobs, or -1 when that child is big/absent
+        int32_t rightJob;
+    };
+    vector<Join> skeleton;
+    vector<NodeId> jobs;
+    vector<NodeId> pending;
+    pending.push_back(head);
+    while (!pending.empty()) {
+        NodeId node = pending.back();
+        pending.pop_back();
+        Join join{node, -1, -1};
+        NodeId left = nodes->left(node);
+        NodeId right = nodes->right(node);
+        if (left != NO_NODE) {
+            if (nodes->subtreeSize(left) >= grain) pending.push_back(left);
+            else { join.leftJob = static_cast<int32_t>(jobs.size()); jobs.push_back(left); }
+        }
+        if (nodes->subtreeSize(right) >= grain) pending.push_back(right);
+        else { join.rightJob = static_cast<int32_t>(jobs.size()); jobs.push_back(right); }
+        skeleton.push_back(join);
+    }
+    // Chain-like trees are mostly skeleton, which is inherently sequential.
+    if (skeleton.size() > nodes->subtreeSize(head) / 4) return calculateFrom(head, values);
+
+    vector<double> jobValue(jobs.size());
+    vector<size_t> batchEnd;
+    size_t batchNodes = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        batchNodes += nodes->subtreeSize(jobs[i]);
+        if (batchNodes >= grain || i + 1 == jobs.size()) {
+            batchEnd.push_back(i + 1);
+            batchNodes = 0;
+        }
+    }
+    pool.parallelFor(batchEnd.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; ++b) {
+            for (size_t i = b ? batchEnd[b - 1] : 0; i < batchEnd[b]; ++i) {
+                jobValue[i] = calculateFrom(jobs[i], values);
+            }
+        }
+    });
+
+    // Children come before parents in id order, so folding the skeleton in
+    // ascending id order sees every big child already computed.
+    sort(skeleton.begin(), skeleton.end(), [](const Join& a, const Join& b) { return a.node < b.node; });
+    vector<double> bigValue(head + 1);
+    for (const Join& join : skeleton) {
+        NodeId node = join.node;
+        OpCode op = nodes->op(node);
+        double right = join.rightJob >= 0 ? jobValue[join.rightJob] : bigValue[nodes->right(node)];
+        double left = 0;
+        if (join.leftJob >= 0) left = jobValue[join.leftJob];
+        else if (nodes->left(node) != NO_NODE) left = bigValue[nodes->left(node)];
+        bigValue[node] = calculateOp(op, left, right);
+    }
+    return bigValue[head];
+}
 
-    if (leftReady && rightReady) {
-        int myDepthFromBottom = getMaxDepth(node);
-        if (myDepthFromBottom == 2) {
-             if (node->data == "_NEG_") {
-                if (node->right) {
-                    double val = -stod(node->right->data);
-                    node->data = formatNumber(val);
-                    delete node->right; node->right = nullptr;
-                    return true;
+Rational AST::calculateExact(const Rational* values) const {
+    STC_TRACE_SCOPE("calculateExact");
+    if (!values && !variables->empty()) throw runtime_error("Error: Unbound variable '" + (*variables)[0] + "'.");
+    if (head == NO_NODE) throw runtime_error("Tree not built.");
+
+    auto leaf = [&](NodeId node) {
+        if (nodes->op(node) == OpCode::Variable) return values[static_cast<size_t>(nodes->value(node))];
+        if (nodes->labelBegin(node) == NodeArena::NO_LABEL) return Rational::fromDouble(nodes->value(node));
+        return Rational::parse(string_view(*source).substr(nodes->labelBegin(node), nodes->labelLength(node)));
+    };
+    auto apply = [](OpCode op, const Rational& left, const Rational& right) {
+        switch (op) {
+            case OpCode::Add: return left + right;
+            case OpCode::Sub: return left - right;
+            case OpCode::Mul: return left * right;
+            case OpCode::Div: return left / right;
+            case OpCode::Neg: return -right;
+            case OpCode::Mod: return left % right;
+            case OpCode::Pow:
+                // Only integer powers stay rational; the cap bounds the digits.
+                if (!right.isInteger() || right.numerator().bitLength() > 16) {
+                    throw runtime_error("Error: ^ needs an integer exponent below 65536 in exact mode.");
                 }
+                return left.power(static_cast<int64_t>(right.numerator().toDouble()));
+            case OpCode::Abs: return right.abs();
+            case OpCode::Min: return right < left ? right : left;
+            case OpCode::Max: return left < right ? right : left;
+            default: throw runtime_error(string("Error: ") + getOperator(op).name + "() is not supported in exact mode.");
+        }
+    };
+
+    if (interned) {
+        // Every distinct subexpression once, children first.
+        vector<Rational> result(head + 1);
+        for (NodeId node = 0; node <= head; ++node) {
+            if ((node & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(node, size_t(head) + 1);
+            OpCode op = nodes->op(node);
+            if (isLeaf(op)) result[node] = leaf(node);
+            else result[node] = apply(op, nodes->left(node) == NO_NODE ? Rational() : result[nodes->left(node)], result[nodes->right(node)]);
+        }
+        return result[head];
+    }
+
+    vector<Rational> results;
+    if (postfixLayout) {
+        // One forward sweep with an operand stack, as in calculatePostfixRange.
+        NodeId first = head + 1 - nodes->subtreeSize(head);
+        for (NodeId node = first; node <= head; ++node) {
+            if (((node - first) & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(node - first, head - first + 1);
+            OpCode op = nodes->op(node);
+            if (isLeaf(op)) {
+                results.push_back(leaf(node));
+            } else if (isUnary(op)) {
+                results.back() = apply(op, Rational(), results.back());
             } else {
-                if (node->left && node->right) {
-                    double l = stod(node->left->data);
-                    double r = stod(node->right->data);
-                    double res = calculateOp(node->data, l, r);
-                    node->data = formatNumber(res);
-                    delete node->left; node->left = nullptr;
-                    delete node->right; node->right = nullptr;
-                    return true;
-                }
+                Rational right = move(results.back());
+                results.pop_back();
+                results.back() = apply(op, results.back(), right);
             }
         }
+        return results.back();
     }
 
-    return false;
+    vector<pair<NodeId, bool>> pending;
+    size_t visits = 0, total = 2 * size_t(nodes->subtreeSize(head));
+    pending.push_back({head, false});
+    while (!pending.empty()) {
+        checkpointEvery(visits, total);
+        auto [node, expanded] = pending.back();
+        pending.pop_back();
+        OpCode op = nodes->op(node);
+        if (isLeaf(op)) {
+            results.push_back(leaf(node));
+        } else if (!expanded) {
+            pending.push_back({node, true});
+            pending.push_back({nodes->right(node), false});
+            if (nodes->left(node) != NO_NODE) pending.push_back({nodes->left(node), false});
+        } else if (nodes->left(node) == NO_NODE) {
+            results.back() = apply(op, Rational(), results.back());
+        } else {
+            Rational right = move(results.back());
+            results.pop_back();
+            results.back() = apply(op, results.back(), right);
+        }
+    }
+    return results.back();
 }
 
-bool AST::simplifyLowestLevel() {
-    if (!head || !isOperator(head->data)) return false;
-
-    return simplifyAtDepth(head, 1, 0);
+Program AST::compile() const {
+    STC_TRACE_SCOPE("compile");
+    if (head == NO_NODE) throw runtime_error("Tree not built.");
+    Program program;
+    program.setVariableCount(variables->size());
+
+    // In an optimized DAG, operators with several parents are stored to a
+    // temporary the first time they are computed and reloaded afterwards.
+    vector<uint8_t> parents;
+    vector<uint32_t> temp;
+    if (interned) {
+        parents.assign(head + 1, 0);
+        temp.assign(head + 1, UINT32_MAX);
+        for (NodeId node = 0; node <= head; ++node) {
+            if (isLeaf(nodes->op(node))) continue;
+            if (nodes->left(node) != NO_NODE && parents[nodes->left(node)] < 2) ++parents[nodes->left(node)];
+            if (parents[nodes->right(node)] < 2) ++parents[nodes->right(node)];
+        }
+    }
+    uint32_t temps = 0;
+
+    // Iterative post-order walk: each entry is visited once to push its
+    // children and once more to emit the node itself.
+    vector<pair<NodeId, bool>> pending;
+    pending.push_back({head, false});
+    while (!pending.empty()) {
+        auto [node, expanded] = pending.back();
+        pending.pop_back();
+        OpCode op = nodes->op(node);
+
+        if (op == OpCode::Number) {
+            program.pushConstant(nodes->value(node));
+        } else if (op == OpCode::Variable) {
+            program.emit(Program::Op::LoadVar, static_cast<uint32_t>(nodes->value(node)));
+        } else if (interned && temp[node] != UINT32_MAX) {
+            program.emit(Program::Op::LoadTemp, temp[node]);
+        } else if (expanded) {
+            switch (op) {
+                case OpCode::Add: program.emit(Program::Op::Add); break;
+                case OpCode::Sub: program.emit(Program::Op::Sub); break;
+                case OpCode::Mul: program.emit(Program::Op::Mul); break;
+                case OpCode::Div: program.emit(Program::Op::Div); break;
+                case OpCode::Neg: program.emit(Program::Op::Neg); break;
+                default:
+                    program.emit(isUnary(op) ? Program::Op::Call1 : Program::Op::Call2, static_cast<uint32_t>(op));
+                    break;
+            }
+            if (interned && parents[node] > 1) {
+                temp[node] = temps++;
+                program.emit(Program::Op::Store, temp[node]);
+            }
+        } else {
+            pending.push_back({node, true});
+            pending.push_back({nodes->right(node), false});
+            if (nodes->left(node) != NO_NODE) pending.push_back({nodes->left(node), false});
+        }
+    }
+    return program;
 }
 
-double AST::calculateRecursive(BNode *node) {
-    if (!node) return 0.0;
-    if (!isOperator(node->data)) return stod(node->data);
-    if (node->data == "_NEG_") return -calculateRecursive(node->right);
-    return calculateOp(node->data, calculateRecursive(node->left), calculateRecursive(node->right));
+namespace {
+
+// Identity of a node once its children are interned.
+struct NodeKey {
+    AST::OpCode op;
+    AST::NodeId left;
+    AST::NodeId right;
+    uint64_t bits;   // value bit pattern for leaves
+
+    bool operator==(const NodeKey& other) const {
+        return op == other.op && left == other.left && right == other.right && bits == other.bits;
+    }
+};
+
+struct NodeKeyHash {
+    size_t operator()(const NodeKey& key) const {
+        uint64_t h = key.bits * 0x9E3779B97F4A7C15ULL;
+        h ^= (uint64_t(key.left) << 32 | key.right) + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+        h ^= static_cast<uint64_t>(key.op) + (h << 6) + (h >> 2);
+        return static_cast<size_t>(h);
+    }
+};
+
 }
 
-double AST::calculate() {
-    if (!head) throw runtime_error("Tree not built.");
-    return calculateRecursive(head);
+// Nodes of `arena` reachable from `root`. Children always have smaller ids
+// than their parents, so one descending sweep marks them all.
+static vector<bool> reachableFrom(const AST::NodeArena& arena, AST::NodeId root) {
+    vector<bool> reachable(root + 1, false);
+    reachable[root] = true;
+    for (AST::NodeId node = root + 1; node-- > 0;) {
+        if (!reachable[node]) continue;
+        if (arena.left(node) != AST::NO_NODE) reachable[arena.left(node)] = true;
+        if (arena.right(node) != AST::NO_NODE) reachable[arena.right(node)] = true;
+    }
+    return reachable;
 }
 
-AST::BNode *AST::getRoot() { return head; }
\ No newline at end of file
+AST AST::optimize() const {
+    STC_TRACE_SCOPE("optimize");
+    if (head == NO_NODE) throw runtime_error("Tree not built.");
+
+    // Pass 1: map every reachable node to its interned id, in id order so
+    // children are always mapped first. Identities and folds may leave
+    // interned nodes unused, which pass 2 drops.
+    vector<bool> reachable = reachableFrom(*nodes, head);
+    vector<NodeId> canonical(head + 1, NO_NODE);
+    NodeArena dag;
+    unordered_map<NodeKey, NodeId, NodeKeyHash> table;
+
+    auto intern = [&](OpCode op, NodeId left, NodeId right, double value, uint32_t labelBegin, uint32_t labelLength) {
+        uint64_t bits = 0;
+        if (isLeaf(op)) memcpy(&bits, &value, sizeof(bits));
+        auto [it, inserted] = table.try_emplace(NodeKey{op, left, right, bits}, 0);
+        if (inserted) it->second = dag.add(op, left, right, value, labelBegin, labelLength);
+        return it->second;
+    };
+    auto isConstant = [&](NodeId id, double value) {
+        return dag.op(id) == OpCode::Number && dag.value(id) == value;
+    };
+
+    for (NodeId node = 0; node <= head; ++node) {
+        if ((node & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(node, size_t(head) + 1);
+        if (!reachable[node]) continue;
+        OpCode op = nodes->op(node);
+        if (isLeaf(op)) {
+            canonical[node] = intern(op, NO_NODE, NO_NODE, nodes->value(node),
+                                     nodes->labelBegin(node), nodes->labelLength(node));
+            continue;
+        }
+        NodeId left = nodes->left(node) != NO_NODE ? canonical[nodes->left(node)] : NO_NODE;
+        NodeId right = canonical[nodes->right(node)];
+        bool leftConstant = left == NO_NODE || dag.op(left) == OpCode::Number;
+        bool rightConstant = dag.op(right) == OpCode::Number;
+
+        NodeId result = NO_NODE;
+        if (leftConstant && rightConstant && !(op == OpCode::Div && dag.value(right) == 0)) {
+            double value = calculateOp(op, left != NO_NODE ? dag.value(left) : 0, dag.value(right));
+            result = intern(OpCode::Number, NO_NODE, NO_NODE, value, NodeArena::NO_LABEL, 0);
+        } else if (op == OpCode::Neg && dag.op(right) == OpCode::Neg) {
+            result = dag.right(right);
+        } else if ((op == OpCode::Mul || op == OpCode::Div) && isConstant(right, 1)) {
+            result = left;
+        } else if (op == OpCode::Mul && isConstant(left, 1)) {
+            result = right;
+        } else if ((op == OpCode::Add || op == OpCode::Sub) && isConstant(right, 0)) {
+            result = left;
+        } else if (op == OpCode::Add && isConstant(left, 0)) {
+            result = right;
+        } else {
+            result = intern(op, left, right, 0.0, NodeArena::NO_LABEL, 0);
+        }
+        canonical[node] = result;
+    }
+
+    // Pass 2: copy only what the optimized root still uses.
+    NodeId root = canonical[head];
+    reachable = reachableFrom(dag, root);
+    auto arena = make_shared<NodeArena>();
+    arena->reserve(count(reachable.begin(), reachable.end(), true));
+    vector<NodeId> renumbered(root + 1, NO_NODE);
+    for (NodeId node = 0; node <= root; ++node) {
+        if (!reachable[node]) continue;
+        NodeId left = dag.left(node) != NO_NODE ? renumbered[dag.left(node)] : NO_NODE;
+        NodeId right = dag.right(node) != NO_NODE ? renumbered[dag.right(node)] : NO_NODE;
+        renumbered[node] = arena->add(dag.op(node), left, right, dag.value(node),
+                                      dag.labelBegin(node), dag.labelLength(node));
+    }
+
+    STC_TRACE_COUNTER("optimizedNodes", arena->size());
+    AST result(*this, move(arena), renumbered[root]);
+    result.interned = true;
+    return result;
+}
@@ -1,62 +1,433 @@
 #ifndef AST_H
 #define AST_H
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
+#include "BuiltinOperators.h"
+#include "Program.h"
+#include "Rational.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
 class AST {
 public:
-    class BNode {
+    typedef uint32_t NodeId;
+    static constexpr NodeId NO_NODE = UINT32_MAX;
+
+    // Codes are stored in program libraries, so new ones are only appended,
+    // in front of BuiltinCount. Functions added with registerFunction() take
+    // the codes from BuiltinCount on.
+    enum class OpCode : uint8_t {
+        Number, Add, Sub, Mul, Div, Neg, Variable,
+        Mod, Pow, Sqrt, Sin, Cos, Tan, Exp, Ln, Abs, Min, Max,
+        BuiltinCount
+    };
+
+    typedef double (*UnaryFunction)(double);
+    typedef double (*BinaryFunction)(double, double);
+
+    // An entry of the operator table; see BuiltinOperators.h.
+    typedef OperatorInfo Operator;
+
+    // Contiguous struct-of-arrays node storage. All columns live in one block,
+    // so freeing a tree is a single delete[] and copying it is a few memcpys.
+    // Nodes are appended in postfix order, so children always have smaller ids
+    // than their parent. add() records each node's subtree size.
+    class NodeArena {
     public:
-        string data;
-        BNode* left;
-        BNode* right;
-        BNode(string val, BNode* l = nullptr, BNode* r = nullptr);
-        ~BNode();
+        // Leaf labels are spans of the source text; NO_LABEL means the label
+        // is regenerated from the value (folded results). Variable leaves keep
+        // their index into AST::getVariables() in the value column.
+        static constexpr uint32_t NO_LABEL = UINT32_MAX;
+
+        NodeArena() : block(nullptr), count(0), capacity(0) {}
+        ~NodeArena();
+
+        NodeArena(const NodeArena& other);
+        NodeArena& operator=(const NodeArena& other);
+
+        size_t size() const { return count; }
+        void reserve(size_t n);
+        void clear();
+
+        NodeId add(OpCode op, NodeId left, NodeId right, double value = 0.0,
+                   uint32_t labelBegin = NO_LABEL, uint32_t labelLength = 0);
+
+        OpCode& op(NodeId id) { return opColumn()[id]; }
+        NodeId& left(NodeId id) { return leftColumn()[id]; }
+        NodeId& right(NodeId id) { return rightColumn()[id]; }
+        double& value(NodeId id) { return valueColumn()[id]; }
+        uint32_t& labelBegin(NodeId id) { return labelBeginColumn()[id]; }
+        uint32_t& labelLength(NodeId id) { return labelLengthColumn()[id]; }
+        uint32_t subtreeSize(NodeId id) const { return sizeColumn()[id]; }
+
+        OpCode op(NodeId id) const { return opColumn()[id]; }
+        NodeId left(NodeId id) const { return leftColumn()[id]; }
+        NodeId right(NodeId id) const { return rightColumn()[id]; }
+        double value(NodeId id) const { return valueColumn()[id]; }
+        uint32_t labelBegin(NodeId id) const { return labelBeginColumn()[id]; }
+        uint32_t labelLength(NodeId id) const { return labelLengthColumn()[id]; }
+
+    private:
+        // Column order keeps every column naturally aligned: 8-byte values,
+        // then the 4-byte columns, then the 1-byte opcodes.
+        static constexpr size_t BYTES_PER_NODE = sizeof(double) + 5 * sizeof(uint32_t) + sizeof(OpCode);
+
+        unsigned char* block;
+        size_t count;
+        size_t capacity;
+
+        double* valueColumn() const { return reinterpret_cast<double*>(block); }
+        NodeId* leftColumn() const { return reinterpret_cast<NodeId*>(block + capacity * 8); }
+        NodeId* rightColumn() const { return reinterpret_cast<NodeId*>(block + capacity * 12); }
+        uint32_t* labelBeginColumn() const { return reinterpret_cast<uint32_t*>(block + capacity * 16); }
+        uint32_t* labelLengthColumn() const { return reinterpret_cast<uint32_t*>(block + capacity * 20); }
+        uint32_t* sizeColumn() const { return reinterpret_cast<uint32_t*>(block + capacity * 24); }
+        OpCode* opColumn() const { return reinterpret_cast<OpCode*>(block + capacity * 28); }
+
+        void grow(size_t newCapacity);
+    };
+
+    enum class TokenKind : uint8_t { Number, Variable, Operator, Function, LParen, RParen, Comma };
+
+    // One lexed token. Spans point into the AST's own copy of the source text,
+    // and numbers are parsed once by the lexer. The lexer reads "-" as Sub
+    // and every name as a Variable; handleUnaryOperators() turns them into
+    // Neg and Function where the context says so.
+    struct Token {
+        TokenKind kind;
+        OpCode op;   // Operator and Function tokens
+        string_view text;
+        double value;
     };
 
-    struct StringArray {
-        string* data;
-        int size;
+    // Growable token buffer with geometric growth.
+    struct TokenArray {
+        Token* data;
+        size_t size;
+        size_t capacity;
 
-        StringArray() : data(nullptr), size(0) {}
+        TokenArray() : data(nullptr), size(0), capacity(0) {}
+        ~TokenArray();
 
-        void add(string s);
+        TokenArray(const TokenArray&) = delete;
+        TokenArray& operator=(const TokenArray&) = delete;
+
+        void add(const Token& t) {
+            if (size == capacity) reserve(capacity ? capacity * 2 : 16);
+            data[size++] = t;
+        }
+        void reserve(size_t n);
         void clear();
     };
 
+    // Every fold simplifyLowestLevel would perform, computed in one pass.
+    // A constant operator of height h (leaves have height 1) folds at step
+    // h - 1, so the whole walk-through is known up front. Per-node columns are
+    // indexed by NodeId over the arena the schedule was built from.
+    struct ReductionSchedule {
+        static constexpr uint32_t NEVER = UINT32_MAX;
+
+        vector<uint32_t> height;      // subtree height of every reachable node
+        vector<uint32_t> foldStep;    // step at which the node becomes a leaf, or NEVER
+        vector<double> foldedValue;   // the leaf value it becomes, at full precision
+        vector<NodeId> order;         // folded nodes sorted by step
+        vector<size_t> stepBegin;     // order[stepBegin[s-1], stepBegin[s]) fold at step s
+        size_t failingStep = 0;       // first step that divides by zero, 0 if none
+
+        size_t steps() const { return stepBegin.empty() ? 0 : stepBegin.size() - 1; }
+    };
+
 private:
-    BNode* head;
+    // The benchmark suite times the private construction stages one by one.
+    friend struct AstStages;
+    friend class StreamingParser;
+    friend class IncrementalParser;
 
-    StringArray postfixContainer;
+    shared_ptr<NodeArena> nodes;
+    NodeId head;
 
-    int getPrecedence(const string& op);
-    bool isOperator(const string& part);
-    double calculateRecursive(BNode* node);
+    shared_ptr<const string> source;
+    TokenArray postfixContainer;
+    shared_ptr<const vector<string>> variables;
 
-    StringArray tokenize(const string& expression);
-    StringArray handleUnaryOperators(const StringArray& tokens);
-    void infixToPostfix(const StringArray& tokens);
+    // Defined in ASTOperators.cpp.
+    static array<Operator, 256> operators;
+    static bool findFunction(string_view name, OpCode& op);
+    // The code of a called function; throws if there is no such function.
+    static OpCode functionCode(string_view name);
+    static OpCode addFunction(const string& name, uint8_t arity, UnaryFunction unary, BinaryFunction binary);
+    static string missingOperands(OpCode op);
+    static string depthError(size_t maxDepth);
+
+    // Resolves what the lexer leaves open, the same way in every parser: it
+    // reads "-" as Sub and every name as a Variable. A minus is unary at the
+    // start or after an operator, "(" or ","; a name followed by "(" is a
+    // call. Tokens go through read() one at a time in text order.
+    class TokenClassifier {
+    public:
+        TokenClassifier() : prev(TokenKind::LParen) {}
 
-    BNode* copyTree(BNode* node);
-    double calculateOp(const string& op, double left, double right);
+        // Returns the kind to parse the token as, and turns Sub into Neg.
+        // parenFollows says whether the next token is "(".
+        TokenKind read(TokenKind kind, OpCode& op, bool parenFollows) {
+            if (kind == TokenKind::Variable && parenFollows) {
+                kind = TokenKind::Function;
+            } else if (kind == TokenKind::Operator && op == OpCode::Sub
+                       && (prev == TokenKind::Operator || prev == TokenKind::LParen || prev == TokenKind::Comma)) {
+                op = OpCode::Neg;
+            }
+            prev = kind;
+            return kind;
+        }
+
+    private:
+        TokenKind prev;
+    };
+
+    // Shunting-yard over the operator, function, parenthesis and comma tokens
+    // of an expression, shared by every parser. Tokens must already have
+    // been through TokenClassifier, and calls looked up. Operators leave through emit(op) in
+    // postfix order, and a function once its closing parenthesis is read.
+    class OperatorStack {
+    public:
+        explicit OperatorStack(size_t maxDepth) : maxDepth(maxDepth), nesting(0) {}
+
+        size_t size() const { return items.size(); }
+        void clear() { items.clear(); nesting = 0; }
+
+        template <typename Emit>
+        void read(TokenKind kind, OpCode op, Emit&& emit) {
+            if (kind == TokenKind::Operator) {
+                // A prefix operator has no left operand to finish yet.
+                const Operator& entry = getOperator(op);
+                while (entry.arity == 2 && !items.empty() && items.back().kind == TokenKind::Operator) {
+                    const Operator& top = getOperator(items.back().op);
+                    if (top.precedence < entry.precedence
+                        || (top.precedence == entry.precedence && entry.rightAssociative)) break;
+                    emit(items.back().op);
+                    items.pop_back();
+                }
+                items.push_back({kind, op, 0});
+            } else if (kind == TokenKind::Function) {
+                items.push_back({kind, op, 0});
+            } else if (kind == TokenKind::LParen) {
+                if (++nesting > maxDepth) throw runtime_error(depthError(maxDepth));
+                items.push_back({kind, op, 0});
+            } else {
+                while (!items.empty() && items.back().kind == TokenKind::Operator) {
+                    emit(items.back().op);
+                    items.pop_back();
+                }
+                if (kind == TokenKind::Comma) {
+                    if (items.size() < 2 || items[items.size() - 2].kind != TokenKind::Function) {
+                        throw runtime_error("Error: Unexpected ',' outside a function call.");
+                    }
+                    ++items.back().commas;
+                    return;
+                }
+                // A stray ")" is ignored.
+                if (items.empty()) return;
+                size_t arguments = size_t(items.back().commas) + 1;
+                items.pop_back();
+                if (nesting) --nesting;
+                if (!items.empty() && items.back().kind == TokenKind::Function) {
+                    const Operator& function = getOperator(items.back().op);
+                    if (arguments != function.arity) {
+                        throw runtime_error(string("Error: ") + function.name + "() takes " + to_string(function.arity)
+                                            + (function.arity == 1 ? " argument." : " arguments."));
+                    }
+                    emit(items.back().op);
+                    items.pop_back();
+                }
+            }
+        }
+
+        // Emits the operators still waiting at the end of the input.
+        template <typename Emit>
+        void finish(Emit&& emit) {
+            for (; !items.empty(); items.pop_back()) {
+                if (items.back().kind != TokenKind::Operator) throw runtime_error("Error: Unmatched left parenthesis.");
+                emit(items.back().op);
+            }
+        }
+
+    private:
+        struct Item {
+            TokenKind kind;     // Operator, Function or LParen
+            OpCode op;
+            uint32_t commas;    // of an LParen, inside a call
+        };
+        vector<Item> items;
+        size_t maxDepth;
+        size_t nesting;
+    };
+
+    // The tree-building step of buildTree(), shared by every parser: the stack
+    // of finished subtrees and their heights, fed leaves and operators in
+    // postfix order. A bad operator goes to fail(message), which throws or,
+    // for a parser that reports errors later, records the message; apply()
+    // then returns false and the stack is no longer meaningful.
+    class TreeBuilder {
+    public:
+        explicit TreeBuilder(size_t maxDepth) : maxDepth(maxDepth) {}
+
+        size_t size() const { return nodeStack.size(); }
+        NodeId top() const { return nodeStack.back(); }
+        size_t height() const { return heights.back(); }
+        void clear() { nodeStack.clear(); heights.clear(); }
+
+        void leaf(NodeId id) {
+            nodeStack.push_back(id);
+            heights.push_back(1);
+        }
+
+        template <typename Fail>
+        bool apply(NodeArena& nodes, OpCode op, Fail&& fail) {
+            if (isUnary(op)) {
+                if (nodeStack.empty()) return fail(missingOperands(op)), false;
+                if (heights.back() + 1 > maxDepth) return fail(depthError(maxDepth)), false;
+                ++heights.back();
+                nodeStack.back() = nodes.add(op, NO_NODE, nodeStack.back());
+                return true;
+            }
+            if (nodeStack.size() < 2) return fail(missingOperands(op)), false;
+            size_t height = 1 + max(heights[heights.size() - 2], heights.back());
+            if (height > maxDepth) return fail(depthError(maxDepth)), false;
+            NodeId right = nodeStack.back();
+            nodeStack.pop_back();
+            heights.pop_back();
+            heights.back() = height;
+            nodeStack.back() = nodes.add(op, nodeStack.back(), right);
+            return true;
+        }
+
+        void apply(NodeArena& nodes, OpCode op) {
+            apply(nodes, op, [](string message) { throw runtime_error(message); });
+        }
+
+    private:
+        vector<NodeId> nodeStack;
+        vector<size_t> heights;   // height of each subtree on nodeStack
+        size_t maxDepth;
+    };
+    // Most expressions have no variables; they all share one empty list.
+    static const shared_ptr<const vector<string>>& noVariables();
+    size_t maxDepth;
+    // True when nodes [0, head] are exactly this tree in postfix order (fresh
+    // builds); path-copied versions interleave nodes of other versions.
+    bool postfixLayout;
+    // True for optimize() results: nodes [0, head] are exactly the distinct
+    // subexpressions, each stored once, children before parents.
+    bool interned;
+
+    double calculateFrom(NodeId node, const double* values) const;
+    double calculatePostfixRange(NodeId first, NodeId last, const double* values) const;
+    double calculateInterned(const double* values) const;
+    static bool isLeaf(OpCode op) { return op == OpCode::Number || op == OpCode::Variable; }
+    static bool isUnary(OpCode op) { return getOperator(op).arity == 1; }
+
+    // Defined in ASTLexer.cpp.
+    static void tokenize(string_view expression, TokenArray& tokens);
+    void handleUnaryOperators(TokenArray& tokens);
+    void infixToPostfix(const TokenArray& tokens);
+
+    static double calculateOp(OpCode op, double left, double right);
+
+    // A version that shares source text and variables with `base`.
+    AST(const AST& base, shared_ptr<NodeArena> arena, NodeId root);
+    // A tree whose leaf labels are spans of `source`. `postfix` says whether
+    // nodes [0, root] are exactly this tree in postfix order.
+    AST(shared_ptr<NodeArena> arena, NodeId root, shared_ptr<const string> source,
+        shared_ptr<const vector<string>> variables, size_t maxDepth, bool postfix);
 
-    int getMaxDepth(BNode* node);
-    bool simplifyAtDepth(BNode* node, int currentDepth, int targetDepth);
 
 public:
-    AST(string expression);
+    // Trees (and parenthesis nesting) deeper than this are rejected with an
+    // error. Every algorithm here uses explicit stacks, so the limit bounds
+    // work and memory rather than protecting the native call stack.
+    static constexpr size_t DEFAULT_MAX_DEPTH = 1000000;
+
+    AST(string expression, size_t maxDepth = DEFAULT_MAX_DEPTH);
     ~AST();
 
+    // Copies are O(1): versions share one append-only arena, and
+    // simplifyLowestLevel path-copies only the nodes it changes. Versions that
+    // share an arena must not be modified from different threads at once.
     AST(const AST& other);
     AST& operator=(const AST& other);
 
     void buildTree();
     double calculate();
-    BNode* getRoot();
+    // Evaluates with values[i] bound to getVariables()[i].
+    double calculate(const double* values);
+
+    // Evaluates on `pool`, forking subtrees of at least `grain` nodes as
+    // separate tasks. Every operation is the same as in calculate(), so the
+    // result is bit-identical.
+    double calculateParallel(ThreadPool& pool, const double* values = nullptr, size_t grain = 1 << 14);
+
+    // Exact evaluation over rationals. Literals are read from the source
+    // text, so long integers and decimals such as 0.1 keep every digit; nodes
+    // folded by simplification carry their exact double value. Throws like
+    // calculate().
+    Rational calculateExact(const Rational* values = nullptr) const;
+
+    // Built in: + - * / % ^ (right-associative, above unary minus), and
+    // sqrt, sin, cos, tan, exp, ln, abs, min and max. % and ^ are fmod and
+    // pow; only / throws on a zero divisor.
+    static const Operator& getOperator(OpCode op) { return operators[static_cast<uint8_t>(op)]; }
+    // Makes `name` callable in expressions parsed from then on and returns
+    // its code. Register before parsing, from one thread: the table is not
+    // locked. Constant calls are folded ahead of time, so the function must
+    // be pure. Throws if the name is not an identifier or is already taken,
+    // or if the table is full.
+    static OpCode registerFunction(const string& name, UnaryFunction function);
+    static OpCode registerFunction(const string& name, BinaryFunction function);
+
+    // Instruction set the lexer dispatches to on this CPU.
+    static const char* lexerName();
+
+    // Variable names in order of first appearance.
+    const vector<string>& getVariables() const { return *variables; }
+    int variableIndex(string_view name) const;
+
+    // Lowers the tree to postfix bytecode that can be evaluated repeatedly.
+    // Shared nodes of an optimized tree are computed once and reloaded.
+    Program compile() const;
+
+    // Interns structurally identical subtrees into one DAG node, folds
+    // constant subtrees and drops x*1, 1*x, x/1, x+0, 0+x, x-0 and --x.
+    // Results match calculate() except that x+0 and x-(-0) turn -0 into 0.
+    // Divisions by zero are left in place so evaluation still reports them.
+    // Evaluating the result computes every distinct subexpression once.
+    AST optimize() const;
+
+    // Read-only traversal for viewers. Leaves have NO_NODE children and unary
+    // operators and functions only have a right child.
+    NodeId getRoot() const { return head; }
+    NodeId getLeft(NodeId node) const { return nodes->left(node); }
+    NodeId getRight(NodeId node) const { return nodes->right(node); }
+    OpCode getOp(NodeId node) const { return nodes->op(node); }
+    double getValue(NodeId node) const { return nodes->value(node); }
+    // Size of the (possibly shared) arena, including nodes of other versions.
+    size_t nodeCount() const { return nodes->size(); }
+    string getLabel(NodeId node) const;
 
     bool simplifyLowestLevel();
+
+    ReductionSchedule reductionSchedule() const;
+    // The tree as it looks after `step` calls to simplifyLowestLevel, built
+    // directly in a fresh arena. Throws if that step divides by zero.
+    AST treeAtStep(const ReductionSchedule& schedule, size_t step) const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,343 @@
+#include "AST.h"
+#include "Cancellation.h"
+#include "CpuFeatures.h"
+#include "Instrumentation.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+using namespace std;
+
+// AST::tokenize. On x86-64 the input is classified 64 bytes at a time into
+// bitmasks (SSE2, or AVX2 when the CPU has it). Tokens start at the edges
+// of those masks and a count of trailing zeros finds where each one ends,
+// so the scanner jumps from token to token instead of testing every byte.
+// Elsewhere, or with STC_SIMD=scalar, a byte-at-a-time loop does the same
+// job. Both produce identical tokens and throw identical errors.
+
+namespace {
+
+typedef AST::TokenKind TokenKind;
+typedef AST::OpCode OpCode;
+
+bool isIdentifierStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool isIdentifierChar(char c) {
+    return isIdentifierStart(c) || (c >= '0' && c <= '9');
+}
+
+const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+double parseNumber(const char* start, const char* end) {
+    // Up to 15 digits form an exactly representable integer and 10^k is exact
+    // for k <= 22, so a single division rounds correctly, just as from_chars
+    // does. Longer literals go to from_chars.
+    if (end - start <= 16) {
+        uint64_t mantissa = 0;
+        int digits = 0;
+        const char* dot = nullptr;
+        bool simple = true;
+        for (const char* p = start; p < end && simple; ++p) {
+            if (*p != '.') {
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                ++digits;
+            } else if (dot) {
+                simple = false;
+            } else {
+                dot = p;
+            }
+        }
+        if (simple && digits > 0 && digits <= 15) {
+            size_t fraction = dot ? end - dot - 1 : 0;
+            return fraction ? double(mantissa) / POWERS_OF_TEN[fraction] : double(mantissa);
+        }
+    }
+    double value = 0;
+    auto res = from_chars(start, end, value);
+    if (res.ec != errc() || res.ptr != end) {
+        throw runtime_error("Error: Invalid number '" + string(start, end) + "'.");
+    }
+    return value;
+}
+
+void addLeaf(AST::TokenArray& tokens, TokenKind kind, const char* start, const char* end) {
+    string_view text(start, end - start);
+    tokens.add({kind, OpCode::Number, text, kind == TokenKind::Number ? parseNumber(start, end) : 0.0});
+}
+
+AST::Token symbolToken(const char* at) {
+    TokenKind kind = TokenKind::Operator;
+    OpCode op = OpCode::Number;
+    switch (*at) {
+        case '+': op = OpCode::Add; break;
+        case '-': op = OpCode::Sub; break;
+        case '*': op = OpCode::Mul; break;
+        case '/': op = OpCode::Div; break;
+        case '%': op = OpCode::Mod; break;
+        case '^': op = OpCode::Pow; break;
+        case '(': kind = TokenKind::LParen; break;
+        case ')': kind = TokenKind::RParen; break;
+        default: kind = TokenKind::Comma; break;
+    }
+    return {kind, op, string_view(at, 1), 0.0};
+}
+
+void tokenizeScalar(string_view expression, AST::TokenArray& tokens) {
+    const char* begin = expression.data();
+    const char* end = begin + expression.size();
+    const char* p = begin;
+    size_t polls = 0;
+
+    while (p < end) {
+        if ((++polls & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(p - begin, end - begin);
+        char c = *p;
+        switch (c) {
+            case '+': case '-': case '*': case '/': case '%': case '^': case '(': case ')': case ',':
+                tokens.add(symbolToken(p));
+                ++p;
+                continue;
+            case ' ': case '\t': case '\r': case '\n':
+                ++p;
+                continue;
+        }
+        const char* start = p;
+        if (isIdentifierStart(c)) {
+            while (p < end && isIdentifierChar(*p)) ++p;
+            addLeaf(tokens, TokenKind::Variable, start, p);
+            continue;
+        }
+        while (p < end && ((*p >= '0' && *p <= '9') || *p == '.')) ++p;
+        if (p == start) throw runtime_error(string("Error: Unexpected character '") + c + "'.");
+        addLeaf(tokens, TokenKind::Number, start, p);
+    }
+}
+
+#ifdef STC_X86_64
+
+// Bit i of each mask describes byte i of a 64-byte block.
+struct BlockMasks {
+    uint64_t alpha;    // letters and '_'
+    uint64_t digit;
+    uint64_t dot;
+    uint64_t symbol;   // + - * / % ^ ( ) ,
+    uint64_t other;    // anything that is not one of the above or whitespace
+};
+
+constexpr size_t BLOCK = 64;
+constexpr size_t BATCH = 64;   // blocks classified per call
+
+typedef void (*Classifier)(const char* p, size_t blocks, BlockMasks* out);
+
+// --- SSE2 (baseline on x86-64) -------------------------------------------
+
+// Signed compares treat bytes >= 0x80 as negative, so they never land in an
+// ASCII range. The symbols are 0x28-0x2F minus '.', plus '%' and '^'.
+void sse2Classify(const char* p, size_t blocks, BlockMasks* out) {
+    const __m128i belowDigit = _mm_set1_epi8('0' - 1), aboveDigit = _mm_set1_epi8('9' + 1);
+    const __m128i belowLower = _mm_set1_epi8('a' - 1), aboveLower = _mm_set1_epi8('z' + 1);
+    const __m128i belowSymbol = _mm_set1_epi8('(' - 1), aboveSymbol = _mm_set1_epi8('/' + 1);
+    const __m128i caseBit = _mm_set1_epi8(0x20), underscore = _mm_set1_epi8('_');
+    const __m128i dot = _mm_set1_epi8('.'), percent = _mm_set1_epi8('%'), caret = _mm_set1_epi8('^');
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n'), carriageReturn = _mm_set1_epi8('\r');
+
+    for (size_t b = 0; b < blocks; ++b, p += BLOCK) {
+        BlockMasks m = {};
+        for (int i = 0; i < 4; ++i) {
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+            __m128i lower = _mm_or_si128(c, caseBit);
+            __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, belowDigit), _mm_cmplt_epi8(c, aboveDigit));
+            __m128i alpha = _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(lower, belowLower), _mm_cmplt_epi8(lower, aboveLower)),
+                                         _mm_cmpeq_epi8(c, underscore));
+            __m128i isDot = _mm_cmpeq_epi8(c, dot);
+            __m128i symbol = _mm_or_si128(_mm_andnot_si128(isDot, _mm_and_si128(_mm_cmpgt_epi8(c, belowSymbol),
+                                                                                 _mm_cmplt_epi8(c, aboveSymbol))),
+                                          _mm_or_si128(_mm_cmpeq_epi8(c, percent), _mm_cmpeq_epi8(c, caret)));
+            __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, space), _mm_cmpeq_epi8(c, tab)),
+                                         _mm_or_si128(_mm_cmpeq_epi8(c, newline), _mm_cmpeq_epi8(c, carriageReturn)));
+            __m128i known = _mm_or_si128(_mm_or_si128(digit, alpha), _mm_or_si128(_mm_or_si128(isDot, symbol), blank));
+            int shift = 16 * i;
+            m.alpha |= uint64_t(uint16_t(_mm_movemask_epi8(alpha))) << shift;
+            m.digit |= uint64_t(uint16_t(_mm_movemask_epi8(digit))) << shift;
+            m.dot |= uint64_t(uint16_t(_mm_movemask_epi8(isDot))) << shift;
+            m.symbol |= uint64_t(uint16_t(_mm_movemask_epi8(symbol))) << shift;
+            m.other |= uint64_t(uint16_t(~_mm_movemask_epi8(known))) << shift;
+        }
+        *out++ = m;
+    }
+}
+
+// --- AVX2 ----------------------------------------------------------------
+
+STC_TARGET_AVX2 void avx2Classify(const char* p, size_t blocks, BlockMasks* out) {
+    const __m256i belowDigit = _mm256_set1_epi8('0' - 1), aboveDigit = _mm256_set1_epi8('9' + 1);
+    const __m256i belowLower = _mm256_set1_epi8('a' - 1), aboveLower = _mm256_set1_epi8('z' + 1);
+    const __m256i belowSymbol = _mm256_set1_epi8('(' - 1), aboveSymbol = _mm256_set1_epi8('/' + 1);
+    const __m256i caseBit = _mm256_set1_epi8(0x20), underscore = _mm256_set1_epi8('_');
+    const __m256i dot = _mm256_set1_epi8('.'), percent = _mm256_set1_epi8('%'), caret = _mm256_set1_epi8('^');
+    const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n'), carriageReturn = _mm256_set1_epi8('\r');
+
+    for (size_t b = 0; b < blocks; ++b, p += BLOCK) {
+        BlockMasks m = {};
+        for (int i = 0; i < 2; ++i) {
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * i));
+            __m256i lower = _mm256_or_si256(c, caseBit);
+            __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, belowDigit), _mm256_cmpgt_epi8(aboveDigit, c));
+            __m256i alpha = _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi8(lower, belowLower),
+                                                             _mm256_cmpgt_epi8(aboveLower, lower)),
+                                            _mm256_cmpeq_epi8(c, underscore));
+            __m256i isDot = _mm256_cmpeq_epi8(c, dot);
+            __m256i symbol = _mm256_or_si256(_mm256_andnot_si256(isDot, _mm256_and_si256(_mm256_cmpgt_epi8(c, belowSymbol),
+                                                                                          _mm256_cmpgt_epi8(aboveSymbol, c))),
+                                             _mm256_or_si256(_mm256_cmpeq_epi8(c, percent), _mm256_cmpeq_epi8(c, caret)));
+            __m256i blank = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, space), _mm256_cmpeq_epi8(c, tab)),
+                                            _mm256_or_si256(_mm256_cmpeq_epi8(c, newline),
+                                                            _mm256_cmpeq_epi8(c, carriageReturn)));
+            __m256i known = _mm256_or_si256(_mm256_or_si256(digit, alpha),
+                                            _mm256_or_si256(_mm256_or_si256(isDot, symbol), blank));
+            int shift = 32 * i;
+            m.alpha |= uint64_t(uint32_t(_mm256_movemask_epi8(alpha))) << shift;
+            m.digit |= uint64_t(uint32_t(_mm256_movemask_epi8(digit))) << shift;
+            m.dot |= uint64_t(uint32_t(_mm256_movemask_epi8(isDot))) << shift;
+            m.symbol |= uint64_t(uint32_t(_mm256_movemask_epi8(symbol))) << shift;
+            m.other |= uint64_t(uint32_t(~_mm256_movemask_epi8(known))) << shift;
+        }
+        *out++ = m;
+    }
+}
+
+inline unsigned lowestBit(uint64_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return unsigned(index);
+#else
+    return unsigned(__builtin_ctzll(x));
+#endif
+}
+
+void tokenizeBlocks(Classifier classify, string_view expression, AST::TokenArray& tokens) {
+    const char* begin = expression.data();
+    const size_t length = expression.size();
+    BlockMasks masks[BATCH];
+    char tail[BLOCK];
+
+    // Whether the last byte of the previous block was in an identifier or a
+    // number, and the token that runs on past the end of that block.
+    uint64_t identCarry = 0, numberCarry = 0;
+    const char* leafStart = nullptr;
+    TokenKind leafKind = TokenKind::Number;
+
+    for (size_t offset = 0; offset < length; offset += BATCH * BLOCK) {
+        CancellationScope::checkpoint(offset, length);
+        size_t blocks = min(BATCH, (length - offset) / BLOCK);
+        classify(begin + offset, blocks, masks);
+        size_t rest = length - offset - blocks * BLOCK;
+        if (blocks < BATCH && rest > 0) {
+            // The last partial block is padded with spaces, which end any
+            // token exactly at the end of the input.
+            memset(tail, ' ', BLOCK);
+            memcpy(tail, begin + offset + blocks * BLOCK, rest);
+            classify(tail, 1, masks + blocks++);
+        }
+
+        for (size_t b = 0; b < blocks; ++b) {
+            const BlockMasks& m = masks[b];
+            const char* base = begin + offset + b * BLOCK;
+
+            // An identifier runs from a letter through the letters and digits
+            // after it. Adding its first bit to the run of word bits carries
+            // through to the end of the run and clears the bits in between.
+            uint64_t word = m.alpha | m.digit;
+            uint64_t starts = m.alpha | (word & identCarry);
+            uint64_t ident = (~(word + starts) & word) | starts;
+            uint64_t number = (m.digit | m.dot) & ~ident;
+
+            uint64_t identStarts = ident & ~((ident << 1) | identCarry);
+            uint64_t numberStarts = number & ~((number << 1) | numberCarry);
+            identCarry = ident >> 63;
+            numberCarry = number >> 63;
+
+            // A token carried over from the previous block ends at the first
+            // byte outside its run, unless the run fills this block too.
+            if (leafStart) {
+                uint64_t outside = ~(leafKind == TokenKind::Variable ? ident : number);
+                if (!outside) continue;
+                addLeaf(tokens, leafKind, leafStart, base + lowestBit(outside));
+                leafStart = nullptr;
+            }
+
+            uint64_t events = identStarts | numberStarts | m.symbol | m.other;
+            while (events) {
+                unsigned bit = lowestBit(events);
+                events &= events - 1;
+                uint64_t here = uint64_t(1) << bit;
+                const char* at = base + bit;
+                if (m.symbol & here) {
+                    tokens.add(symbolToken(at));
+                } else if (m.other & here) {
+                    throw runtime_error(string("Error: Unexpected character '") + *at + "'.");
+                } else {
+                    TokenKind kind = (ident & here) ? TokenKind::Variable : TokenKind::Number;
+                    uint64_t run = (kind == TokenKind::Variable ? ident : number) >> bit;
+                    unsigned end = ~run ? bit + lowestBit(~run) : unsigned(BLOCK);
+                    if (end == BLOCK) {
+                        leafStart = at;
+                        leafKind = kind;
+                    } else {
+                        addLeaf(tokens, kind, at, base + end);
+                    }
+                }
+            }
+        }
+    }
+    if (leafStart) addLeaf(tokens, leafKind, leafStart, begin + length);
+}
+
+#endif
+
+enum class Lexer { Scalar, Sse2, Avx2 };
+
+Lexer selectLexer() {
+    string_view limit = simdLimit();
+    if (limit == "scalar") return Lexer::Scalar;
+#ifdef STC_X86_64
+    if (limit != "sse2" && cpuHasAvx2()) return Lexer::Avx2;
+    return Lexer::Sse2;
+#else
+    return Lexer::Scalar;
+#endif
+}
+
+Lexer lexer() {
+    static const Lexer selected = selectLexer();
+    return selected;
+}
+
+}
+
+const char* AST::lexerName() {
+    switch (lexer()) {
+        case Lexer::Avx2: return "avx2";
+        case Lexer::Sse2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+void AST::tokenize(string_view expression, TokenArray& tokens) {
+    STC_TRACE_SCOPE("tokenize");
+    tokens.reserve(expression.size() / 2 + 1);
+    switch (lexer()) {
+#ifdef STC_X86_64
+        case Lexer::Avx2: tokenizeBlocks(avx2Classify, expression, tokens); break;
+        case Lexer::Sse2: tokenizeBlocks(sse2Classify, expression, tokens); break;
+#endif
+        default: tokenizeScalar(expression, tokens); break;
+    }
+}
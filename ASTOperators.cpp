@@ -0,0 +1,97 @@
+#include "AST.h"
+#include <array>
+#include <deque>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+// The operator table behind AST::getOperator(): the built-ins of
+// BuiltinOperators.h, then registered functions. It is constant-initialized,
+// so it is complete before any static constructor can parse an expression.
+
+namespace {
+
+// Names of registered functions; a deque never moves its elements.
+deque<string>& registeredNames() {
+    static deque<string> names;
+    return names;
+}
+
+// Code of every function name, filled from the table on first use and by
+// addFunction(). Keys point at the table's names.
+unordered_map<string_view, AST::OpCode>& functionCodes(const AST::Operator* table) {
+    static unordered_map<string_view, AST::OpCode> codes = [table]() {
+        unordered_map<string_view, AST::OpCode> builtins;
+        for (size_t i = 0; i < 256; ++i) {
+            if (table[i].function) builtins.emplace(table[i].name, static_cast<AST::OpCode>(i));
+        }
+        return builtins;
+    }();
+    return codes;
+}
+
+constexpr array<AST::Operator, 256> builtinTable() {
+    array<AST::Operator, 256> table = {};
+    for (size_t i = 0; i < BUILTIN_OPERATOR_COUNT; ++i) table[i] = BUILTIN_OPERATORS[i];
+    return table;
+}
+
+bool isIdentifier(const string& name) {
+    if (name.empty()) return false;
+    for (size_t i = 0; i < name.size(); ++i) {
+        char c = name[i];
+        bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+        if (!letter && (i == 0 || c < '0' || c > '9')) return false;
+    }
+    return true;
+}
+
+}
+
+static_assert(BUILTIN_OPERATOR_COUNT == static_cast<size_t>(AST::OpCode::BuiltinCount),
+              "every built-in code needs a table entry");
+
+constinit array<AST::Operator, 256> AST::operators = builtinTable();
+
+bool AST::findFunction(string_view name, OpCode& op) {
+    const unordered_map<string_view, OpCode>& codes = functionCodes(operators.data());
+    auto it = codes.find(name);
+    if (it == codes.end()) return false;
+    op = it->second;
+    return true;
+}
+
+AST::OpCode AST::addFunction(const string& name, uint8_t arity, UnaryFunction unary, BinaryFunction binary) {
+    if (!isIdentifier(name)) throw runtime_error("Error: '" + name + "' is not a valid function name.");
+    OpCode existing;
+    if (findFunction(name, existing)) throw runtime_error("Error: Function '" + name + "' is already defined.");
+    if (!unary && !binary) throw runtime_error("Error: Function '" + name + "' has no implementation.");
+    size_t code = static_cast<size_t>(OpCode::BuiltinCount);
+    while (code < 256 && operators[code].arity != 0) ++code;
+    if (code == 256) throw runtime_error("Error: Too many functions.");
+    registeredNames().push_back(name);
+    operators[code] = {registeredNames().back().c_str(), arity, 0, false, true, unary, binary};
+    functionCodes(operators.data()).emplace(registeredNames().back(), static_cast<OpCode>(code));
+    return static_cast<OpCode>(code);
+}
+
+AST::OpCode AST::registerFunction(const string& name, UnaryFunction function) {
+    return addFunction(name, 1, function, nullptr);
+}
+
+AST::OpCode AST::registerFunction(const string& name, BinaryFunction function) {
+    return addFunction(name, 2, nullptr, function);
+}
+
+AST::OpCode AST::functionCode(string_view name) {
+    OpCode op;
+    if (!findFunction(name, op)) throw runtime_error("Error: Unknown function '" + string(name) + "'.");
+    return op;
+}
+
+string AST::missingOperands(OpCode op) {
+    if (op == OpCode::Neg) return "Missing operand for unary -";
+    const Operator& entry = getOperator(op);
+    return string(entry.arity == 1 ? "Missing operand for " : "Missing operands for ") + entry.name;
+}
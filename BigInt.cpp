@@ -0,0 +1,449 @@
+#include "BigInt.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+using namespace std;
+
+
+using Limbs = vector<uint32_t>;
+
+// Below this many limbs schoolbook multiplication wins.
+static const size_t KARATSUBA_LIMBS = 32;
+static const int64_t SMALL_MAX = numeric_limits<int64_t>::max();
+
+static void trim(Limbs& a) {
+    while (!a.empty() && a.back() == 0) a.pop_back();
+}
+
+static Limbs fromUint64(uint64_t value) {
+    Limbs a;
+    if (value) a.push_back(uint32_t(value));
+    if (value >> 32) a.push_back(uint32_t(value >> 32));
+    return a;
+}
+
+static int compareMagnitude(const Limbs& a, const Limbs& b) {
+    if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0;) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static Limbs addMagnitude(const Limbs& a, const Limbs& b) {
+    const Limbs& longer = a.size() >= b.size() ? a : b;
+    const Limbs& shorter = a.size() >= b.size() ? b : a;
+    Limbs sum(longer.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < longer.size(); ++i) {
+        carry += uint64_t(longer[i]) + (i < shorter.size() ? shorter[i] : 0);
+        sum[i] = uint32_t(carry);
+        carry >>= 32;
+    }
+    sum[longer.size()] = uint32_t(carry);
+    trim(sum);
+    return sum;
+}
+
+// a - b for a >= b.
+static Limbs subMagnitude(const Limbs& a, const Limbs& b) {
+    Limbs diff(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        int64_t t = int64_t(a[i]) - borrow - (i < b.size() ? int64_t(b[i]) : 0);
+        borrow = t < 0;
+        diff[i] = uint32_t(t);
+    }
+    trim(diff);
+    return diff;
+}
+
+// out[offset...] += a; `out` must be large enough for the carry.
+static void addInto(Limbs& out, const Limbs& a, size_t offset) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < a.size(); ++i) {
+        carry += uint64_t(out[offset + i]) + a[i];
+        out[offset + i] = uint32_t(carry);
+        carry >>= 32;
+    }
+    for (; carry; ++i) {
+        carry += out[offset + i];
+        out[offset + i] = uint32_t(carry);
+        carry >>= 32;
+    }
+}
+
+static Limbs mulSchoolbook(const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+    Limbs product(an + bn, 0);
+    for (size_t i = 0; i < an; ++i) {
+        uint64_t carry = 0;
+        uint64_t ai = a[i];
+        if (!ai) continue;
+        for (size_t j = 0; j < bn; ++j) {
+            carry += ai * b[j] + product[i + j];
+            product[i + j] = uint32_t(carry);
+            carry >>= 32;
+        }
+        product[i + bn] = uint32_t(carry);
+    }
+    trim(product);
+    return product;
+}
+
+static Limbs mulMagnitude(const uint32_t* a, size_t an, const uint32_t* b, size_t bn);
+
+// Karatsuba: with a = a1*B^m + a0 and b = b1*B^m + b0, three half-size
+// products give a*b = z2*B^2m + (z1 - z2 - z0)*B^m + z0.
+static Limbs mulKaratsuba(const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+    size_t m = max(an, bn) / 2;
+    Limbs product(an + bn + 1, 0);
+    if (bn <= m) {
+        // Unbalanced: split only the longer operand.
+        addInto(product, mulMagnitude(a, m, b, bn), 0);
+        addInto(product, mulMagnitude(a + m, an - m, b, bn), m);
+        trim(product);
+        return product;
+    }
+    Limbs a0(a, a + m), a1(a + m, a + an), b0(b, b + m), b1(b + m, b + bn);
+    trim(a0);
+    trim(b0);
+    Limbs z0 = mulMagnitude(a0.data(), a0.size(), b0.data(), b0.size());
+    Limbs z2 = mulMagnitude(a1.data(), a1.size(), b1.data(), b1.size());
+    Limbs sa = addMagnitude(a0, a1);
+    Limbs sb = addMagnitude(b0, b1);
+    Limbs z1 = subMagnitude(subMagnitude(mulMagnitude(sa.data(), sa.size(), sb.data(), sb.size()), z0), z2);
+    addInto(product, z0, 0);
+    addInto(product, z1, m);
+    addInto(product, z2, 2 * m);
+    trim(product);
+    return product;
+}
+
+static Limbs mulMagnitude(const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+    if (an == 0 || bn == 0) return Limbs();
+    if (an < bn) { swap(a, b); swap(an, bn); }
+    if (bn < KARATSUBA_LIMBS) return mulSchoolbook(a, an, b, bn);
+    return mulKaratsuba(a, an, b, bn);
+}
+
+static Limbs divideSmall(const Limbs& a, uint32_t divisor, uint32_t& remainder) {
+    Limbs quotient(a.size());
+    uint64_t rest = 0;
+    for (size_t i = a.size(); i-- > 0;) {
+        rest = (rest << 32) | a[i];
+        quotient[i] = uint32_t(rest / divisor);
+        rest %= divisor;
+    }
+    trim(quotient);
+    remainder = uint32_t(rest);
+    return quotient;
+}
+
+// Knuth's algorithm D (TAOCP 4.3.1) in the form of Hacker's Delight divmnu.
+static void divideMagnitude(const Limbs& u, const Limbs& v, Limbs& quotient, Limbs& remainder) {
+    if (compareMagnitude(u, v) < 0) {
+        quotient.clear();
+        remainder = u;
+        return;
+    }
+    if (v.size() == 1) {
+        uint32_t rest;
+        quotient = divideSmall(u, v[0], rest);
+        remainder = fromUint64(rest);
+        return;
+    }
+    size_t n = v.size();
+    size_t m = u.size();
+    // Normalize so the divisor's top limb has its high bit set.
+    int s = countl_zero(v.back());
+    Limbs vn(n), un(m + 1);
+    for (size_t i = n - 1; i > 0; --i) vn[i] = (v[i] << s) | (s ? uint32_t(uint64_t(v[i - 1]) >> (32 - s)) : 0);
+    vn[0] = v[0] << s;
+    un[m] = s ? uint32_t(uint64_t(u[m - 1]) >> (32 - s)) : 0;
+    for (size_t i = m - 1; i > 0; --i) un[i] = (u[i] << s) | (s ? uint32_t(uint64_t(u[i - 1]) >> (32 - s)) : 0);
+    un[0] = u[0] << s;
+
+    const uint64_t base = uint64_t(1) << 32;
+    quotient.assign(m - n + 1, 0);
+    for (size_t j = m - n + 1; j-- > 0;) {
+        uint64_t top = (uint64_t(un[j + n]) << 32) | un[j + n - 1];
+        uint64_t qhat = top / vn[n - 1];
+        uint64_t rhat = top % vn[n - 1];
+        while (qhat >= base || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+            --qhat;
+            rhat += vn[n - 1];
+            if (rhat >= base) break;
+        }
+        // Multiply and subtract.
+        int64_t borrow = 0;
+        int64_t t;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t p = qhat * vn[i];
+            t = int64_t(un[i + j]) - borrow - int64_t(p & 0xFFFFFFFF);
+            un[i + j] = uint32_t(t);
+            borrow = int64_t(p >> 32) - (t >> 32);
+        }
+        t = int64_t(un[j + n]) - borrow;
+        un[j + n] = uint32_t(t);
+        quotient[j] = uint32_t(qhat);
+        if (t < 0) {
+            // qhat was one too large: add the divisor back.
+            --quotient[j];
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; ++i) {
+                carry += uint64_t(un[i + j]) + vn[i];
+                un[i + j] = uint32_t(carry);
+                carry >>= 32;
+            }
+            un[j + n] += uint32_t(carry);
+        }
+    }
+    remainder.assign(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        remainder[i] = (un[i] >> s) | (s ? uint32_t(uint64_t(un[i + 1]) << (32 - s)) : 0);
+    }
+    trim(quotient);
+    trim(remainder);
+}
+
+BigInt BigInt::minimum() {
+    BigInt result;
+    result.negative = true;
+    result.limbs = fromUint64(uint64_t(1) << 63);
+    return result;
+}
+
+BigInt BigInt::fromMagnitude(bool negative, Limbs magnitude) {
+    trim(magnitude);
+    BigInt result;
+    if (magnitude.size() <= 2) {
+        uint64_t value = magnitude.empty() ? 0 : magnitude[0];
+        if (magnitude.size() == 2) value |= uint64_t(magnitude[1]) << 32;
+        if (value <= uint64_t(SMALL_MAX)) {
+            result.small = negative ? -int64_t(value) : int64_t(value);
+            return result;
+        }
+    }
+    result.negative = negative;
+    result.limbs = move(magnitude);
+    return result;
+}
+
+BigInt::Limbs BigInt::magnitude() const {
+    if (!limbs.empty()) return limbs;
+    return fromUint64(small < 0 ? 0 - uint64_t(small) : uint64_t(small));
+}
+
+BigInt BigInt::parse(string_view digits) {
+    bool minus = !digits.empty() && digits[0] == '-';
+    if (minus) digits.remove_prefix(1);
+    if (digits.empty()) throw runtime_error("Error: Invalid integer.");
+    for (char c : digits) {
+        if (c < '0' || c > '9') throw runtime_error("Error: Invalid integer '" + string(digits) + "'.");
+    }
+    // Up to 18 digits fit an int64_t directly.
+    if (digits.size() <= 18) {
+        int64_t value = 0;
+        for (char c : digits) value = value * 10 + (c - '0');
+        return BigInt(minus ? -value : value);
+    }
+    // Fold nine digits at a time into the limbs.
+    Limbs magnitude;
+    size_t first = digits.size() % 9 ? digits.size() % 9 : 9;
+    for (size_t pos = 0; pos < digits.size(); pos += (pos ? 9 : first)) {
+        size_t len = pos ? 9 : first;
+        uint32_t chunk = 0;
+        uint32_t scale = 1;
+        for (size_t i = 0; i < len; ++i) {
+            chunk = chunk * 10 + (digits[pos + i] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (uint32_t& limb : magnitude) {
+            carry += uint64_t(limb) * scale;
+            limb = uint32_t(carry);
+            carry >>= 32;
+        }
+        if (carry) magnitude.push_back(uint32_t(carry));
+    }
+    return fromMagnitude(minus, move(magnitude));
+}
+
+BigInt BigInt::power2(size_t exponent) {
+    return BigInt(1) << exponent;
+}
+
+BigInt BigInt::power10(size_t exponent) {
+    // Square and multiply.
+    BigInt result(1);
+    BigInt base(10);
+    for (; exponent; exponent >>= 1) {
+        if (exponent & 1) result = result * base;
+        if (exponent > 1) base = base * base;
+    }
+    return result;
+}
+
+size_t BigInt::bitLength() const {
+    if (limbs.empty()) {
+        uint64_t value = small < 0 ? 0 - uint64_t(small) : uint64_t(small);
+        return 64 - countl_zero(value);
+    }
+    return limbs.size() * 32 - countl_zero(limbs.back());
+}
+
+size_t BigInt::trailingZeros() const {
+    if (limbs.empty()) return small ? countr_zero(uint64_t(small)) : 0;
+    size_t i = 0;
+    while (limbs[i] == 0) ++i;
+    return i * 32 + countr_zero(limbs[i]);
+}
+
+BigInt BigInt::operator-() const {
+    if (limbs.empty()) return BigInt(-small);
+    BigInt result = *this;
+    result.negative = !negative;
+    return fromMagnitude(result.negative, move(result.limbs));
+}
+
+BigInt BigInt::add(const BigInt& a, const BigInt& b) {
+    Limbs ma = a.magnitude(), mb = b.magnitude();
+    bool na = a.isNegative(), nb = b.isNegative();
+    if (na == nb) return fromMagnitude(na, addMagnitude(ma, mb));
+    int order = compareMagnitude(ma, mb);
+    if (order == 0) return BigInt();
+    return order > 0 ? fromMagnitude(na, subMagnitude(ma, mb)) : fromMagnitude(nb, subMagnitude(mb, ma));
+}
+
+BigInt BigInt::multiply(const BigInt& a, const BigInt& b) {
+    Limbs ma = a.magnitude(), mb = b.magnitude();
+    return fromMagnitude(a.isNegative() != b.isNegative(), mulMagnitude(ma.data(), ma.size(), mb.data(), mb.size()));
+}
+
+void BigInt::divide(const BigInt& a, const BigInt& b, BigInt& quotient, BigInt& remainder) {
+    if (b.isZero()) throw runtime_error("Div by zero");
+    if (a.isSmall() && b.isSmall()) {
+        int64_t q = a.small / b.small;   // INT64_MIN is never small, so this cannot overflow
+        int64_t r = a.small % b.small;
+        quotient = BigInt(q);
+        remainder = BigInt(r);
+        return;
+    }
+    Limbs q, r;
+    divideMagnitude(a.magnitude(), b.magnitude(), q, r);
+    quotient = fromMagnitude(a.isNegative() != b.isNegative(), move(q));
+    remainder = fromMagnitude(a.isNegative(), move(r));
+}
+
+BigInt operator/(const BigInt& a, const BigInt& b) {
+    BigInt q, r;
+    BigInt::divide(a, b, q, r);
+    return q;
+}
+
+BigInt operator%(const BigInt& a, const BigInt& b) {
+    BigInt q, r;
+    BigInt::divide(a, b, q, r);
+    return r;
+}
+
+BigInt BigInt::operator<<(size_t bits) const {
+    if (isZero() || bits == 0) return *this;
+    if (limbs.empty() && bits < 63 && bitLength() + bits < 63) return BigInt(small * (int64_t(1) << bits));
+    Limbs a = magnitude();
+    size_t whole = bits / 32;
+    int part = int(bits % 32);
+    Limbs shifted(a.size() + whole + 1, 0);
+    for (size_t i = 0; i < a.size(); ++i) {
+        shifted[i + whole] |= a[i] << part;
+        if (part) shifted[i + whole + 1] = uint32_t(uint64_t(a[i]) >> (32 - part));
+    }
+    return fromMagnitude(isNegative(), move(shifted));
+}
+
+BigInt BigInt::operator>>(size_t bits) const {
+    if (limbs.empty()) {
+        uint64_t value = small < 0 ? 0 - uint64_t(small) : uint64_t(small);
+        value = bits >= 64 ? 0 : value >> bits;
+        return BigInt(small < 0 ? -int64_t(value) : int64_t(value));
+    }
+    size_t whole = bits / 32;
+    if (whole >= limbs.size()) return BigInt();
+    int part = int(bits % 32);
+    Limbs shifted(limbs.size() - whole);
+    for (size_t i = 0; i < shifted.size(); ++i) {
+        uint64_t pair = limbs[i + whole];
+        if (i + whole + 1 < limbs.size()) pair |= uint64_t(limbs[i + whole + 1]) << 32;
+        shifted[i] = uint32_t(pair >> part);
+    }
+    return fromMagnitude(negative, move(shifted));
+}
+
+bool operator==(const BigInt& a, const BigInt& b) {
+    if (a.isSmall() != b.isSmall()) return false;   // the representation is canonical
+    if (a.isSmall()) return a.small == b.small;
+    return a.negative == b.negative && a.limbs == b.limbs;
+}
+
+int BigInt::compare(const BigInt& a, const BigInt& b) {
+    if (a.isSmall() && b.isSmall()) return a.small < b.small ? -1 : a.small > b.small;
+    bool na = a.isNegative(), nb = b.isNegative();
+    if (na != nb) return na ? -1 : 1;
+    int order = compareMagnitude(a.magnitude(), b.magnitude());
+    return na ? -order : order;
+}
+
+BigInt BigInt::gcd(const BigInt& a, const BigInt& b) {
+    if (a.isSmall() && b.isSmall()) {
+        uint64_t x = a.small < 0 ? 0 - uint64_t(a.small) : uint64_t(a.small);
+        uint64_t y = b.small < 0 ? 0 - uint64_t(b.small) : uint64_t(b.small);
+        return BigInt(int64_t(std::gcd(x, y)));
+    }
+    BigInt x = a.abs(), y = b.abs();
+    while (!y.isZero()) {
+        if (x.isSmall() && y.isSmall()) return gcd(x, y);
+        BigInt r = x % y;
+        x = move(y);
+        y = move(r);
+    }
+    return x;
+}
+
+string BigInt::toString() const {
+    if (limbs.empty()) return to_string(small);
+    // Peel off nine decimal digits at a time.
+    Limbs rest = limbs;
+    vector<uint32_t> chunks;
+    while (!rest.empty()) {
+        uint32_t chunk;
+        rest = divideSmall(rest, 1000000000, chunk);
+        chunks.push_back(chunk);
+    }
+    string text = negative ? "-" : "";
+    text += to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        string part = to_string(chunks[i]);
+        text.append(9 - part.size(), '0');
+        text += part;
+    }
+    return text;
+}
+
+double BigInt::toDouble() const {
+    if (limbs.empty()) return double(small);
+    // The top 64 bits carry more than a double's precision; the rest only
+    // scales the result.
+    size_t bits = bitLength();
+    size_t drop = bits > 64 ? bits - 64 : 0;
+    BigInt top = abs() >> drop;
+    uint64_t value = top.isSmall() ? uint64_t(top.small) : top.limbs[0] | (uint64_t(top.limbs.size() > 1 ? top.limbs[1] : 0) << 32);
+    // Keep a sticky bit so the conversion rounds like a correctly rounded one.
+    if (drop && (value & 1) == 0 && trailingZeros() < drop) value |= 1;
+    double result = ldexp(double(value), int(min<size_t>(drop, 4096)));
+    return negative ? -result : result;
+}
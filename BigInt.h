@@ -0,0 +1,117 @@
+#ifndef BIGINT_H
+#define BIGINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Arbitrary-precision signed integer. Values that fit in an int64_t are kept
+// inline and use plain machine arithmetic with overflow checks, so they never
+// touch the heap. Larger values keep their magnitude as base-2^32 limbs, and
+// large products switch from schoolbook to Karatsuba multiplication.
+class BigInt {
+public:
+    BigInt() : small(0), negative(false) {}
+    BigInt(int64_t value) : small(value), negative(false) {
+        if (value == INT64_MIN) *this = minimum();
+    }
+
+    // Decimal digits with an optional leading '-'. Throws runtime_error on
+    // anything else.
+    static BigInt parse(string_view digits);
+    // 2^exponent.
+    static BigInt power2(size_t exponent);
+    static BigInt power10(size_t exponent);
+
+    bool isZero() const { return limbs.empty() && small == 0; }
+    bool isOne() const { return limbs.empty() && small == 1; }
+    bool isNegative() const { return limbs.empty() ? small < 0 : negative; }
+    int sign() const { return isZero() ? 0 : isNegative() ? -1 : 1; }
+    // Inline, allocation-free representation.
+    bool isSmall() const { return limbs.empty(); }
+    // Number of bits in the magnitude; 0 for zero.
+    size_t bitLength() const;
+    // Number of trailing zero bits; 0 for zero.
+    size_t trailingZeros() const;
+
+    BigInt operator-() const;
+    BigInt abs() const { return isNegative() ? -*this : *this; }
+
+    // Small operands take an inline overflow-checked path.
+    friend BigInt operator+(const BigInt& a, const BigInt& b) {
+        int64_t sum;
+        if (a.isSmall() && b.isSmall() && !addOverflow(a.small, b.small, &sum)) return BigInt(sum);
+        return add(a, b);
+    }
+    friend BigInt operator-(const BigInt& a, const BigInt& b) {
+        int64_t diff;
+        if (a.isSmall() && b.isSmall() && !addOverflow(a.small, -b.small, &diff)) return BigInt(diff);
+        return add(a, -b);
+    }
+    friend BigInt operator*(const BigInt& a, const BigInt& b) {
+        int64_t product;
+        if (a.isSmall() && b.isSmall() && !mulOverflow(a.small, b.small, &product)) return BigInt(product);
+        return multiply(a, b);
+    }
+    // Truncating division, like C++ integers. Throws on division by zero.
+    friend BigInt operator/(const BigInt& a, const BigInt& b);
+    friend BigInt operator%(const BigInt& a, const BigInt& b);
+    static void divide(const BigInt& a, const BigInt& b, BigInt& quotient, BigInt& remainder);
+
+    BigInt operator<<(size_t bits) const;
+    // Shifts the magnitude, i.e. rounds toward zero.
+    BigInt operator>>(size_t bits) const;
+
+    friend bool operator==(const BigInt& a, const BigInt& b);
+    friend bool operator!=(const BigInt& a, const BigInt& b) { return !(a == b); }
+    friend bool operator<(const BigInt& a, const BigInt& b) { return compare(a, b) < 0; }
+    static int compare(const BigInt& a, const BigInt& b);
+
+    static BigInt gcd(const BigInt& a, const BigInt& b);
+
+    string toString() const;
+    // Nearest double; +-inf when out of range.
+    double toDouble() const;
+
+private:
+    using Limbs = vector<uint32_t>;
+
+    int64_t small;    // the value while `limbs` is empty
+    bool negative;    // sign of a large value
+    Limbs limbs;      // magnitude of a large value, least significant first
+
+    static BigInt fromMagnitude(bool negative, Limbs magnitude);
+    // INT64_MIN, which is stored as limbs so that negating a small value never overflows.
+    static BigInt minimum();
+    static BigInt add(const BigInt& a, const BigInt& b);
+    static BigInt multiply(const BigInt& a, const BigInt& b);
+
+    static bool addOverflow(int64_t a, int64_t b, int64_t* out) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_add_overflow(a, b, out);
+#else
+        if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) return true;
+        *out = a + b;
+        return false;
+#endif
+    }
+    static bool mulOverflow(int64_t a, int64_t b, int64_t* out) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_mul_overflow(a, b, out);
+#else
+        if (a == 0 || b == 0) { *out = 0; return false; }
+        uint64_t ua = a < 0 ? 0 - uint64_t(a) : uint64_t(a);
+        uint64_t ub = b < 0 ? 0 - uint64_t(b) : uint64_t(b);
+        if (ua > uint64_t(INT64_MAX) / ub) return true;
+        *out = a * b;
+        return false;
+#endif
+    }
+    Limbs magnitude() const;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef BUILTINOPERATORS_H
+#define BUILTINOPERATORS_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// An entry of the operator table. The table is indexed by AST::OpCode, so
+// parsing and evaluation never compare names; the only name lookup is
+// once per call such as "sqrt(". Leaves and unused codes have arity 0.
+struct OperatorInfo {
+    const char* name;                  // symbol or function name
+    uint8_t arity;                     // 1 (the right child) or 2
+    uint8_t precedence;                // of symbols; higher binds tighter
+    bool rightAssociative;
+    bool function;                     // called as name(a) or name(a, b)
+    double (*unary)(double);           // evaluates functions of arity 1
+    double (*binary)(double, double);  // and of arity 2
+};
+
+// The built-in operators and functions, in AST::OpCode order. AST's table
+// starts as a copy, and StaticExpression.h parses with it at compile time,
+// so both accept the same grammar. + - * / and unary minus have no function:
+// evaluators do them inline, and / throws on a zero divisor.
+inline constexpr OperatorInfo BUILTIN_OPERATORS[] = {
+    {"", 0, 0, false, false, nullptr, nullptr},   // Number
+    {"+", 2, 1, false, false, nullptr, nullptr},
+    {"-", 2, 1, false, false, nullptr, nullptr},
+    {"*", 2, 2, false, false, nullptr, nullptr},
+    {"/", 2, 2, false, false, nullptr, nullptr},
+    {"-", 1, 3, true, false, nullptr, nullptr},   // Neg
+    {"", 0, 0, false, false, nullptr, nullptr},   // Variable
+    {"%", 2, 2, false, false, nullptr, [](double x, double y) { return fmod(x, y); }},
+    {"^", 2, 4, true, false, nullptr, [](double x, double y) { return pow(x, y); }},
+    {"sqrt", 1, 0, false, true, [](double x) { return sqrt(x); }, nullptr},
+    {"sin", 1, 0, false, true, [](double x) { return sin(x); }, nullptr},
+    {"cos", 1, 0, false, true, [](double x) { return cos(x); }, nullptr},
+    {"tan", 1, 0, false, true, [](double x) { return tan(x); }, nullptr},
+    {"exp", 1, 0, false, true, [](double x) { return exp(x); }, nullptr},
+    {"ln", 1, 0, false, true, [](double x) { return log(x); }, nullptr},
+    {"abs", 1, 0, false, true, [](double x) { return fabs(x); }, nullptr},
+    {"min", 2, 0, false, true, nullptr, [](double x, double y) { return fmin(x, y); }},
+    {"max", 2, 0, false, true, nullptr, [](double x, double y) { return fmax(x, y); }},
+};
+
+inline constexpr size_t BUILTIN_OPERATOR_COUNT = sizeof(BUILTIN_OPERATORS) / sizeof(BUILTIN_OPERATORS[0]);
+
+#endif
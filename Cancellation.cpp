@@ -0,0 +1,39 @@
+#include "Cancellation.h"
+
+using namespace std;
+
+
+static thread_local CancellationToken* activeToken = nullptr;
+
+void CancellationToken::setPhase(const char* name) {
+    done.store(0, memory_order_relaxed);
+    total.store(0, memory_order_relaxed);
+    phaseName.store(name, memory_order_relaxed);
+}
+
+double CancellationToken::progress() const {
+    size_t t = total.load(memory_order_relaxed);
+    if (t == 0) return 0;
+    size_t d = done.load(memory_order_relaxed);
+    return d >= t ? 1.0 : double(d) / double(t);
+}
+
+void CancellationToken::report(size_t doneCount, size_t totalCount) {
+    done.store(doneCount, memory_order_relaxed);
+    total.store(totalCount, memory_order_relaxed);
+}
+
+CancellationScope::CancellationScope(CancellationToken& token) : previous(activeToken) {
+    activeToken = &token;
+}
+
+CancellationScope::~CancellationScope() {
+    activeToken = previous;
+}
+
+void CancellationScope::checkpoint(size_t done, size_t total) {
+    CancellationToken* token = activeToken;
+    if (!token) return;
+    if (token->cancelled()) throw OperationCancelled();
+    if (total) token->report(done, total);
+}
@@ -0,0 +1,60 @@
+#ifndef CANCELLATION_H
+#define CANCELLATION_H
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+
+using namespace std;
+
+// Thrown from a checkpoint once the active token has been cancelled.
+class OperationCancelled : public runtime_error {
+public:
+    OperationCancelled() : runtime_error("Error: Operation cancelled.") {}
+};
+
+// Shared between a worker and whoever controls it. All members are atomic,
+// so any thread may cancel or read progress while the worker runs.
+class CancellationToken {
+public:
+    CancellationToken() : cancelFlag(false), phaseName(""), done(0), total(0) {}
+
+    void cancel() { cancelFlag.store(true, memory_order_relaxed); }
+    bool cancelled() const { return cancelFlag.load(memory_order_relaxed); }
+
+    // Names the current phase (a string literal) and resets its progress.
+    void setPhase(const char* name);
+    const char* phase() const { return phaseName.load(memory_order_relaxed); }
+    // Fraction of the current phase done, in [0, 1].
+    double progress() const;
+    void report(size_t done, size_t total);
+
+private:
+    atomic<bool> cancelFlag;
+    atomic<const char*> phaseName;
+    atomic<size_t> done;
+    atomic<size_t> total;
+};
+
+// Installs a token for the calling thread; scopes nest. Long-running loops
+// call checkpoint() every few thousand iterations, which reports progress
+// and throws OperationCancelled once the token is cancelled. Without an
+// active scope a checkpoint is a single thread-local load.
+class CancellationScope {
+public:
+    explicit CancellationScope(CancellationToken& token);
+    ~CancellationScope();
+
+    CancellationScope(const CancellationScope&) = delete;
+    CancellationScope& operator=(const CancellationScope&) = delete;
+
+    static void checkpoint(size_t done = 0, size_t total = 0);
+
+    // Loops check in once per this many iterations.
+    static constexpr size_t INTERVAL = 4096;
+
+private:
+    CancellationToken* previous;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#include "Instrumentation.h"
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+// Counting replacements for the global allocation functions, for the
+// allocation column of TraceSession. Only the GUI and the benchmarks link
+// this file, and only with STC_ENABLE_INSTRUMENTATION; the core library
+// leaves the standard allocator alone. The array and nothrow forms forward
+// here by default; aligned allocations are not counted.
+
+void* operator new(size_t size) {
+    ++threadAllocations;
+    if (size == 0) size = 1;
+    for (;;) {
+        if (void* p = malloc(size)) return p;
+        new_handler handler = get_new_handler();
+        if (!handler) throw bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    try {
+        return ::operator new(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { free(p); }
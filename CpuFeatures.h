@@ -0,0 +1,51 @@
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+#include <cstdlib>
+#include <string_view>
+
+// Runtime instruction-set dispatch shared by the SIMD code paths.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define STC_X86_64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define STC_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define STC_TARGET_AVX2
+#endif
+
+using namespace std;
+
+#ifdef STC_X86_64
+inline bool cpuHasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+#endif
+
+// STC_SIMD=scalar|sse2|avx2 caps the instruction set the SIMD paths use,
+// which is handy for cross-checking them against the scalar code.
+inline string_view simdLimit() {
+    const char* cap = getenv("STC_SIMD");
+    return cap ? cap : "";
+}
+
+#endif
@@ -0,0 +1,51 @@
+#include "ExpressionCache.h"
+#include <exception>
+#include <functional>
+
+using namespace std;
+
+
+ExpressionCache::ExpressionCache(size_t capacity, size_t maxDepth)
+    : shardCapacity(max<size_t>(capacity / SHARDS, 1)), maxDepth(maxDepth), hitCount(0), missCount(0) {
+    for (size_t i = 0; i < SHARDS; ++i) shards.push_back(make_unique<Shard>());
+}
+
+shared_ptr<const ExpressionCache::Entry> ExpressionCache::compile(string_view expression) const {
+    auto entry = make_shared<Entry>();
+    try {
+        AST tree{string(expression), maxDepth};
+        entry->program = make_shared<const Program>(tree.compile());
+        entry->variables = tree.getVariables();
+    } catch (const exception& e) {
+        entry->error = e.what();
+    }
+    return entry;
+}
+
+shared_ptr<const ExpressionCache::Entry> ExpressionCache::get(string_view expression) {
+    Shard& shard = *shards[hash<string_view>()(expression) % SHARDS];
+    {
+        lock_guard<mutex> guard(shard.lock);
+        auto it = shard.index.find(expression);
+        if (it != shard.index.end()) {
+            shard.order.splice(shard.order.begin(), shard.order, it->second);
+            hitCount.fetch_add(1, memory_order_relaxed);
+            return it->second->second;
+        }
+    }
+
+    // Compile outside the lock; two threads missing on the same expression
+    // both compile it and the second insert is dropped.
+    missCount.fetch_add(1, memory_order_relaxed);
+    shared_ptr<const Entry> entry = compile(expression);
+
+    lock_guard<mutex> guard(shard.lock);
+    if (shard.index.count(expression)) return entry;
+    shard.order.emplace_front(string(expression), entry);
+    shard.index.emplace(shard.order.front().first, shard.order.begin());
+    if (shard.order.size() > shardCapacity) {
+        shard.index.erase(shard.order.back().first);
+        shard.order.pop_back();
+    }
+    return entry;
+}
@@ -0,0 +1,57 @@
+#ifndef EXPRESSIONCACHE_H
+#define EXPRESSIONCACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "AST.h"
+#include "Program.h"
+
+using namespace std;
+
+// Thread-safe LRU cache from expression text to its compiled Program, so an
+// expression seen once is never parsed again while it stays in the cache.
+// Parse errors are cached as well. The map is split into shards with one
+// lock each, so concurrent lookups rarely contend.
+class ExpressionCache {
+public:
+    struct Entry {
+        shared_ptr<const Program> program;   // null if parsing failed
+        string error;
+        vector<string> variables;            // of the parsed tree
+    };
+
+    explicit ExpressionCache(size_t capacity = 1 << 16, size_t maxDepth = AST::DEFAULT_MAX_DEPTH);
+
+    // Compiles the expression on a miss; never throws for bad input.
+    shared_ptr<const Entry> get(string_view expression);
+
+    size_t hits() const { return hitCount.load(memory_order_relaxed); }
+    size_t misses() const { return missCount.load(memory_order_relaxed); }
+
+private:
+    static constexpr size_t SHARDS = 16;
+
+    struct Shard {
+        mutex lock;
+        // Most recently used first; the map points into the list.
+        list<pair<string, shared_ptr<const Entry>>> order;
+        unordered_map<string_view, decltype(order)::iterator> index;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    size_t shardCapacity;
+    size_t maxDepth;
+    atomic<size_t> hitCount;
+    atomic<size_t> missCount;
+
+    shared_ptr<const Entry> compile(string_view expression) const;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "HistoryModel.h"
+#include <algorithm>
+#include <climits>
+
+HistoryModel::HistoryModel(HistoryStore &store, QObject *parent)
+    : QAbstractListModel(parent), store(store), first(0), count(0), filtered(false) {
+    reload();
+}
+
+int HistoryModel::rowCount(const QModelIndex &parent) const {
+    if (parent.isValid()) return 0;
+    return (int)std::min<size_t>(filtered ? rows.size() : count, INT_MAX);
+}
+
+QVariant HistoryModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= rowCount()) return QVariant();
+    if (role != Qt::DisplayRole) return QVariant();
+    std::string_view line = store.line(storeRow(index.row()));
+    return QString::fromUtf8(line.data(), (qsizetype)line.size());
+}
+
+void HistoryModel::setFilter(const QString &needle, const QString &from, const QString &to) {
+    this->needle = needle;
+    this->from = from;
+    this->to = to;
+    reload();
+}
+
+void HistoryModel::reload() {
+    beginResetModel();
+    rows.clear();
+    try {
+        store.refresh();
+        std::string fromText = from.toStdString();
+        std::string toText = to.toStdString();
+        std::pair<size_t, size_t> range = store.timeRange(fromText, toText);
+        first = range.first;
+        count = range.second - range.first;
+        filtered = !needle.isEmpty();
+        if (filtered) rows = store.search(needle.toStdString(), range.first, range.second);
+    } catch (const std::exception &) {
+        // An unreadable log shows as empty.
+        first = count = 0;
+        filtered = false;
+    }
+    endResetModel();
+}
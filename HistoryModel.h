@@ -0,0 +1,41 @@
+#ifndef HISTORYMODEL_H
+#define HISTORYMODEL_H
+
+#include <QAbstractListModel>
+#include <QString>
+#include <cstdint>
+#include <vector>
+#include "HistoryStore.h"
+
+// One row per logged calculation, read straight from the store's memory
+// map when a view asks for it, so only the visible rows are ever decoded.
+// A filter narrows the rows to a time range and a substring.
+class HistoryModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    explicit HistoryModel(HistoryStore &store, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    // Re-reads the store and applies the filter. Empty arguments match all.
+    void setFilter(const QString &needle, const QString &from, const QString &to);
+    void reload();
+
+private:
+    HistoryStore &store;
+    QString needle;
+    QString from;
+    QString to;
+    // Unfiltered rows are the store's rows [first, first + count); a
+    // substring filter lists the matching rows instead.
+    size_t first;
+    size_t count;
+    bool filtered;
+    std::vector<uint32_t> rows;
+
+    size_t storeRow(int row) const { return filtered ? rows[row] : first + row; }
+};
+
+#endif
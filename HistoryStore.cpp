@@ -0,0 +1,195 @@
+#include "HistoryStore.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+
+
+HistoryStore::HistoryStore(string path) : logPath(move(path)), indexPath(logPath + ".idx") {}
+
+HistoryStore::~HistoryStore() {
+    try {
+        flush();
+    } catch (const exception&) {
+    }
+}
+
+void HistoryStore::append(string_view timestamp, string_view expression, string_view result) {
+    pending += '[';
+    pending += timestamp;
+    pending += "] ";
+    pending += expression;
+    pending += " = ";
+    pending += result;
+    pending += '\n';
+    pendingEnds.push_back(pending.size());
+    if (pending.size() >= FLUSH_BYTES) flush();
+}
+
+// End of the last line the index file covers, 0 if it is missing or empty.
+uint64_t HistoryStore::indexedBytes() const {
+    ifstream in(indexPath, ios::binary | ios::ate);
+    if (!in) return 0;
+    streamoff size = in.tellg();
+    if (size < (streamoff)sizeof(uint64_t)) return 0;
+    uint64_t end = 0;
+    in.seekg(size - size % sizeof(uint64_t) - sizeof(uint64_t));
+    in.read(reinterpret_cast<char*>(&end), sizeof(end));
+    return in ? end : 0;
+}
+
+void HistoryStore::flush() {
+    if (pending.empty()) return;
+    error_code ec;
+    uint64_t base = filesystem::file_size(logPath, ec);
+    if (ec) base = 0;
+    // Only extend an index that covers the whole log; otherwise refresh()
+    // rebuilds the missing part from the log itself.
+    bool indexCurrent = indexedBytes() == base;
+
+    ofstream out(logPath, ios::binary | ios::app);
+    if (!out) throw runtime_error("Error: Cannot open '" + logPath + "' for writing.");
+    out.write(pending.data(), pending.size());
+    if (!out) throw runtime_error("Error: Failed to write '" + logPath + "'.");
+    out.close();
+
+    if (indexCurrent) {
+        vector<uint64_t> absolute(pendingEnds.size());
+        for (size_t i = 0; i < pendingEnds.size(); ++i) absolute[i] = base + pendingEnds[i];
+        ofstream index(indexPath, ios::binary | ios::app);
+        index.write(reinterpret_cast<const char*>(absolute.data()), absolute.size() * sizeof(uint64_t));
+    }
+    pending.clear();
+    pendingEnds.clear();
+}
+
+void HistoryStore::clear() {
+    pending.clear();
+    pendingEnds.clear();
+    // Unmap before truncating: some platforms refuse, others fault on access.
+    log = MappedFile();
+    ends.clear();
+    for (const string& path : {logPath, indexPath}) {
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out) throw runtime_error("Error: Cannot open '" + path + "' for writing.");
+    }
+}
+
+void HistoryStore::refresh() {
+    flush();
+    log = MappedFile();
+    ends.clear();
+    error_code ec;
+    if (!filesystem::exists(logPath, ec)) return;
+    log = MappedFile(logPath);
+
+    ifstream in(indexPath, ios::binary | ios::ate);
+    if (in) {
+        size_t count = static_cast<size_t>(in.tellg()) / sizeof(uint64_t);
+        ends.resize(count);
+        in.seekg(0);
+        in.read(reinterpret_cast<char*>(ends.data()), count * sizeof(uint64_t));
+        if (!in) ends.clear();
+    }
+    in.close();
+    // An index that runs past the log or does not stop at a line break
+    // belongs to some other file: rebuild it.
+    const char* data = log.data();
+    bool valid = ends.empty() || (ends.back() > 0 && ends.back() <= log.size() && data[ends.back() - 1] == '\n');
+    if (!valid) ends.clear();
+    size_t indexed = ends.size();
+
+    // Index whatever was appended since, e.g. by an older build or a flush
+    // that could not write the index.
+    size_t pos = lineStart(ends.size());
+    while (pos < log.size()) {
+        const void* newline = memchr(data + pos, '\n', log.size() - pos);
+        pos = newline ? static_cast<const char*>(newline) - data + 1 : log.size();
+        ends.push_back(pos);
+    }
+    // A trailing line without a break may still be growing; keep it out of
+    // the file so the next refresh looks at it again.
+    size_t complete = ends.size();
+    if (complete > indexed && data[ends.back() - 1] != '\n') --complete;
+    if (complete > indexed || !valid) {
+        ofstream index(indexPath, ios::binary | (valid ? ios::app : ios::trunc));
+        index.write(reinterpret_cast<const char*>(ends.data() + (valid ? indexed : 0)),
+                    (complete - (valid ? indexed : 0)) * sizeof(uint64_t));
+    }
+}
+
+string_view HistoryStore::line(size_t i) const {
+    if (i >= ends.size()) throw out_of_range("Error: History entry out of range.");
+    size_t begin = lineStart(i);
+    size_t end = ends[i];
+    while (end > begin && (log.data()[end - 1] == '\n' || log.data()[end - 1] == '\r')) --end;
+    return string_view(log.data() + begin, end - begin);
+}
+
+HistoryStore::Entry HistoryStore::entry(size_t i) const {
+    string_view text = line(i);
+    Entry e;
+    if (text.size() >= 22 && text[0] == '[' && text[20] == ']' && text[21] == ' ') {
+        e.timestamp = text.substr(1, 19);
+        text.remove_prefix(22);
+    }
+    size_t eq = text.rfind(" = ");
+    if (eq == string_view::npos) {
+        e.expression = text;
+    } else {
+        e.expression = text.substr(0, eq);
+        e.result = text.substr(eq + 3);
+    }
+    return e;
+}
+
+pair<size_t, size_t> HistoryStore::timeRange(string_view from, string_view to) const {
+    // First row in [lo, hi) for which `before` is false.
+    auto partitionRow = [](size_t lo, size_t hi, auto before) {
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (before(mid)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    };
+    size_t first = 0;
+    size_t last = ends.size();
+    if (!from.empty()) {
+        first = partitionRow(first, last, [&](size_t i) { return entry(i).timestamp < from; });
+    }
+    if (!to.empty()) {
+        last = partitionRow(first, last, [&](size_t i) { return entry(i).timestamp.substr(0, to.size()) <= to; });
+    }
+    return {first, last};
+}
+
+vector<uint32_t> HistoryStore::search(string_view needle, size_t first, size_t last) const {
+    vector<uint32_t> rows;
+    last = min(last, ends.size());
+    if (first >= last) return rows;
+    if (needle.empty()) {
+        rows.resize(last - first);
+        for (size_t i = 0; i < rows.size(); ++i) rows[i] = static_cast<uint32_t>(first + i);
+        return rows;
+    }
+
+    // One pass over the mapped bytes; each hit is mapped back to its line,
+    // and the scan resumes at the next line.
+    const char* data = log.data();
+    const char* end = data + ends[last - 1];
+    const char* pos = data + lineStart(first);
+    boyer_moore_horspool_searcher searcher(needle.begin(), needle.end());
+    while (pos < end) {
+        const char* hit = std::search(pos, end, searcher);
+        if (hit == end) break;
+        size_t row = upper_bound(ends.begin() + first, ends.begin() + last, uint64_t(hit - data)) - ends.begin();
+        rows.push_back(static_cast<uint32_t>(row));
+        pos = data + ends[row];
+    }
+    return rows;
+}
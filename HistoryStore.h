@@ -0,0 +1,75 @@
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "MappedFile.h"
+
+using namespace std;
+
+// Append-only calculation log: one "[yyyy-MM-dd HH:mm:ss] expression = result"
+// line per entry. Appends are buffered and written in batches. A sidecar
+// index (`<log>.idx`) stores the end offset of every line as a uint64, so
+// any entry is found in O(1) without scanning; a stale or missing index is
+// repaired from the log on the next refresh(). Reads go through a memory map
+// of the log, so only the pages that are looked at are loaded.
+class HistoryStore {
+public:
+    struct Entry {
+        string_view timestamp;    // "yyyy-MM-dd HH:mm:ss", empty if the line has none
+        string_view expression;
+        string_view result;
+    };
+
+    // Appends are written once this much is pending.
+    static constexpr size_t FLUSH_BYTES = 64 * 1024;
+
+    explicit HistoryStore(string logPath);
+    // Flushes pending appends; errors are dropped.
+    ~HistoryStore();
+
+    HistoryStore(const HistoryStore&) = delete;
+    HistoryStore& operator=(const HistoryStore&) = delete;
+
+    const string& path() const { return logPath; }
+
+    void append(string_view timestamp, string_view expression, string_view result);
+    void flush();
+    // Empties the log and its index.
+    void clear();
+
+    // Writes pending appends, maps the log and brings the index up to date.
+    // The accessors below see the log as of the last refresh.
+    void refresh();
+
+    size_t size() const { return ends.size(); }
+    // Line i without its line break.
+    string_view line(size_t i) const;
+    Entry entry(size_t i) const;
+
+    // Entries [first, last) whose timestamp lies in [from, to]. Timestamps
+    // compare as text and the log is in time order, so this is a binary
+    // search. `to` matches by prefix, so "2026-10-17" covers that whole day.
+    // Empty bounds are open.
+    pair<size_t, size_t> timeRange(string_view from, string_view to) const;
+    // Entries in [first, last) whose line contains `needle`, in order.
+    vector<uint32_t> search(string_view needle, size_t first, size_t last) const;
+
+private:
+    string logPath;
+    string indexPath;
+    string pending;                 // appended lines not yet written
+    vector<uint64_t> pendingEnds;   // their end offsets within `pending`
+
+    MappedFile log;
+    vector<uint64_t> ends;     // end offset of each line, line break included
+
+    size_t lineStart(size_t i) const { return i ? ends[i - 1] : 0; }
+    uint64_t indexedBytes() const;
+};
+
+#endif
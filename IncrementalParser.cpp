@@ -0,0 +1,175 @@
+#include "IncrementalParser.h"
+#include "Cancellation.h"
+#include "Instrumentation.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// Bytes that can continue a number or an identifier.
+static bool isWordChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+
+IncrementalParser::IncrementalParser(size_t maxDepth)
+    : maxDepth(maxDepth), nodes(make_shared<AST::NodeArena>()), liveNodes(0), reused(0), lexed(0),
+      operators(maxDepth), tree(maxDepth) {}
+
+void IncrementalParser::clear() {
+    source.reset();
+    tokens.clear();
+    checkpoints.clear();
+    nodes = make_shared<AST::NodeArena>();
+    liveNodes = 0;
+}
+
+// Replaces the tokens with those of `text` and returns how many leading
+// tokens are unchanged. Throws lexer errors with the state untouched.
+size_t IncrementalParser::relex(const string& text) {
+    STC_TRACE_SCOPE("relex");
+    if (text.size() > UINT32_MAX) throw runtime_error("Error: Expression is too large.");
+    const string empty;
+    const string& old = source ? *source : empty;
+    size_t limit = min(old.size(), text.size());
+    size_t prefix = mismatch(old.begin(), old.begin() + limit, text.begin()).first - old.begin();
+    size_t suffix = 0;
+    while (suffix < limit - prefix && old[old.size() - 1 - suffix] == text[text.size() - 1 - suffix]) ++suffix;
+    size_t oldEditEnd = old.size() - suffix;
+    int64_t shift = int64_t(text.size()) - int64_t(old.size());
+
+    // A token is kept when the byte after it is unchanged, so it still ends
+    // where it did. A kept suffix token must also start where a fresh scan
+    // would: after an unchanged byte that cannot run into it.
+    size_t first = partition_point(tokens.begin(), tokens.end(), [&](const Token& t) {
+        return size_t(t.begin) + t.length < prefix;
+    }) - tokens.begin();
+    size_t last = partition_point(tokens.begin(), tokens.end(), [&](const Token& t) {
+        return t.begin <= oldEditEnd;
+    }) - tokens.begin();
+    while (last < tokens.size()) {
+        const Token& t = tokens[last];
+        bool leaf = t.kind == TokenKind::Number || t.kind == TokenKind::Variable;
+        if (!leaf || !isWordChar(old[t.begin - 1])) break;
+        ++last;
+    }
+
+    size_t lexBegin = first > 0 ? tokens[first - 1].begin + tokens[first - 1].length : 0;
+    size_t lexEnd = last < tokens.size() ? size_t(int64_t(tokens[last].begin) + shift) : text.size();
+    AST::TokenArray middle;
+    AST::tokenize(string_view(text).substr(lexBegin, lexEnd - lexBegin), middle);
+    lexed = lexEnd - lexBegin;
+
+    vector<Token> fresh;
+    fresh.reserve(middle.size);
+    for (size_t i = 0; i < middle.size; ++i) {
+        const AST::Token& t = middle.data[i];
+        fresh.push_back({t.kind, t.op, uint32_t(t.text.data() - text.data()), uint32_t(t.text.size()), t.value});
+    }
+    for (size_t i = last; i < tokens.size(); ++i) tokens[i].begin = uint32_t(int64_t(tokens[i].begin) + shift);
+    tokens.erase(tokens.begin() + first, tokens.begin() + last);
+    tokens.insert(tokens.begin() + first, fresh.begin(), fresh.end());
+    source = make_shared<const string>(text);
+    return first;
+}
+
+void IncrementalParser::restore(const Checkpoint* checkpoint) {
+    if (!checkpoint) {
+        classifier = AST::TokenClassifier();
+        operators.clear();
+        tree.clear();
+        names.clear();
+        variableIds.clear();
+        return;
+    }
+    classifier = checkpoint->classifier;
+    operators = checkpoint->operators;
+    tree = checkpoint->tree;
+    // Variables are numbered in order of appearance, so the ones seen before
+    // the checkpoint are still the first ones.
+    while (names.size() > checkpoint->variableCount) {
+        variableIds.erase(names.back());
+        names.pop_back();
+    }
+}
+
+void IncrementalParser::save(size_t token) {
+    checkpoints.push_back({token, classifier, names.size(), operators, tree});
+}
+
+// Postfix output goes straight into the tree; the first error waits in
+// buildError.
+void IncrementalParser::output(OpCode op) {
+    if (buildError.empty()) tree.apply(*nodes, op, [this](string message) { buildError = move(message); });
+}
+
+// One step of shunting-yard, the same as handleUnaryOperators() and
+// infixToPostfix() together.
+void IncrementalParser::read(size_t i) {
+    const Token& token = tokens[i];
+    OpCode op = token.op;
+    TokenKind kind = classifier.read(token.kind, op, i + 1 < tokens.size() && tokens[i + 1].kind == TokenKind::LParen);
+    auto emit = [this](OpCode ready) { output(ready); };
+    if (kind == TokenKind::Function) {
+        operators.read(kind, AST::functionCode(string_view(*source).substr(token.begin, token.length)), emit);
+        return;
+    }
+    if (kind == TokenKind::Number || kind == TokenKind::Variable) {
+        if (!buildError.empty()) return;
+        if (kind == TokenKind::Number) {
+            tree.leaf(nodes->add(AST::OpCode::Number, AST::NO_NODE, AST::NO_NODE, token.value,
+                                 token.begin, token.length));
+            return;
+        }
+        string name = source->substr(token.begin, token.length);
+        auto [it, inserted] = variableIds.try_emplace(name, static_cast<int>(names.size()));
+        if (inserted) names.push_back(move(name));
+        tree.leaf(nodes->add(AST::OpCode::Variable, AST::NO_NODE, AST::NO_NODE, it->second,
+                             token.begin, token.length));
+        return;
+    }
+
+    operators.read(kind, op, emit);
+}
+
+AST IncrementalParser::parse(const string& text) {
+    STC_TRACE_SCOPE("incrementalParse");
+    size_t unchanged = relex(text);
+
+    // Once most of the arena is garbage from earlier parses, start over.
+    if (nodes->size() > 2 * liveNodes + 4096) {
+        nodes = make_shared<AST::NodeArena>();
+        checkpoints.clear();
+    }
+    // A checkpoint at the first changed token is stale too: whether the name
+    // before it is a call depends on that token.
+    while (!checkpoints.empty() && checkpoints.back().token >= unchanged) checkpoints.pop_back();
+    restore(checkpoints.empty() ? nullptr : &checkpoints.back());
+    size_t start = checkpoints.empty() ? 0 : checkpoints.back().token;
+    bool fresh = nodes->size() == 0;
+    reused = start;
+    buildError.clear();
+
+    size_t lastSaved = start;
+    for (size_t i = start; i < tokens.size(); ++i) {
+        if ((i & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(i, tokens.size());
+        if (buildError.empty() && i - lastSaved >= max(CHECKPOINT_SPACING, operators.size() + tree.size())) {
+            save(i);
+            lastSaved = i;
+        }
+        read(i);
+    }
+    operators.finish([this](OpCode op) { output(op); });
+    if (!buildError.empty()) throw runtime_error(buildError);
+
+    if (tree.size() == 0) {
+        liveNodes = 0;
+        return AST(make_shared<AST::NodeArena>(), AST::NO_NODE, source, AST::noVariables(), maxDepth, true);
+    }
+    if (tree.size() != 1) throw runtime_error("Error: Malformed expression.");
+    NodeId root = tree.top();
+    liveNodes = nodes->subtreeSize(root);
+    STC_TRACE_COUNTER("nodes", liveNodes);
+    STC_TRACE_COUNTER("depth", tree.height());
+    auto variables = names.empty() ? AST::noVariables() : make_shared<const vector<string>>(names);
+    return AST(nodes, root, source, move(variables), maxDepth, fresh);
+}
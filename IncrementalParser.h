@@ -0,0 +1,91 @@
+#ifndef INCREMENTALPARSER_H
+#define INCREMENTALPARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AST.h"
+
+using namespace std;
+
+// Reparses an expression that is being edited, doing work in proportion to
+// the edit rather than to the whole text.
+//
+// The tokens of the previous text are kept, and only the span between the
+// common prefix and the common suffix is lexed again. Shunting-yard and tree
+// building run as one pass whose state is saved every so often. A parse
+// resumes from the last state saved before the first changed token, so every
+// subtree finished by then is reused as is. New nodes are appended to the
+// same arena, like the versions simplifyLowestLevel makes. Once most of the
+// arena is unreachable, the next parse starts a fresh one.
+//
+// Results and error messages are exactly those of AST(text). The returned
+// trees share the arena, so they and the parser must stay on one thread.
+class IncrementalParser {
+public:
+    explicit IncrementalParser(size_t maxDepth = AST::DEFAULT_MAX_DEPTH);
+
+    AST parse(const string& text);
+    // Forgets the previous text; the next parse starts from scratch.
+    void clear();
+
+    // What the last parse() was able to skip.
+    size_t reusedTokens() const { return reused; }
+    size_t lexedBytes() const { return lexed; }
+
+private:
+    using TokenKind = AST::TokenKind;
+    using OpCode = AST::OpCode;
+    using NodeId = AST::NodeId;
+
+    struct Token {
+        TokenKind kind;
+        OpCode op;
+        uint32_t begin;
+        uint32_t length;
+        double value;
+    };
+
+    // Parser state just before tokens[token] is read.
+    struct Checkpoint {
+        size_t token;
+        AST::TokenClassifier classifier;
+        size_t variableCount;
+        AST::OperatorStack operators;
+        AST::TreeBuilder tree;
+    };
+
+    // A state is saved at least this many tokens after the previous one, and
+    // no sooner than its own size, so saving costs O(1) per token.
+    static constexpr size_t CHECKPOINT_SPACING = 64;
+
+    size_t maxDepth;
+    shared_ptr<const string> source;   // the previous text
+    vector<Token> tokens;              // all tokens of *source
+    vector<Checkpoint> checkpoints;    // ascending by token
+    shared_ptr<AST::NodeArena> nodes;
+    size_t liveNodes;                  // size of the last tree built
+    size_t reused;
+    size_t lexed;
+
+    // Shunting-yard and tree-building state of the parse in progress.
+    AST::TokenClassifier classifier;
+    AST::OperatorStack operators;
+    AST::TreeBuilder tree;
+    vector<string> names;
+    unordered_map<string, int> variableIds;
+    // AST(text) reports shunting-yard errors before tree-building errors, so
+    // the first tree-building error waits until the token stream is done.
+    string buildError;
+
+    size_t relex(const string& text);
+    void restore(const Checkpoint* checkpoint);
+    void save(size_t token);
+    void read(size_t i);
+    void output(OpCode op);
+};
+
+#endif
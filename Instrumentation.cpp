@@ -0,0 +1,137 @@
+#include "Instrumentation.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+
+static thread_local TraceSession* activeSession = nullptr;
+thread_local uint64_t threadAllocations = 0;
+
+uint64_t threadAllocationCount() {
+    return threadAllocations;
+}
+
+TraceSession::TraceSession() : previous(activeSession), origin(chrono::steady_clock::now()), level(0) {
+    if (!enabled) return;
+    eventList.reserve(256);   // keeps the collector's own allocations out of most phases
+    activeSession = this;
+}
+
+TraceSession::~TraceSession() {
+    if (activeSession == this) activeSession = previous;
+}
+
+TraceSession* TraceSession::current() {
+    return activeSession;
+}
+
+uint64_t TraceSession::now() const {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+}
+
+void TraceSession::counter(const char* name, double value) {
+    TraceSession* session = activeSession;
+    if (session) session->counterList.push_back({name, session->now(), value});
+}
+
+void TraceSession::clear() {
+    eventList.clear();
+    counterList.clear();
+    origin = chrono::steady_clock::now();
+}
+
+vector<TraceSession::Summary> TraceSession::summary() const {
+    // Events are recorded when a phase ends; walk them by start time so
+    // outer phases come before the phases nested in them.
+    vector<size_t> order(eventList.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return eventList[a].startNs < eventList[b].startNs;
+    });
+
+    vector<Summary> totals;
+    for (size_t i : order) {
+        const Event& e = eventList[i];
+        Summary* entry = nullptr;
+        for (Summary& s : totals) {
+            if (string_view(s.name) == e.name) { entry = &s; break; }
+        }
+        if (!entry) {
+            totals.push_back({e.name, 0, 0, 0, e.level});
+            entry = &totals.back();
+        }
+        ++entry->calls;
+        entry->totalNs += e.durationNs;
+        entry->allocations += e.allocations;
+        entry->level = min(entry->level, e.level);
+    }
+    return totals;
+}
+
+double TraceSession::counterValue(string_view name, double fallback) const {
+    for (size_t i = counterList.size(); i-- > 0;) {
+        if (name == counterList[i].name) return counterList[i].value;
+    }
+    return fallback;
+}
+
+string TraceSession::toChromeTrace() const {
+    // Complete ("X") events for phases and "C" events for counters; times in
+    // microseconds. Names are string literals without quotes or backslashes.
+    string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    char buf[256];
+    bool first = true;
+    for (const Event& e : eventList) {
+        snprintf(buf, sizeof(buf),
+                 "%s\n{\"name\":\"%s\",\"cat\":\"stc\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"args\":{\"allocations\":%llu}}",
+                 first ? "" : ",", e.name, e.startNs / 1000.0, e.durationNs / 1000.0,
+                 static_cast<unsigned long long>(e.allocations));
+        json += buf;
+        first = false;
+    }
+    for (const Counter& c : counterList) {
+        snprintf(buf, sizeof(buf),
+                 "%s\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"args\":{\"value\":%.17g}}",
+                 first ? "" : ",", c.name, c.timeNs / 1000.0, c.value);
+        json += buf;
+        first = false;
+    }
+    json += "\n]}\n";
+    return json;
+}
+
+void TraceSession::writeChromeTrace(const string& path) const {
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) throw runtime_error("Error: Cannot open '" + path + "' for writing.");
+    out << toChromeTrace();
+    if (!out) throw runtime_error("Error: Failed to write '" + path + "'.");
+}
+
+TraceScope::TraceScope(const char* name) : session(activeSession), name(name), start(0), allocations(0) {
+    if (!session) return;
+    start = session->now();
+    allocations = threadAllocations;
+    ++session->level;
+}
+
+TraceScope::~TraceScope() {
+    // The session may have ended inside the scope; then nothing is recorded.
+    if (!session || activeSession != session) return;
+    --session->level;
+    uint64_t duration = session->now() - start;
+    uint64_t allocated = threadAllocations - allocations;
+    session->eventList.push_back({name, start, duration, allocated, session->level});
+}
+
+TraceAttach::TraceAttach(TraceSession* session) : previous(activeSession), attached(session && TraceSession::enabled) {
+    if (attached) activeSession = session;
+}
+
+TraceAttach::~TraceAttach() {
+    if (attached) activeSession = previous;
+}
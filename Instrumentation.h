@@ -0,0 +1,131 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Per-phase instrumentation. A TraceSession collects what runs on the thread
+// that created it: STC_TRACE_SCOPE records the wall time and heap allocations
+// of a phase, STC_TRACE_COUNTER a value such as a node count or tree depth.
+// Without a session both cost one thread-local load. When the build does not
+// define STC_ENABLE_INSTRUMENTATION the macros compile to nothing and
+// sessions stay empty.
+class TraceSession {
+public:
+#ifdef STC_ENABLE_INSTRUMENTATION
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    struct Event {
+        const char* name;        // string literal
+        uint64_t startNs;        // relative to the session start
+        uint64_t durationNs;
+        uint64_t allocations;    // heap allocations inside the phase, nested ones included
+        uint32_t level;          // nesting depth; 0 for outermost phases
+    };
+
+    struct Counter {
+        const char* name;
+        uint64_t timeNs;
+        double value;
+    };
+
+    // Per-phase totals, in order of first appearance.
+    struct Summary {
+        const char* name;
+        size_t calls;
+        uint64_t totalNs;
+        uint64_t allocations;
+        uint32_t level;
+    };
+
+    // Sessions nest: the newest one on a thread collects until it is destroyed.
+    TraceSession();
+    ~TraceSession();
+
+    TraceSession(const TraceSession&) = delete;
+    TraceSession& operator=(const TraceSession&) = delete;
+
+    static TraceSession* current();
+    static void counter(const char* name, double value);
+
+    const vector<Event>& events() const { return eventList; }
+    const vector<Counter>& counters() const { return counterList; }
+    vector<Summary> summary() const;
+    // Latest value of a counter, or `fallback` if it was never recorded.
+    double counterValue(string_view name, double fallback = 0) const;
+    void clear();
+
+    // Chrome trace_event JSON (chrome://tracing, Perfetto).
+    string toChromeTrace() const;
+    void writeChromeTrace(const string& path) const;
+
+private:
+    friend class TraceScope;
+
+    TraceSession* previous;
+    chrono::steady_clock::time_point origin;
+    uint32_t level;
+    vector<Event> eventList;
+    vector<Counter> counterList;
+
+    uint64_t now() const;
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    TraceSession* session;
+    const char* name;
+    uint64_t start;
+    uint64_t allocations;
+};
+
+// Lends an existing session to the calling thread until destroyed, so a
+// worker can record into its owner's session. The owner must leave the
+// session alone meanwhile. A null session is ignored.
+class TraceAttach {
+public:
+    explicit TraceAttach(TraceSession* session);
+    ~TraceAttach();
+
+    TraceAttach(const TraceAttach&) = delete;
+    TraceAttach& operator=(const TraceAttach&) = delete;
+
+private:
+    TraceSession* previous;
+    bool attached;
+};
+
+// Heap allocations made so far by the calling thread. They are counted by
+// the operator new in CountingAllocator.cpp, which only the binaries that
+// report allocations link; elsewhere, and when instrumentation is compiled
+// out, this stays 0.
+uint64_t threadAllocationCount();
+extern thread_local uint64_t threadAllocations;
+
+#ifdef STC_ENABLE_INSTRUMENTATION
+#define STC_TRACE_CONCAT_(a, b) a##b
+#define STC_TRACE_CONCAT(a, b) STC_TRACE_CONCAT_(a, b)
+#define STC_TRACE_SCOPE(name) TraceScope STC_TRACE_CONCAT(stcTraceScope, __LINE__)(name)
+#define STC_TRACE_COUNTER(name, value) TraceSession::counter(name, value)
+#else
+#define STC_TRACE_SCOPE(name) ((void)0)
+#define STC_TRACE_COUNTER(name, value) ((void)0)
+#endif
+
+#endif
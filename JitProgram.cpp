@@ -0,0 +1,360 @@
+#include "JitProgram.h"
+#include "Instrumentation.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(STC_ENABLE_JIT) && (defined(__x86_64__) || defined(_M_X64))
+#define STC_JIT_X86_64 1
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+
+using namespace std;
+
+
+#ifdef STC_JIT_X86_64
+
+namespace {
+
+// Operand stack slots below this depth live in xmm registers; two more
+// registers are scratch. Windows x64 preserves xmm6-xmm15 across calls, so
+// only the volatile xmm0-xmm5 are used there.
+#ifdef _WIN32
+const int STACK_REGISTERS = 4;
+#else
+const int STACK_REGISTERS = 14;
+#endif
+const int SCRATCH0 = STACK_REGISTERS;
+const int SCRATCH1 = STACK_REGISTERS + 1;
+
+// Larger frames would need a deep native stack; such programs are interpreted.
+const size_t MAX_FRAME_BYTES = 64 * 1024;
+const size_t PAGE_BYTES = 4096;
+
+// Pool entries in front of the program's constants. The sign mask is a
+// 16-byte operand of xorpd and must stay 16-byte aligned.
+const uint32_t POOL_SIGN = 0, POOL_ZERO = 2, POOL_NAN = 3, POOL_CONSTANTS = 4;
+
+// Where an operand lives: an xmm register, a slot of the native frame, an
+// element of the vars array (held in rax) or a pool entry.
+struct Operand {
+    enum Kind { Reg, Frame, Var, Pool } kind;
+    uint32_t index;
+};
+
+class Emitter {
+public:
+    vector<uint8_t> code;
+    vector<pair<size_t, uint32_t>> poolFixups;   // disp32 offset, pool index
+    vector<size_t> nanFixups;                    // rel32 offsets of jumps to the NaN exit
+
+    void byte(uint8_t b) { code.push_back(b); }
+
+    void u32(uint32_t value) {
+        for (int i = 0; i < 4; ++i) byte(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    void patch32(size_t at, uint32_t value) {
+        for (int i = 0; i < 4; ++i) code[at + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    // <prefix> [REX] 0F <opcode> ModRM ..., with xmm `reg` in the reg field.
+    void sse(uint8_t prefix, uint8_t opcode, int reg, Operand rm) {
+        byte(prefix);
+        uint8_t rex = 0x40;
+        if (reg & 8) rex |= 0x04;
+        if (rm.kind == Operand::Reg && (rm.index & 8)) rex |= 0x01;
+        if (rex != 0x40) byte(rex);
+        byte(0x0F);
+        byte(opcode);
+        uint8_t r = static_cast<uint8_t>((reg & 7) << 3);
+        switch (rm.kind) {
+            case Operand::Reg:
+                byte(0xC0 | r | (rm.index & 7));
+                break;
+            case Operand::Frame:   // [rsp + disp32]
+                byte(0x84 | r);
+                byte(0x24);
+                u32(8 * rm.index);
+                break;
+            case Operand::Var:     // [rax + disp32]
+                byte(0x80 | r);
+                u32(8 * rm.index);
+                break;
+            case Operand::Pool:    // [rip + disp32], patched once the pool is placed
+                byte(0x05 | r);
+                poolFixups.push_back({code.size(), rm.index});
+                u32(0);
+                break;
+        }
+    }
+
+    void load(int reg, Operand from) {
+        if (from.kind == Operand::Reg) {
+            if (static_cast<int>(from.index) != reg) sse(0x66, 0x28, reg, from);   // movapd
+        } else {
+            sse(0xF2, 0x10, reg, from);   // movsd xmm, m64
+        }
+    }
+
+    void store(Operand to, int reg) {
+        if (to.kind == Operand::Reg) load(static_cast<int>(to.index), {Operand::Reg, static_cast<uint32_t>(reg)});
+        else sse(0xF2, 0x11, reg, to);    // movsd m64, xmm
+    }
+
+    void move(Operand to, Operand from) {
+        if (to.kind == Operand::Reg) {
+            load(static_cast<int>(to.index), from);
+        } else if (from.kind == Operand::Reg) {
+            store(to, static_cast<int>(from.index));
+        } else {
+            load(SCRATCH0, from);
+            store(to, SCRATCH0);
+        }
+    }
+
+    void adjustStack(uint8_t modrm, uint32_t bytes) {   // add/sub rsp, imm32
+        byte(0x48);
+        byte(0x81);
+        byte(modrm);
+        u32(bytes);
+    }
+
+    void prologue(size_t frameBytes) {
+#ifdef _WIN32
+        byte(0x48); byte(0x89); byte(0xC8);   // mov rax, rcx
+#else
+        byte(0x48); byte(0x89); byte(0xF8);   // mov rax, rdi
+#endif
+        // Grow the frame a page at a time and touch each page, as stack
+        // guard pages require.
+        for (; frameBytes > PAGE_BYTES; frameBytes -= PAGE_BYTES) {
+            adjustStack(0xEC, PAGE_BYTES);
+            byte(0x48); byte(0x83); byte(0x0C); byte(0x24); byte(0x00);   // or qword [rsp], 0
+        }
+        if (frameBytes) adjustStack(0xEC, static_cast<uint32_t>(frameBytes));
+    }
+
+    void epilogue(size_t frameBytes) {
+        if (frameBytes) adjustStack(0xC4, static_cast<uint32_t>(frameBytes));
+        byte(0xC3);   // ret
+    }
+};
+
+// Translates the bytecode; false if the program is unsuitable.
+bool generate(const Program& program, Emitter& out, vector<double>& pool) {
+    const vector<Program::Instr>& code = program.code();
+    if (code.empty()) return false;
+    // Calls would have to save every live xmm register around them.
+    for (const Program::Instr& in : code) {
+        if (in.op == Program::Op::Call1 || in.op == Program::Op::Call2) return false;
+    }
+
+    size_t temps = program.temporaries();
+    size_t maxStack = program.stackDepth() - temps;
+    size_t spills = maxStack > STACK_REGISTERS ? maxStack - STACK_REGISTERS : 0;
+    size_t frameBytes = 8 * (spills + temps);
+    if (frameBytes > MAX_FRAME_BYTES) return false;
+
+    pool.assign(POOL_CONSTANTS, 0);
+    uint64_t sign = uint64_t(1) << 63;
+    memcpy(&pool[POOL_SIGN], &sign, sizeof sign);
+    memcpy(&pool[POOL_SIGN + 1], &sign, sizeof sign);
+    pool[POOL_NAN] = numeric_limits<double>::quiet_NaN();
+    pool.insert(pool.end(), program.constants().begin(), program.constants().end());
+
+    auto slot = [&](size_t index) -> Operand {
+        if (index < STACK_REGISTERS) return {Operand::Reg, static_cast<uint32_t>(index)};
+        return {Operand::Frame, static_cast<uint32_t>(index - STACK_REGISTERS)};
+    };
+    auto temp = [&](uint32_t index) -> Operand {
+        return {Operand::Frame, static_cast<uint32_t>(spills + index)};
+    };
+
+    out.prologue(frameBytes);
+    size_t depth = 0;
+    for (const Program::Instr& in : code) {
+        switch (in.op) {
+            case Program::Op::PushConst:
+                out.move(slot(depth++), {Operand::Pool, POOL_CONSTANTS + in.arg});
+                break;
+            case Program::Op::LoadVar:
+                out.move(slot(depth++), {Operand::Var, in.arg});
+                break;
+            case Program::Op::LoadTemp:
+                out.move(slot(depth++), temp(in.arg));
+                break;
+            case Program::Op::Store:
+                out.move(temp(in.arg), slot(depth - 1));
+                break;
+            case Program::Op::Neg: {
+                Operand top = slot(depth - 1);
+                int reg = top.kind == Operand::Reg ? static_cast<int>(top.index) : SCRATCH0;
+                out.load(reg, top);
+                out.sse(0x66, 0x57, reg, {Operand::Pool, POOL_SIGN});   // xorpd
+                out.store(top, reg);
+                break;
+            }
+            default: {
+                Operand right = slot(depth - 1);
+                Operand left = slot(depth - 2);
+                --depth;
+                uint8_t opcode = 0;
+                switch (in.op) {
+                    case Program::Op::Add: opcode = 0x58; break;
+                    case Program::Op::Sub: opcode = 0x5C; break;
+                    case Program::Op::Mul: opcode = 0x59; break;
+                    default: opcode = 0x5E; break;   // Div
+                }
+                if (in.op == Program::Op::Div) {
+                    // ucomisd sets ZF for zero and for NaN; both leave
+                    // through the NaN exit.
+                    if (right.kind != Operand::Reg) {
+                        out.load(SCRATCH1, right);
+                        right = {Operand::Reg, SCRATCH1};
+                    }
+                    out.sse(0x66, 0x2E, static_cast<int>(right.index), {Operand::Pool, POOL_ZERO});
+                    out.byte(0x0F); out.byte(0x84);   // je rel32
+                    out.nanFixups.push_back(out.code.size());
+                    out.u32(0);
+                }
+                int reg = left.kind == Operand::Reg ? static_cast<int>(left.index) : SCRATCH0;
+                out.load(reg, left);
+                out.sse(0xF2, opcode, reg, right);
+                out.store(left, reg);
+                break;
+            }
+        }
+    }
+    // The result is stack slot 0, which is xmm0.
+    out.epilogue(frameBytes);
+
+    size_t nanExit = out.code.size();
+    out.load(0, {Operand::Pool, POOL_NAN});
+    out.epilogue(frameBytes);
+    for (size_t at : out.nanFixups) out.patch32(at, static_cast<uint32_t>(nanExit - (at + 4)));
+    return true;
+}
+
+void* allocateExecutable(const vector<uint8_t>& bytes) {
+#ifdef _WIN32
+    void* memory = VirtualAlloc(nullptr, bytes.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!memory) return nullptr;
+    memcpy(memory, bytes.data(), bytes.size());
+    DWORD previous;
+    if (!VirtualProtect(memory, bytes.size(), PAGE_EXECUTE_READ, &previous)) {
+        VirtualFree(memory, 0, MEM_RELEASE);
+        return nullptr;
+    }
+    FlushInstructionCache(GetCurrentProcess(), memory, bytes.size());
+    return memory;
+#else
+    // Written while writable, then switched to read+execute, so the pages are
+    // never writable and executable at once.
+    void* memory = mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    memcpy(memory, bytes.data(), bytes.size());
+    if (mprotect(memory, bytes.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, bytes.size());
+        return nullptr;
+    }
+    return memory;
+#endif
+}
+
+void freeExecutable(void* memory, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+
+}
+
+#endif
+
+JitProgram::JitProgram(const Program& program) : program(program), entry(nullptr), memory(nullptr), memorySize(0) {
+#ifdef STC_JIT_X86_64
+    STC_TRACE_SCOPE("jitCompile");
+    Emitter emitter;
+    vector<double> pool;
+    if (!generate(program, emitter, pool)) return;
+
+    // Code, then the 16-byte aligned constant pool.
+    vector<uint8_t> bytes = move(emitter.code);
+    size_t poolOffset = (bytes.size() + 15) & ~size_t(15);
+    for (auto [at, index] : emitter.poolFixups) {
+        size_t target = poolOffset + 8 * index;
+        uint32_t disp = static_cast<uint32_t>(static_cast<int32_t>(target - (at + 4)));
+        for (int i = 0; i < 4; ++i) bytes[at + i] = static_cast<uint8_t>(disp >> (8 * i));
+    }
+    bytes.resize(poolOffset + 8 * pool.size());
+    memcpy(bytes.data() + poolOffset, pool.data(), 8 * pool.size());
+
+    memory = allocateExecutable(bytes);
+    if (!memory) return;
+    memorySize = bytes.size();
+    entry = reinterpret_cast<Function>(memory);
+#endif
+}
+
+JitProgram::~JitProgram() {
+    release();
+}
+
+JitProgram::JitProgram(JitProgram&& other) noexcept
+    : program(move(other.program)), entry(other.entry), memory(other.memory), memorySize(other.memorySize) {
+    other.entry = nullptr;
+    other.memory = nullptr;
+    other.memorySize = 0;
+}
+
+JitProgram& JitProgram::operator=(JitProgram&& other) noexcept {
+    if (this != &other) {
+        release();
+        program = move(other.program);
+        entry = exchange(other.entry, nullptr);
+        memory = exchange(other.memory, nullptr);
+        memorySize = exchange(other.memorySize, 0);
+    }
+    return *this;
+}
+
+void JitProgram::release() {
+#ifdef STC_JIT_X86_64
+    if (memory) freeExecutable(memory, memorySize);
+#endif
+    entry = nullptr;
+    memory = nullptr;
+    memorySize = 0;
+}
+
+double JitProgram::evaluate(const double* vars) const {
+    if (program.variables() && !vars) throw runtime_error("Error: Program needs variable values.");
+    if (!entry) return program.evaluate(vars);
+    double result = entry(vars);
+    // NaN is either a division by zero or a genuine NaN; the interpreter
+    // tells them apart and throws for the former.
+    if (isnan(result)) return program.evaluate(vars);
+    return result;
+}
+
+bool JitProgram::supported() {
+#ifdef STC_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,50 @@
+#ifndef JITPROGRAM_H
+#define JITPROGRAM_H
+
+#include <cstddef>
+#include "Program.h"
+
+using namespace std;
+
+// A Program translated to native x86-64 code, for formulas evaluated many
+// times. The code is emitted straight into executable memory, with no
+// external compiler. The operand stack lives in SSE registers and spills to
+// the native stack only when it runs deep. On other CPUs, when the program
+// is too large, or when it calls functions (including % and ^), the JIT
+// falls back to the bytecode interpreter and gives the same results.
+// Immutable once built and safe to call from several threads.
+class JitProgram {
+public:
+    using Function = double (*)(const double* vars);
+
+    explicit JitProgram(const Program& program);
+    ~JitProgram();
+    JitProgram(JitProgram&& other) noexcept;
+    JitProgram& operator=(JitProgram&& other) noexcept;
+    JitProgram(const JitProgram&) = delete;
+    JitProgram& operator=(const JitProgram&) = delete;
+
+    // True when native code was generated for this program.
+    bool isNative() const { return entry != nullptr; }
+    // The generated function, or nullptr when interpreting. It cannot throw,
+    // so division by zero makes it return NaN instead.
+    Function function() const { return entry; }
+    // Bytes of generated code and constants; 0 when interpreting.
+    size_t codeSize() const { return memorySize; }
+
+    // Same results and errors as Program::evaluate(vars).
+    double evaluate(const double* vars = nullptr) const;
+
+    // Whether this build and CPU can run generated code.
+    static bool supported();
+
+private:
+    Program program;   // kept for the fallback and to report errors
+    Function entry;
+    void* memory;
+    size_t memorySize;
+
+    void release();
+};
+
+#endif
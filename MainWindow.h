@@ -13,9 +13,29 @@
 #include <QDialog>
 #include <QTextEdit>
 #include <QDateTime>
+#include <QSlider>
+#include <QLabel>
+#include <QToolButton>
+#include <QFont>
+#include <QFontMetrics>
+#include <QTreeWidget>
+#include <QProgressBar>
+#include <QTimer>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include "AST.h"
+#include "Cancellation.h"
+#include "HistoryStore.h"
+#include "IncrementalParser.h"
+#include "Instrumentation.h"
+#include "TreeLayout.h"
 
 
+class TreeItem;
+
 class ZoomableView : public QGraphicsView {
 public:
     explicit ZoomableView(QGraphicsScene *scene);
@@ -39,27 +59,82 @@ public:
 private slots:
     void clearHistory();
     void onEqualPressed();
+    void onDisplayEdited();
+    void updatePreview();
     void onStepForward();
     void onStepBack();
+    void onStepSliderMoved(int step);
     void showHistory();
+    void flushHistory();
+    void exportTrace();
+    void onCancelPressed();
+    void updateProgress();
 
 private:
     QLineEdit *display;
     QGraphicsScene *scene;
     ZoomableView *view;
+    TreeItem *treeItem;   // the drawn tree, or null when the scene is empty
     QPushButton *btnStepBack;
     QPushButton *btnStepForward;
     QPushButton *btnHistory;
+    QPushButton *btnExact;
+    QSlider *stepSlider;
+    QLabel *stepLabel;
+
+    // Collapsible per-phase stats for the current expression.
+    QToolButton *statsToggle;
+    QWidget *statsPanel;
+    QTreeWidget *statsTree;
+    std::unique_ptr<TraceSession> trace;
+
+    // Parsing, simplification, layout and evaluation run on one worker
+    // thread, one job at a time. A job returns what to apply on the GUI
+    // thread; starting another job cancels it and waits for it first.
+    using Job = std::function<std::function<void()>(CancellationToken &)>;
+    std::thread worker;
+    std::shared_ptr<CancellationToken> jobToken;
+    unsigned jobGeneration;
+    QWidget *progressPanel;
+    QLabel *progressLabel;
+    QProgressBar *progressBar;
+    QTimer *progressTimer;
 
+    // history[k] caches the tree after k steps; entries are built on demand
+    // from the precomputed schedule and may be null.
     std::vector<AST*> history;
+    // layouts[k] caches the drawing positions for step k. A step always has
+    // the same tree, so layouts survive when jumps evict cached trees.
+    std::vector<std::shared_ptr<const TreeLayout>> layouts;
+    AST::ReductionSchedule schedule;
     int currentStepIndex;
 
+    // One font for every node label.
+    QFont nodeFont;
+    // Label widths measured so far; only jobs use it, one at a time.
+    std::unordered_map<std::string, double> labelWidths;
+
+    // Live preview while typing: edits restart a short timer, and when it
+    // fires a job reparses incrementally, redraws and shows the value.
+    // The parser is only used by jobs.
+    QLabel *previewLabel;
+    QTimer *previewTimer;
+    IncrementalParser liveParser;
+    void setPreview(const QString &text, bool failed);
+
+    void resetSteps();
+    void drawTree(const std::shared_ptr<const TreeLayout> &layout, bool recentre);
     void updateVisualization();
+    void showStep(int step);
+    void refreshStats();
 
-    int getLeafCount(AST::BNode* node);
-    int calculateMaxNodeWidth(AST::BNode* node);
-    void drawTreeRecursive(AST::BNode* node, double x, double y, double spacing);
+    void startJob(Job job);
+    void stopJob();
+    void finishJob(unsigned generation, const std::function<void()> &apply, const std::string &error);
 
+    // Buffered calculation log; see HistoryStore.
+    std::unique_ptr<HistoryStore> historyStore;
+    QTimer *historyFlushTimer;
     void saveToHistory(const QString &expression, const QString &result);
 };
 
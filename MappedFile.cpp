@@ -0,0 +1,108 @@
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const string& path) : begin(nullptr), length(0), handle(nullptr) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) throw runtime_error("Error: Cannot open '" + path + "'.");
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        throw runtime_error("Error: Cannot read the size of '" + path + "'.");
+    }
+    if (size.QuadPart == 0) {
+        CloseHandle(file);
+        return;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) throw runtime_error("Error: Cannot map '" + path + "'.");
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        throw runtime_error("Error: Cannot map '" + path + "'.");
+    }
+    begin = static_cast<const char*>(view);
+    length = static_cast<size_t>(size.QuadPart);
+    handle = mapping;
+}
+
+void MappedFile::release() {
+    if (begin) UnmapViewOfFile(begin);
+    if (handle) CloseHandle(static_cast<HANDLE>(handle));
+}
+
+#else
+
+MappedFile::MappedFile(const string& path) : begin(nullptr), length(0), handle(nullptr) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Error: Cannot open '" + path + "'.");
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw runtime_error("Error: Cannot read the size of '" + path + "'.");
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);   // the mapping keeps the file alive
+    if (view == MAP_FAILED) throw runtime_error("Error: Cannot map '" + path + "'.");
+    begin = static_cast<const char*>(view);
+    length = static_cast<size_t>(info.st_size);
+}
+
+void MappedFile::release() {
+    if (begin) munmap(const_cast<char*>(begin), length);
+}
+
+#endif
+
+void MappedFile::discard(size_t offset, size_t count) const {
+#ifdef _WIN32
+    (void)offset;
+    (void)count;
+#else
+    // Only whole pages inside the range can go.
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + offset + page - 1) / page * page;
+    uintptr_t last = (reinterpret_cast<uintptr_t>(begin) + min(offset + count, length)) / page * page;
+    if (begin && last > first) madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+#endif
+}
+
+MappedFile::~MappedFile() {
+    release();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : begin(exchange(other.begin, nullptr)), length(exchange(other.length, 0)), handle(exchange(other.handle, nullptr)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        release();
+        begin = exchange(other.begin, nullptr);
+        length = exchange(other.length, 0);
+        handle = exchange(other.handle, nullptr);
+    }
+    return *this;
+}
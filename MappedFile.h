@@ -0,0 +1,43 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Read-only memory map of a whole file. Pages are loaded by the OS as they
+// are touched, so opening a large file costs nothing up front. An empty
+// file maps to an empty view. Throws runtime_error if the file cannot be
+// opened or mapped.
+class MappedFile {
+public:
+    MappedFile() : begin(nullptr), length(0), handle(nullptr) {}
+    explicit MappedFile(const string& path);
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return begin; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    string_view view() const { return string_view(begin, length); }
+
+    // Hints that [offset, offset + count) will not be read again, so its
+    // pages can leave the process's working set. Reading it later still
+    // works; it is simply faulted in again. A no-op where unsupported.
+    void discard(size_t offset, size_t count) const;
+
+private:
+    const char* begin;
+    size_t length;
+    void* handle;   // Windows mapping object; unused elsewhere
+
+    void release();
+};
+
+#endif
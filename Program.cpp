@@ -0,0 +1,88 @@
+#include "Program.h"
+#include "AST.h"
+#include <stdexcept>
+
+using namespace std;
+
+
+void Program::emit(Op op, uint32_t arg) {
+    Instr in{};
+    in.op = op;
+    in.arg = arg;
+    instructions.push_back(in);
+
+    switch (op) {
+        case Op::PushConst:
+        case Op::LoadVar:
+        case Op::LoadTemp:
+            if (++depth > maxStack) maxStack = depth;
+            break;
+        case Op::Store:
+            if (arg >= tempCount) tempCount = arg + 1;
+            break;
+        case Op::Neg:
+        case Op::Call1:
+            break;
+        default:
+            --depth;
+            break;
+    }
+}
+
+void Program::pushConstant(double value) {
+    constantPool.push_back(value);
+    emit(Op::PushConst, static_cast<uint32_t>(constantPool.size() - 1));
+}
+
+double Program::evaluate() const {
+    if (variableCount) throw runtime_error("Error: Program needs variable values.");
+    return evaluate(nullptr);
+}
+
+double Program::evaluate(const double* vars) const {
+    if (instructions.empty()) throw runtime_error("Program is empty.");
+    return run(instructions.data(), instructions.size(), constantPool.data(), vars, stackDepth());
+}
+
+// The operand stack grows up from the start of the frame and temporaries are
+// indexed down from its end, so one buffer of stackDepth() entries holds both.
+static double execute(const Program::Instr* code, size_t count, const double* constants,
+                      const double* vars, double* stack, double* frameEnd) {
+    double* top = stack - 1;
+    for (const Program::Instr* ip = code, *end = code + count; ip != end; ++ip) {
+        switch (ip->op) {
+            case Program::Op::PushConst: *++top = constants[ip->arg]; break;
+            case Program::Op::Add: top[-1] += top[0]; --top; break;
+            case Program::Op::Sub: top[-1] -= top[0]; --top; break;
+            case Program::Op::Mul: top[-1] *= top[0]; --top; break;
+            case Program::Op::Div:
+                if (top[0] == 0) throw runtime_error("Div by zero");
+                top[-1] /= top[0];
+                --top;
+                break;
+            case Program::Op::Neg: top[0] = -top[0]; break;
+            case Program::Op::LoadVar: *++top = vars[ip->arg]; break;
+            case Program::Op::Store: frameEnd[-1 - static_cast<ptrdiff_t>(ip->arg)] = *top; break;
+            case Program::Op::LoadTemp: *++top = frameEnd[-1 - static_cast<ptrdiff_t>(ip->arg)]; break;
+            case Program::Op::Call1:
+                top[0] = AST::getOperator(static_cast<AST::OpCode>(ip->arg)).unary(top[0]);
+                break;
+            case Program::Op::Call2:
+                top[-1] = AST::getOperator(static_cast<AST::OpCode>(ip->arg)).binary(top[-1], top[0]);
+                --top;
+                break;
+        }
+    }
+    return *top;
+}
+
+double Program::run(const Instr* code, size_t count, const double* constants,
+                    const double* vars, size_t frameSize) {
+    // Small programs keep their frame on the native stack.
+    if (frameSize <= 64) {
+        double stack[64];
+        return execute(code, count, constants, vars, stack, stack + frameSize);
+    }
+    vector<double> stack(frameSize);
+    return execute(code, count, constants, vars, stack.data(), stack.data() + frameSize);
+}
@@ -0,0 +1,67 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Postfix bytecode for a compiled expression. Evaluation is a tight stack
+// machine over pre-parsed constants, so a Program can be evaluated many times
+// without touching the tree it came from. Programs are immutable once built
+// and safe to evaluate from several threads at once.
+class Program {
+public:
+    // Store copies the top of the stack into a temporary without popping it;
+    // LoadTemp pushes it back. They let shared subexpressions run once.
+    // Call1 and Call2 apply an entry of AST's operator table to the top one
+    // or two values; % and ^ compile to them as well.
+    enum class Op : uint8_t { PushConst, Add, Sub, Mul, Div, Neg, LoadVar, Store, LoadTemp, Call1, Call2 };
+
+    struct Instr {
+        Op op;
+        uint8_t reserved[3];
+        uint32_t arg;   // PushConst: constant pool index, LoadVar: variable index,
+                        // Store/LoadTemp: temporary index, Call1/Call2: AST::OpCode
+    };
+    static_assert(sizeof(Instr) == 8, "Instr must stay 8 bytes");
+
+    Program() : maxStack(0), depth(0), variableCount(0), tempCount(0) {}
+
+    void emit(Op op, uint32_t arg = 0);
+    void pushConstant(double value);
+    void setVariableCount(size_t count) { variableCount = count; }
+
+    const vector<Instr>& code() const { return instructions; }
+    const vector<double>& constants() const { return constantPool; }
+    // Operand stack plus temporaries: the frame size run() needs.
+    size_t stackDepth() const { return maxStack + tempCount; }
+    size_t temporaries() const { return tempCount; }
+    size_t variables() const { return variableCount; }
+
+    double evaluate() const;
+    // vars[i] is the value of variable i (see AST::getVariables).
+    double evaluate(const double* vars) const;
+
+    // Evaluates every row of a columnar input: columns[i][row] is variable i.
+    // Runs block-wise SIMD kernels (AVX2 or SSE2, picked at runtime) with a
+    // scalar fallback; out must hold `rows` doubles.
+    void evaluateColumns(const double* const* columns, size_t rows, double* out) const;
+    // Name of the kernel set evaluateColumns dispatches to on this CPU.
+    static const char* columnKernelName();
+
+    // Runs raw bytecode; frameSize must be at least the program's stackDepth().
+    static double run(const Instr* code, size_t count, const double* constants,
+                      const double* vars, size_t frameSize);
+
+private:
+    vector<Instr> instructions;
+    vector<double> constantPool;
+    size_t maxStack;
+    size_t depth;   // running stack depth while emitting
+    size_t variableCount;
+    size_t tempCount;
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include "Program.h"
+#include "AST.h"
+#include "CpuFeatures.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+using namespace std;
+
+// Element-wise kernels used by Program::evaluateColumns. Every kernel accepts
+// dst aliasing one of its inputs. Division reports a zero divisor instead of
+// throwing so the caller can raise the same error as the scalar interpreter.
+
+namespace {
+
+struct Kernels {
+    const char* name;
+    void (*add)(double* dst, const double* a, const double* b, size_t n);
+    void (*sub)(double* dst, const double* a, const double* b, size_t n);
+    void (*mul)(double* dst, const double* a, const double* b, size_t n);
+    bool (*div)(double* dst, const double* a, const double* b, size_t n);
+    void (*neg)(double* dst, const double* a, size_t n);
+};
+
+// --- Scalar --------------------------------------------------------------
+
+void scalarAdd(double* dst, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; ++i) dst[i] = a[i] + b[i]; }
+void scalarSub(double* dst, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; ++i) dst[i] = a[i] - b[i]; }
+void scalarMul(double* dst, const double* a, const double* b, size_t n) { for (size_t i = 0; i < n; ++i) dst[i] = a[i] * b[i]; }
+void scalarNeg(double* dst, const double* a, size_t n) { for (size_t i = 0; i < n; ++i) dst[i] = -a[i]; }
+
+bool scalarDiv(double* dst, const double* a, const double* b, size_t n) {
+    bool zero = false;
+    for (size_t i = 0; i < n; ++i) {
+        zero |= b[i] == 0;
+        dst[i] = a[i] / b[i];
+    }
+    return !zero;
+}
+
+const Kernels scalarKernels = {"scalar", scalarAdd, scalarSub, scalarMul, scalarDiv, scalarNeg};
+
+#ifdef STC_X86_64
+
+// --- SSE2 (baseline on x86-64) -------------------------------------------
+
+#define STC_SSE2_BINARY(name, intrinsic, op)                                        \
+    void name(double* dst, const double* a, const double* b, size_t n) {            \
+        size_t i = 0;                                                               \
+        for (; i + 2 <= n; i += 2)                                                  \
+            _mm_storeu_pd(dst + i, intrinsic(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))); \
+        for (; i < n; ++i) dst[i] = a[i] op b[i];                                   \
+    }
+
+STC_SSE2_BINARY(sse2Add, _mm_add_pd, +)
+STC_SSE2_BINARY(sse2Sub, _mm_sub_pd, -)
+STC_SSE2_BINARY(sse2Mul, _mm_mul_pd, *)
+
+bool sse2Div(double* dst, const double* a, const double* b, size_t n) {
+    const __m128d zero = _mm_setzero_pd();
+    __m128d hits = zero;
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d vb = _mm_loadu_pd(b + i);
+        hits = _mm_or_pd(hits, _mm_cmpeq_pd(vb, zero));
+        _mm_storeu_pd(dst + i, _mm_div_pd(_mm_loadu_pd(a + i), vb));
+    }
+    bool ok = _mm_movemask_pd(hits) == 0;
+    for (; i < n; ++i) {
+        ok &= b[i] != 0;
+        dst[i] = a[i] / b[i];
+    }
+    return ok;
+}
+
+void sse2Neg(double* dst, const double* a, size_t n) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(dst + i, _mm_xor_pd(_mm_loadu_pd(a + i), sign));
+    for (; i < n; ++i) dst[i] = -a[i];
+}
+
+const Kernels sse2Kernels = {"sse2", sse2Add, sse2Sub, sse2Mul, sse2Div, sse2Neg};
+
+// --- AVX2 ----------------------------------------------------------------
+
+#define STC_AVX2_BINARY(name, intrinsic, op)                                        \
+    STC_TARGET_AVX2 void name(double* dst, const double* a, const double* b, size_t n) { \
+        size_t i = 0;                                                               \
+        for (; i + 4 <= n; i += 4)                                                  \
+            _mm256_storeu_pd(dst + i, intrinsic(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+        for (; i < n; ++i) dst[i] = a[i] op b[i];                                   \
+    }
+
+STC_AVX2_BINARY(avx2Add, _mm256_add_pd, +)
+STC_AVX2_BINARY(avx2Sub, _mm256_sub_pd, -)
+STC_AVX2_BINARY(avx2Mul, _mm256_mul_pd, *)
+
+STC_TARGET_AVX2 bool avx2Div(double* dst, const double* a, const double* b, size_t n) {
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d hits = zero;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d vb = _mm256_loadu_pd(b + i);
+        hits = _mm256_or_pd(hits, _mm256_cmp_pd(vb, zero, _CMP_EQ_OQ));
+        _mm256_storeu_pd(dst + i, _mm256_div_pd(_mm256_loadu_pd(a + i), vb));
+    }
+    bool ok = _mm256_movemask_pd(hits) == 0;
+    for (; i < n; ++i) {
+        ok &= b[i] != 0;
+        dst[i] = a[i] / b[i];
+    }
+    return ok;
+}
+
+STC_TARGET_AVX2 void avx2Neg(double* dst, const double* a, size_t n) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(dst + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+    for (; i < n; ++i) dst[i] = -a[i];
+}
+
+const Kernels avx2Kernels = {"avx2", avx2Add, avx2Sub, avx2Mul, avx2Div, avx2Neg};
+
+#endif
+
+const Kernels& selectKernels() {
+    string_view limit = simdLimit();
+    if (limit == "scalar") return scalarKernels;
+#ifdef STC_X86_64
+    if (limit != "sse2" && cpuHasAvx2()) return avx2Kernels;
+    return sse2Kernels;
+#else
+    return scalarKernels;
+#endif
+}
+
+const Kernels& kernels() {
+    static const Kernels& selected = selectKernels();
+    return selected;
+}
+
+}
+
+const char* Program::columnKernelName() {
+    return kernels().name;
+}
+
+void Program::evaluateColumns(const double* const* columns, size_t rows, double* out) const {
+    if (instructions.empty()) throw runtime_error("Program is empty.");
+    if (rows == 0) return;
+
+    const Kernels& k = kernels();
+    // 512-row blocks, shrunk for very deep programs so scratch stays near 8 MB.
+    const size_t BLOCK = max<size_t>(16, min<size_t>(512, (size_t(1) << 20) / max<size_t>(maxStack, 1)));
+
+    // One scratch block per stack slot and per temporary. Stack entries are
+    // pointers, so variables are read straight from their columns without
+    // copying; temporaries follow the stack slots in scratch.
+    vector<double> scratch((maxStack + tempCount) * BLOCK);
+    vector<const double*> slot(maxStack);
+    vector<const double*> temp(tempCount);
+
+    for (size_t base = 0; base < rows; base += BLOCK) {
+        size_t n = min(BLOCK, rows - base);
+        size_t top = 0;   // number of live stack entries
+
+        for (const Instr& in : instructions) {
+            switch (in.op) {
+                case Op::PushConst: {
+                    double* dst = scratch.data() + top * BLOCK;
+                    fill_n(dst, n, constantPool[in.arg]);
+                    slot[top++] = dst;
+                    break;
+                }
+                case Op::LoadVar: slot[top++] = columns[in.arg] + base; break;
+                case Op::Store: {
+                    double* dst = scratch.data() + (maxStack + in.arg) * BLOCK;
+                    memcpy(dst, slot[top - 1], n * sizeof(double));
+                    temp[in.arg] = dst;
+                    break;
+                }
+                case Op::LoadTemp: slot[top++] = temp[in.arg]; break;
+                case Op::Neg: {
+                    double* dst = scratch.data() + (top - 1) * BLOCK;
+                    k.neg(dst, slot[top - 1], n);
+                    slot[top - 1] = dst;
+                    break;
+                }
+                case Op::Call1: {
+                    // Library functions have no vector kernels.
+                    AST::UnaryFunction f = AST::getOperator(static_cast<AST::OpCode>(in.arg)).unary;
+                    double* dst = scratch.data() + (top - 1) * BLOCK;
+                    const double* a = slot[top - 1];
+                    for (size_t i = 0; i < n; ++i) dst[i] = f(a[i]);
+                    slot[top - 1] = dst;
+                    break;
+                }
+                default: {
+                    double* dst = scratch.data() + (top - 2) * BLOCK;
+                    const double* a = slot[top - 2];
+                    const double* b = slot[top - 1];
+                    switch (in.op) {
+                        case Op::Add: k.add(dst, a, b, n); break;
+                        case Op::Sub: k.sub(dst, a, b, n); break;
+                        case Op::Mul: k.mul(dst, a, b, n); break;
+                        case Op::Div:
+                            if (!k.div(dst, a, b, n)) throw runtime_error("Div by zero");
+                            break;
+                        case Op::Call2: {
+                            AST::BinaryFunction f = AST::getOperator(static_cast<AST::OpCode>(in.arg)).binary;
+                            for (size_t i = 0; i < n; ++i) dst[i] = f(a[i], b[i]);
+                            break;
+                        }
+                        default: break;
+                    }
+                    slot[top - 2] = dst;
+                    --top;
+                    break;
+                }
+            }
+        }
+        memcpy(out + base, slot[0], n * sizeof(double));
+    }
+}
@@ -0,0 +1,293 @@
+#include "ProgramLibrary.h"
+#include "AST.h"
+#include "Instrumentation.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t fileSize;
+    uint64_t checksum;   // of every byte after the header
+    uint64_t reserved;
+};
+static_assert(sizeof(Header) == 40, "Header is part of the file format");
+
+const char MAGIC[8] = {'S', 'T', 'C', 'P', 'L', 'I', 'B', '\0'};
+
+}
+
+// FNV-1a over 64-bit words in four interleaved lanes, rotated so high bits
+// feed back down. Catches truncation and stray writes at memory speed; it is
+// not meant to resist tampering. `size` is a multiple of 8.
+static uint64_t checksum(const char* data, size_t size) {
+    const uint64_t PRIME = 0x100000001b3ULL;
+    uint64_t lanes[4] = {0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL, 0x9ce484222325cbf2ULL, 0x2325cbf29ce48422ULL};
+    size_t words = size / 8, i = 0;
+    for (; i + 4 <= words; i += 4) {
+        for (size_t k = 0; k < 4; ++k) {
+            uint64_t word;
+            memcpy(&word, data + (i + k) * 8, 8);
+            lanes[k] = rotl((lanes[k] ^ word) * PRIME, 29);
+        }
+    }
+    for (; i < words; ++i) {
+        uint64_t word;
+        memcpy(&word, data + i * 8, 8);
+        lanes[0] = rotl((lanes[0] ^ word) * PRIME, 29);
+    }
+    uint64_t hash = lanes[0];
+    for (size_t k = 1; k < 4; ++k) hash = rotl((hash ^ lanes[k]) * PRIME, 29);
+    return hash ^ size;
+}
+
+// Whether a Call1/Call2 operand names a built-in function of that arity.
+// Registered functions get their codes at runtime, so a file cannot name them.
+static bool isStoredFunction(uint32_t arg, int arity) {
+    if (arg >= static_cast<uint32_t>(AST::OpCode::BuiltinCount)) return false;
+    const AST::Operator& entry = AST::getOperator(static_cast<AST::OpCode>(arg));
+    return arity == 1 ? entry.unary != nullptr : entry.binary != nullptr;
+}
+
+// The file is read and written in place, so it only matches the host's own
+// layout on little-endian machines.
+static void requireLittleEndian() {
+    if constexpr (endian::native != endian::little) {
+        throw runtime_error("Error: Program libraries need a little-endian machine.");
+    }
+}
+
+ProgramLibrary::ProgramLibrary(const string& path) : file(path), count(0) {
+    STC_TRACE_SCOPE("loadLibrary");
+    count = validate(path);
+}
+
+size_t ProgramLibrary::validate(const string& path) const {
+    requireLittleEndian();
+    auto bad = [&](const string& why) {
+        return runtime_error("Error: '" + path + "' is not a valid program library (" + why + ").");
+    };
+    const char* base = file.data();
+    size_t size = file.size();
+
+    Header header;
+    if (size < sizeof header) throw bad("too short");
+    memcpy(&header, base, sizeof header);
+    if (memcmp(header.magic, MAGIC, sizeof MAGIC) != 0) throw bad("wrong magic number");
+    if (header.version != VERSION) {
+        throw bad("version " + to_string(header.version) + ", expected " + to_string(VERSION));
+    }
+    if (header.fileSize != size || size % 8 != 0) throw bad("truncated");
+    if (checksum(base + sizeof header, size - sizeof header) != header.checksum) throw bad("checksum mismatch");
+    if (header.count > (size - sizeof header) / sizeof(Record)) throw bad("directory out of bounds");
+
+    // Sections are 8-byte aligned within a page-aligned mapping.
+    auto fits = [&](uint64_t offset, uint64_t items, size_t itemSize) {
+        return offset % 8 == 0 && offset <= size && items <= (size - offset) / itemSize;
+    };
+    const Record* records = reinterpret_cast<const Record*>(base + sizeof header);
+    string_view previous;
+    vector<bool> stored;
+    for (size_t i = 0; i < header.count; ++i) {
+        const Record& r = records[i];
+        auto which = [i]() { return "program " + to_string(i); };
+        if (!fits(r.codeOffset, r.codeCount, sizeof(Program::Instr)) || !fits(r.constantsOffset, r.constantCount, sizeof(double))
+            || !fits(r.namesOffset, r.namesSize, 1)) {
+            throw bad(which() + " out of bounds");
+        }
+
+        const char* names = base + r.namesOffset;
+        if (r.namesSize == 0 || names[r.namesSize - 1] != '\0'
+            || size_t(std::count(names, names + r.namesSize, '\0')) != size_t(r.variableCount) + 1) {
+            throw bad(which() + " has malformed names");
+        }
+        string_view name(names);
+        if (i > 0 && !(previous < name)) throw bad("directory not sorted by name");
+        previous = name;
+
+        // Replay the stack effect of every instruction, as Program::emit
+        // does, and check each operand against what it indexes.
+        const Program::Instr* code = reinterpret_cast<const Program::Instr*>(base + r.codeOffset);
+        if (r.frameSize > 2 * uint64_t(r.codeCount)) throw bad(which() + " has an oversized frame");
+        stored.assign(r.frameSize, false);
+        size_t depth = 0, maxStack = 0, temps = 0;
+        for (size_t k = 0; k < r.codeCount; ++k) {
+            uint32_t arg = code[k].arg;
+            bool ok = true;
+            switch (code[k].op) {
+                case Program::Op::PushConst: ok = arg < r.constantCount; ++depth; break;
+                case Program::Op::LoadVar: ok = arg < r.variableCount; ++depth; break;
+                case Program::Op::LoadTemp: ok = arg < r.frameSize && stored[arg]; ++depth; break;
+                case Program::Op::Store:
+                    ok = depth > 0 && arg < r.frameSize;
+                    if (ok) stored[arg] = true;
+                    temps = max<size_t>(temps, size_t(arg) + 1);
+                    break;
+                case Program::Op::Neg: ok = depth > 0; break;
+                case Program::Op::Call1: ok = depth > 0 && isStoredFunction(arg, 1); break;
+                case Program::Op::Call2:
+                    ok = depth > 1 && isStoredFunction(arg, 2);
+                    --depth;
+                    break;
+                case Program::Op::Add:
+                case Program::Op::Sub:
+                case Program::Op::Mul:
+                case Program::Op::Div:
+                    ok = depth > 1;
+                    --depth;
+                    break;
+                default: ok = false; break;
+            }
+            if (!ok) throw bad(which() + " has an invalid instruction at " + to_string(k));
+            maxStack = max(maxStack, depth);
+        }
+        if (depth != 1) throw bad(which() + " does not leave one result");
+        if (maxStack + temps > r.frameSize) throw bad(which() + " overflows its frame");
+    }
+    return header.count;
+}
+
+ProgramLibrary::Entry ProgramLibrary::at(size_t i) const {
+    if (i >= count) throw out_of_range("Error: Program library index out of range.");
+    Entry entry;
+    entry.base = file.data();
+    entry.record = reinterpret_cast<const Record*>(file.data() + sizeof(Header)) + i;
+    entry.label = string_view(entry.base + entry.record->namesOffset);
+    return entry;
+}
+
+bool ProgramLibrary::find(string_view name, Entry& entry) const {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        Entry candidate = at(mid);
+        int order = candidate.name().compare(name);
+        if (order == 0) {
+            entry = candidate;
+            return true;
+        }
+        if (order < 0) low = mid + 1;
+        else high = mid;
+    }
+    return false;
+}
+
+string_view ProgramLibrary::Entry::variable(size_t i) const {
+    if (i >= record->variableCount) throw out_of_range("Error: Variable index out of range.");
+    const char* p = label.data() + label.size() + 1;
+    for (; i > 0; --i) p += strlen(p) + 1;
+    return string_view(p);
+}
+
+double ProgramLibrary::Entry::evaluate() const {
+    // Same message as AST::calculate(), which knows the names too.
+    if (record->variableCount) throw runtime_error("Error: Unbound variable '" + string(variable(0)) + "'.");
+    return evaluate(nullptr);
+}
+
+double ProgramLibrary::Entry::evaluate(const double* vars) const {
+    return Program::run(reinterpret_cast<const Program::Instr*>(base + record->codeOffset), record->codeCount,
+                        reinterpret_cast<const double*>(base + record->constantsOffset), vars, record->frameSize);
+}
+
+void ProgramLibraryWriter::add(string name, const AST& tree) {
+    add(move(name), tree.compile(), tree.getVariables());
+}
+
+void ProgramLibraryWriter::add(string name, Program program, vector<string> variables) {
+    if (name.find('\0') != string::npos) throw runtime_error("Error: Program names cannot contain '\\0'.");
+    if (program.code().empty()) throw runtime_error("Error: Cannot store an empty program.");
+    if (program.variables() > variables.size()) throw runtime_error("Error: Missing variable names for '" + name + "'.");
+    for (const string& variable : variables) {
+        if (variable.find('\0') != string::npos) throw runtime_error("Error: Variable names cannot contain '\\0'.");
+    }
+    for (const Program::Instr& in : program.code()) {
+        bool call = in.op == Program::Op::Call1 || in.op == Program::Op::Call2;
+        if (call && !isStoredFunction(in.arg, in.op == Program::Op::Call1 ? 1 : 2)) {
+            throw runtime_error("Error: Program '" + name + "' calls a registered function, which a library cannot store.");
+        }
+    }
+    if (program.code().size() > UINT32_MAX || program.constants().size() > UINT32_MAX) {
+        throw runtime_error("Error: Program '" + name + "' is too large for a library.");
+    }
+    programs.push_back({move(name), move(program), move(variables)});
+}
+
+static size_t alignUp(size_t offset) {
+    return (offset + 7) & ~size_t(7);
+}
+
+void ProgramLibraryWriter::save(const string& path) const {
+    requireLittleEndian();
+    vector<const Item*> order;
+    order.reserve(programs.size());
+    for (const Item& item : programs) order.push_back(&item);
+    sort(order.begin(), order.end(), [](const Item* a, const Item* b) { return a->name < b->name; });
+    for (size_t i = 1; i < order.size(); ++i) {
+        if (order[i]->name == order[i - 1]->name) {
+            throw runtime_error("Error: Duplicate program name '" + order[i]->name + "'.");
+        }
+    }
+    if (order.size() > UINT32_MAX) throw runtime_error("Error: Too many programs for one library.");
+
+    // Lay out every section first, then fill one image of the whole file.
+    vector<ProgramLibrary::Record> records(order.size());
+    size_t offset = sizeof(Header) + records.size() * sizeof(ProgramLibrary::Record);
+    for (size_t i = 0; i < order.size(); ++i) {
+        const Item& item = *order[i];
+        ProgramLibrary::Record& r = records[i];
+        r = {};
+        r.codeOffset = offset;
+        r.codeCount = uint32_t(item.program.code().size());
+        offset = alignUp(offset + r.codeCount * sizeof(Program::Instr));
+        r.constantsOffset = offset;
+        r.constantCount = uint32_t(item.program.constants().size());
+        offset = alignUp(offset + r.constantCount * sizeof(double));
+        r.namesOffset = offset;
+        size_t namesSize = item.name.size() + 1;
+        for (size_t v = 0; v < item.program.variables(); ++v) namesSize += item.variables[v].size() + 1;
+        if (namesSize > UINT32_MAX) throw runtime_error("Error: Program '" + item.name + "' is too large for a library.");
+        r.namesSize = uint32_t(namesSize);
+        offset = alignUp(offset + namesSize);
+        r.variableCount = uint32_t(item.program.variables());
+        r.frameSize = uint32_t(item.program.stackDepth());
+    }
+
+    string image(offset, '\0');
+    if (!records.empty()) memcpy(&image[sizeof(Header)], records.data(), records.size() * sizeof(ProgramLibrary::Record));
+    for (size_t i = 0; i < order.size(); ++i) {
+        const Item& item = *order[i];
+        const ProgramLibrary::Record& r = records[i];
+        memcpy(&image[r.codeOffset], item.program.code().data(), r.codeCount * sizeof(Program::Instr));
+        if (r.constantCount) memcpy(&image[r.constantsOffset], item.program.constants().data(), r.constantCount * sizeof(double));
+        size_t at = r.namesOffset;
+        memcpy(&image[at], item.name.data(), item.name.size());
+        at += item.name.size() + 1;
+        for (size_t v = 0; v < r.variableCount; ++v) {
+            memcpy(&image[at], item.variables[v].data(), item.variables[v].size());
+            at += item.variables[v].size() + 1;
+        }
+    }
+
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.version = ProgramLibrary::VERSION;
+    header.count = uint32_t(order.size());
+    header.fileSize = image.size();
+    header.checksum = checksum(image.data() + sizeof header, image.size() - sizeof header);
+    memcpy(&image[0], &header, sizeof header);
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) throw runtime_error("Error: Cannot open '" + path + "' for writing.");
+    out.write(image.data(), image.size());
+    if (!out) throw runtime_error("Error: Failed to write '" + path + "'.");
+}
@@ -0,0 +1,113 @@
+#ifndef PROGRAMLIBRARY_H
+#define PROGRAMLIBRARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "MappedFile.h"
+#include "Program.h"
+
+class AST;
+
+using namespace std;
+
+// A file of compiled programs, looked up by name and evaluated straight out
+// of a memory map. Opening one maps the file and validates it once; there is
+// no deserialization, so a library of thousands of formulas is ready as soon
+// as its pages are. Throws runtime_error if the file is not a valid library.
+//
+// Layout, little-endian, every section 8-byte aligned, offsets from the
+// start of the file:
+//
+//   Header     magic "STCPLIB\0", version, program count, file size,
+//              checksum of everything after the header
+//   Directory  one Record per program, sorted by name
+//   Sections   per program: Program::Instr code, double constants, then
+//              its name and variable names, each ending in '\0'
+//
+// Calls store the AST::OpCode of a built-in function. Functions added with
+// AST::registerFunction() are numbered at runtime, so the writer rejects
+// programs that call them.
+//
+// Validation checks every offset and every instruction operand, and runs
+// the stack discipline of each program, so a loaded library cannot make
+// Program::run read or write out of bounds.
+class ProgramLibrary {
+    friend class ProgramLibraryWriter;
+
+    // Directory entry of one program, as stored in the file.
+    struct Record {
+        uint64_t codeOffset;
+        uint64_t constantsOffset;
+        uint64_t namesOffset;
+        uint32_t codeCount;
+        uint32_t constantCount;
+        uint32_t namesSize;
+        uint32_t variableCount;
+        uint32_t frameSize;   // Program::stackDepth()
+        uint32_t reserved;
+    };
+    static_assert(sizeof(Record) == 48, "Record is part of the file format");
+
+public:
+    // A program in the library; the views point into the mapping.
+    class Entry {
+    public:
+        string_view name() const { return label; }
+        size_t variables() const { return record->variableCount; }
+        // Name of variable i, as in AST::getVariables(). Walks the names
+        // before it, so fetch them once rather than per evaluation.
+        string_view variable(size_t i) const;
+        size_t instructions() const { return record->codeCount; }
+
+        double evaluate() const;
+        // vars[i] is the value of variable i.
+        double evaluate(const double* vars) const;
+
+    private:
+        friend class ProgramLibrary;
+        const char* base = nullptr;
+        const Record* record = nullptr;
+        string_view label;   // the variable names follow it
+    };
+
+    static constexpr uint32_t VERSION = 1;
+
+    ProgramLibrary() : count(0) {}
+    explicit ProgramLibrary(const string& path);
+
+    size_t size() const { return count; }
+    Entry at(size_t i) const;
+    // Binary search on the sorted directory; false if there is no such name.
+    bool find(string_view name, Entry& entry) const;
+
+private:
+    MappedFile file;
+    size_t count;
+
+    size_t validate(const string& path) const;
+};
+
+// Collects programs and writes them as a ProgramLibrary file.
+class ProgramLibraryWriter {
+public:
+    // Compiles the tree and keeps its variable names.
+    void add(string name, const AST& tree);
+    void add(string name, Program program, vector<string> variables);
+
+    size_t size() const { return programs.size(); }
+    // Throws runtime_error on duplicate names or if the file cannot be written.
+    void save(const string& path) const;
+
+private:
+    struct Item {
+        string name;
+        Program program;
+        vector<string> variables;
+    };
+    vector<Item> programs;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "Rational.h"
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+
+Rational::Rational(BigInt numerator, BigInt denominator) : num(move(numerator)), den(move(denominator)) {
+    if (den.isZero()) throw runtime_error("Div by zero");
+    if (den.isNegative()) {
+        num = -num;
+        den = -den;
+    }
+    BigInt g = BigInt::gcd(num, den);
+    if (!g.isOne() && !g.isZero()) {
+        num = num / g;
+        den = den / g;
+    }
+}
+
+Rational Rational::parse(string_view literal) {
+    // Short literals, the common case, are read straight into an int64_t.
+    if (literal.size() <= 18) {
+        int64_t value = 0, scale = 1;
+        bool digits = false, point = false, valid = true;
+        for (char c : literal) {
+            if (c >= '0' && c <= '9') {
+                value = value * 10 + (c - '0');
+                if (point) scale *= 10;
+                digits = true;
+            } else if (c == '.' && !point) {
+                point = true;
+            } else {
+                valid = false;
+                break;
+            }
+        }
+        if (valid && digits) return scale == 1 ? Rational(value) : Rational(BigInt(value), BigInt(scale));
+    }
+    size_t dot = literal.find('.');
+    string_view whole = literal.substr(0, dot);
+    string_view fraction = dot == string_view::npos ? string_view() : literal.substr(dot + 1);
+    if (whole.empty() && fraction.empty()) throw runtime_error("Error: Invalid number '" + string(literal) + "'.");
+    if (!whole.empty() && whole[0] == '-') throw runtime_error("Error: Invalid number '" + string(literal) + "'.");
+    // "12.34" is 1234 / 10^2.
+    string digits(whole);
+    digits += fraction;
+    BigInt value = BigInt::parse(digits.empty() ? "0" : digits);
+    if (fraction.empty()) return Rational(move(value));
+    return Rational(move(value), BigInt::power10(fraction.size()));
+}
+
+Rational Rational::fromDouble(double value) {
+    if (!isfinite(value)) throw runtime_error("Error: Cannot represent a non-finite value exactly.");
+    int exponent;
+    double mantissa = frexp(value, &exponent);
+    // Scale the 53-bit mantissa to an integer: value = m * 2^(exponent - 53).
+    int64_t m = int64_t(ldexp(mantissa, 53));
+    exponent -= 53;
+    if (exponent >= 0) return Rational(BigInt(m) << size_t(exponent));
+    return Rational(BigInt(m), BigInt::power2(size_t(-exponent)));
+}
+
+Rational Rational::operator-() const {
+    return Rational(-num, den, Reduced());
+}
+
+Rational operator+(const Rational& a, const Rational& b) {
+    if (a.isInteger() && b.isInteger()) return Rational(a.num + b.num);
+    return Rational(a.num * b.den + b.num * a.den, a.den * b.den);
+}
+
+Rational operator-(const Rational& a, const Rational& b) {
+    if (a.isInteger() && b.isInteger()) return Rational(a.num - b.num);
+    return Rational(a.num * b.den - b.num * a.den, a.den * b.den);
+}
+
+Rational operator*(const Rational& a, const Rational& b) {
+    if (a.isInteger() && b.isInteger()) return Rational(a.num * b.num);
+    return Rational(a.num * b.num, a.den * b.den);
+}
+
+Rational operator/(const Rational& a, const Rational& b) {
+    if (b.isZero()) throw runtime_error("Div by zero");
+    return Rational(a.num * b.den, a.den * b.num);
+}
+
+Rational operator%(const Rational& a, const Rational& b) {
+    if (b.isZero()) throw runtime_error("Div by zero");
+    if (a.isInteger() && b.isInteger()) return Rational(a.num % b.num);
+    // a/b = (an bd) / (bn ad), so the remainder is (an bd mod bn ad) / (ad bd).
+    return Rational((a.num * b.den) % (b.num * a.den), a.den * b.den);
+}
+
+Rational Rational::power(int64_t exponent) const {
+    if (exponent < 0 && isZero()) throw runtime_error("Div by zero");
+    // Powers of coprime numbers stay coprime, so the result is reduced.
+    BigInt n(1), d(1), baseNum = num, baseDen = den;
+    for (uint64_t e = exponent < 0 ? 0 - uint64_t(exponent) : uint64_t(exponent); e; e >>= 1) {
+        if (e & 1) {
+            n = n * baseNum;
+            d = d * baseDen;
+        }
+        if (e > 1) {
+            baseNum = baseNum * baseNum;
+            baseDen = baseDen * baseDen;
+        }
+    }
+    if (exponent >= 0) return Rational(move(n), move(d), Reduced());
+    if (n.isNegative()) return Rational(-d, -n, Reduced());
+    return Rational(move(d), move(n), Reduced());
+}
+
+bool operator<(const Rational& a, const Rational& b) {
+    if (a.isInteger() && b.isInteger()) return a.num < b.num;
+    return a.num * b.den < b.num * a.den;
+}
+
+// Inserts a decimal point `scale` digits from the right of |digits|.
+static string placePoint(const BigInt& scaled, size_t scale) {
+    string digits = scaled.abs().toString();
+    if (digits.size() <= scale) digits.insert(0, scale - digits.size() + 1, '0');
+    if (scale) digits.insert(digits.size() - scale, ".");
+    return (scaled.isNegative() ? "-" : "") + digits;
+}
+
+string Rational::toString() const {
+    if (isInteger()) return num.toString();
+    // The expansion terminates iff the denominator is 2^a 5^b; then
+    // max(a, b) digits are enough.
+    size_t twos = den.trailingZeros();
+    BigInt rest = den >> twos;
+    size_t fives = 0;
+    BigInt quotient, remainder;
+    for (;;) {
+        BigInt::divide(rest, BigInt(5), quotient, remainder);
+        if (!remainder.isZero()) break;
+        rest = move(quotient);
+        ++fives;
+    }
+    if (!rest.isOne()) return num.toString() + "/" + den.toString();
+    size_t scale = max(twos, fives);
+    return placePoint(num * BigInt::power10(scale) / den, scale);
+}
+
+string Rational::toDecimal(size_t digits) const {
+    // round(|n| * 10^digits / d) = floor((2 |n| 10^digits + d) / 2d)
+    BigInt scaled = (num.abs() * BigInt::power10(digits) * BigInt(2) + den) / (den * BigInt(2));
+    return placePoint(num.isNegative() ? -scaled : scaled, digits);
+}
+
+double Rational::toDouble() const {
+    if (isInteger()) return num.toDouble();
+    // Shift so the integer quotient carries 64 significant bits, then scale back.
+    // A nonzero remainder becomes a sticky low bit, so the final conversion
+    // still rounds correctly.
+    long shift = 64 + long(den.bitLength()) - long(num.bitLength());
+    BigInt scaled, remainder;
+    if (shift >= 0) BigInt::divide(num << size_t(shift), den, scaled, remainder);
+    else BigInt::divide(num, den << size_t(-shift), scaled, remainder);
+    if (!remainder.isZero() && scaled.trailingZeros() > 0) scaled = scaled + BigInt(scaled.sign());
+    return ldexp(scaled.toDouble(), int(max(-100000L, min(100000L, -shift))));
+}
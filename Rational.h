@@ -0,0 +1,67 @@
+#ifndef RATIONAL_H
+#define RATIONAL_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "BigInt.h"
+
+using namespace std;
+
+// Exact fraction of two BigInts, always in lowest terms with a positive
+// denominator. Decimal literals such as 0.1 are represented exactly, so sums
+// like 0.1 + 0.2 come out as 3/10. Integer-only arithmetic skips the
+// fraction work, and small values never allocate.
+class Rational {
+public:
+    Rational() : num(0), den(1) {}
+    Rational(int64_t value) : num(value), den(1) {}
+    Rational(BigInt value) : num(move(value)), den(1) {}
+    // Throws "Div by zero" if `denominator` is zero.
+    Rational(BigInt numerator, BigInt denominator);
+
+    // Decimal literal: digits with an optional fractional part, as the
+    // tokenizer accepts them ("12", "1.25", ".5", "3."). Throws runtime_error
+    // otherwise.
+    static Rational parse(string_view literal);
+    // The exact value of a finite double. Throws on inf and NaN.
+    static Rational fromDouble(double value);
+
+    const BigInt& numerator() const { return num; }
+    const BigInt& denominator() const { return den; }
+    bool isInteger() const { return den.isOne(); }
+    bool isZero() const { return num.isZero(); }
+
+    Rational operator-() const;
+    friend Rational operator+(const Rational& a, const Rational& b);
+    friend Rational operator-(const Rational& a, const Rational& b);
+    friend Rational operator*(const Rational& a, const Rational& b);
+    // Throws "Div by zero".
+    friend Rational operator/(const Rational& a, const Rational& b);
+    // a - b * trunc(a / b), which has the sign of a, as fmod. Throws "Div by zero".
+    friend Rational operator%(const Rational& a, const Rational& b);
+    // Negative exponents give the reciprocal; 0 to a negative power throws "Div by zero".
+    Rational power(int64_t exponent) const;
+    Rational abs() const { return Rational(num.abs(), den, Reduced()); }
+
+    friend bool operator==(const Rational& a, const Rational& b) { return a.num == b.num && a.den == b.den; }
+    friend bool operator!=(const Rational& a, const Rational& b) { return !(a == b); }
+    friend bool operator<(const Rational& a, const Rational& b);
+
+    // Exact text: an integer, a terminating decimal, or "n/d" when the
+    // decimal expansion would repeat.
+    string toString() const;
+    // Rounded to `digits` fractional digits, halves away from zero.
+    string toDecimal(size_t digits) const;
+    // Nearest double.
+    double toDouble() const;
+
+private:
+    BigInt num;
+    BigInt den;
+
+    struct Reduced {};
+    Rational(BigInt numerator, BigInt denominator, Reduced) : num(move(numerator)), den(move(denominator)) {}
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "ServerProtocol.h"
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+
+void ServerProtocol::appendU32(string& out, uint32_t value) {
+    char bytes[4] = {char(value), char(value >> 8), char(value >> 16), char(value >> 24)};
+    out.append(bytes, 4);
+}
+
+uint32_t ServerProtocol::readU32(const char* data) {
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(data);
+    return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+}
+
+size_t ServerProtocol::frameSize(const char* data, size_t available) {
+    if (available < HEADER_BYTES) return 0;
+    uint32_t length = readU32(data);
+    if (length > MAX_FRAME_BYTES) throw runtime_error("Error: Frame too large.");
+    return HEADER_BYTES + length;
+}
+
+// Reads fields off the front of a payload, failing on truncation.
+class PayloadReader {
+public:
+    explicit PayloadReader(string_view payload) : rest(payload) {}
+
+    uint32_t u32() {
+        need(4);
+        uint32_t value = ServerProtocol::readU32(rest.data());
+        rest.remove_prefix(4);
+        return value;
+    }
+
+    string_view bytes(size_t count) {
+        need(count);
+        string_view value = rest.substr(0, count);
+        rest.remove_prefix(count);
+        return value;
+    }
+
+    bool empty() const { return rest.empty(); }
+
+private:
+    string_view rest;
+
+    void need(size_t count) const {
+        if (rest.size() < count) throw runtime_error("Error: Truncated frame.");
+    }
+};
+
+void ServerProtocol::appendRequest(string& out, uint32_t id, const vector<string_view>& expressions) {
+    size_t start = out.size();
+    appendU32(out, 0);
+    appendU32(out, id);
+    appendU32(out, static_cast<uint32_t>(expressions.size()));
+    for (string_view e : expressions) {
+        appendU32(out, static_cast<uint32_t>(e.size()));
+        out.append(e);
+    }
+    finishFrame(out, start);
+}
+
+void ServerProtocol::parseRequest(string_view payload, uint32_t& id, vector<string_view>& expressions) {
+    PayloadReader reader(payload);
+    id = reader.u32();
+    uint32_t count = reader.u32();
+    // Every expression takes at least its length field.
+    if (count > payload.size() / 4) throw runtime_error("Error: Truncated frame.");
+    expressions.clear();
+    expressions.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) expressions.push_back(reader.bytes(reader.u32()));
+    if (!reader.empty()) throw runtime_error("Error: Trailing bytes in frame.");
+}
+
+size_t ServerProtocol::beginResponse(string& out, uint32_t id, uint32_t count) {
+    size_t start = out.size();
+    appendU32(out, 0);
+    appendU32(out, id);
+    appendU32(out, count);
+    return start;
+}
+
+void ServerProtocol::appendValue(string& out, double value) {
+    char bytes[9];
+    bytes[0] = 0;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    for (int i = 0; i < 8; ++i) bytes[1 + i] = char(bits >> (8 * i));
+    out.append(bytes, sizeof bytes);
+}
+
+void ServerProtocol::appendError(string& out, string_view message) {
+    out.push_back(1);
+    appendU32(out, static_cast<uint32_t>(message.size()));
+    out.append(message);
+}
+
+void ServerProtocol::finishFrame(string& out, size_t start) {
+    uint32_t length = static_cast<uint32_t>(out.size() - start - HEADER_BYTES);
+    for (int i = 0; i < 4; ++i) out[start + i] = char(length >> (8 * i));
+}
+
+void ServerProtocol::parseResponse(string_view payload, uint32_t& id, vector<Result>& results) {
+    PayloadReader reader(payload);
+    id = reader.u32();
+    uint32_t count = reader.u32();
+    if (count > payload.size() / 5) throw runtime_error("Error: Truncated frame.");
+    results.clear();
+    results.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        string_view tag = reader.bytes(1);
+        if (tag[0] == 0) {
+            string_view raw = reader.bytes(8);
+            uint64_t bits = 0;
+            for (int k = 0; k < 8; ++k) bits |= uint64_t(static_cast<unsigned char>(raw[k])) << (8 * k);
+            double value;
+            memcpy(&value, &bits, sizeof value);
+            results.push_back({true, value, string()});
+        } else {
+            string_view message = reader.bytes(reader.u32());
+            results.push_back({false, 0, string(message)});
+        }
+    }
+    if (!reader.empty()) throw runtime_error("Error: Trailing bytes in frame.");
+}
@@ -0,0 +1,55 @@
+#ifndef SERVERPROTOCOL_H
+#define SERVERPROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Wire format of Syntax_Tree_Server. Every frame is a little-endian u32
+// payload length followed by the payload:
+//
+//   request:  u32 id, u32 count, count x (u32 length, expression bytes)
+//   response: u32 id, u32 count, count x result
+//   result:   u8 0, f64 value           on success
+//             u8 1, u32 length, message on error
+//
+// A response echoes the id of its request. Clients may pipeline any number
+// of requests; responses on a connection come back in request order.
+class ServerProtocol {
+public:
+    // Larger frames are a protocol error and close the connection.
+    static constexpr uint32_t MAX_FRAME_BYTES = 64u << 20;
+    static constexpr size_t HEADER_BYTES = 4;
+
+    struct Result {
+        bool ok;
+        double value;
+        string error;
+    };
+
+    // Length of the frame starting at `data`, header included; 0 while the
+    // header is incomplete. Throws runtime_error for oversized frames.
+    static size_t frameSize(const char* data, size_t available);
+
+    static void appendRequest(string& out, uint32_t id, const vector<string_view>& expressions);
+    // Views point into `payload`. Throws runtime_error on malformed payloads.
+    static void parseRequest(string_view payload, uint32_t& id, vector<string_view>& expressions);
+
+    // Responses are written in steps so results can be appended as they are
+    // produced: begin, append each result, then finishFrame.
+    static size_t beginResponse(string& out, uint32_t id, uint32_t count);
+    static void appendValue(string& out, double value);
+    static void appendError(string& out, string_view message);
+    // Fills in the length of the frame that starts at `start`.
+    static void finishFrame(string& out, size_t start);
+    static void parseResponse(string_view payload, uint32_t& id, vector<Result>& results);
+
+    static void appendU32(string& out, uint32_t value);
+    static uint32_t readU32(const char* data);
+};
+
+#endif
@@ -0,0 +1,518 @@
+#ifndef STATICEXPRESSION_H
+#define STATICEXPRESSION_H
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "BuiltinOperators.h"
+
+using namespace std;
+
+// Compile-time front end for formulas that are fixed at build time:
+//
+//     constexpr auto area = staticExpression<"w*h/2">;
+//     double a = area(3.0, 4.0);       // variables in order of first appearance
+//     static_assert(staticExpression<"1+2*3">() == 7);
+//
+// The literal is tokenized, parsed and built into a tree during compilation
+// with AST's grammar: the same tokens, precedence and unary minus rules, and
+// the built-in operators and functions of BuiltinOperators.h. Functions
+// added with AST::registerFunction() are not known at compile time.
+// Constant +, -, *, / and unary minus are folded there too; %, ^ and the
+// functions call libm, which is not constexpr, so they run at runtime. What
+// is left becomes a nest of inline function templates, one per remaining
+// node, so nothing is parsed or allocated at runtime. Results match
+// AST::calculate() bit for bit. Malformed expressions, and division by a
+// constant zero, fail to compile with an error message like AST's.
+
+template <size_t N>
+struct FixedString {
+    char text[N];
+
+    constexpr FixedString(const char (&s)[N]) { copy(s, s + N, text); }
+    constexpr string_view view() const { return string_view(text, N - 1); }
+};
+
+// Deliberately not constexpr: reaching it while parsing at compile time is a
+// compile error, and the diagnostic shows the message.
+inline void staticExpressionError(const char* message) {
+    throw runtime_error(message);
+}
+
+class StaticParser {
+public:
+    enum class Kind : uint8_t { Number, Variable, Operator, Function, LParen, RParen, Comma };
+
+    // Operators and calls both become Operator nodes. op indexes
+    // BUILTIN_OPERATORS, so it is the AST::OpCode of the same operator.
+    struct Node {
+        Kind kind = Kind::Number;
+        uint8_t op = 0;
+        int left = -1;
+        int right = -1;
+        int variable = -1;
+        double value = 0;
+    };
+
+    // Nodes in build order; children come before their parents.
+    template <size_t Capacity>
+    struct Tree {
+        Node nodes[Capacity] = {};
+        int count = 0;
+        int root = -1;
+        // Variable names as offsets into the source.
+        uint32_t variableBegin[Capacity] = {};
+        uint32_t variableLength[Capacity] = {};
+        int variableCount = 0;
+    };
+
+    template <size_t Capacity>
+    static constexpr Tree<Capacity> parse(string_view source) {
+        Token tokens[Capacity] = {};
+        size_t count = tokenize(source, tokens);
+        handleUnaryOperators(source, tokens, count);
+        Token postfix[Capacity] = {};
+        size_t length = infixToPostfix(tokens, count, postfix);
+        return buildTree<Capacity>(source, postfix, length);
+    }
+
+    // Decimal literal ("12", "1.25", ".5", "3.") to the nearest double, as
+    // from_chars rounds it.
+    static constexpr double toDouble(string_view literal) {
+        Digits digits;
+        size_t scale = 0;
+        bool point = false;
+        for (char c : literal) {
+            if (c == '.') { point = true; continue; }
+            digits.mulAdd(10, static_cast<uint32_t>(c - '0'));
+            if (point) ++scale;
+        }
+        if (digits.isZero()) return 0.0;
+
+        // Exact for up to 2^53 over up to 10^22, the common case.
+        if (digits.bitLength() <= 53 && scale <= 22) {
+            double power = 1;
+            for (size_t i = 0; i < scale; ++i) power *= 10;
+            return static_cast<double>(digits.low64()) / power;
+        }
+
+        Digits denominator;
+        denominator.mulAdd(1, 1);
+        for (size_t i = 0; i < scale; ++i) denominator.mulAdd(10, 0);
+
+        // Scale so the quotient has 55 or 56 bits, then round it to the
+        // precision of the result's binade with the remainder as sticky bit.
+        long shift = 55 + long(denominator.bitLength()) - long(digits.bitLength());
+        if (shift >= 0) digits.shiftLeft(size_t(shift));
+        else denominator.shiftLeft(size_t(-shift));
+        bool sticky = false;
+        uint64_t quotient = digits.divide(denominator, 56, sticky);
+
+        int bits = 64 - countl_zero(quotient);
+        long exponent = bits - 1 - shift;
+        if (exponent > 1023) staticExpressionError("Error: Invalid number.");
+        long precision = exponent < -1022 ? 53 - (-1022 - exponent) : 53;
+        if (precision < 0) staticExpressionError("Error: Invalid number.");
+
+        int drop = bits - int(precision);
+        uint64_t mantissa = drop < 64 ? quotient >> drop : 0;
+        uint64_t rest = quotient - (mantissa << drop);
+        uint64_t half = uint64_t(1) << (drop - 1);
+        if (rest > half || (rest == half && (sticky || (mantissa & 1)))) ++mantissa;
+        if (mantissa == 0) staticExpressionError("Error: Invalid number.");
+
+        uint64_t pattern;
+        if (precision < 53) {
+            // Subnormal; rounding up into 2^52 yields the smallest normal.
+            pattern = mantissa;
+        } else {
+            if (mantissa >> 53) {
+                mantissa >>= 1;
+                ++exponent;
+            }
+            if (exponent > 1023) staticExpressionError("Error: Invalid number.");
+            pattern = (uint64_t(exponent + 1023) << 52) | (mantissa & ((uint64_t(1) << 52) - 1));
+        }
+        return bit_cast<double>(pattern);
+    }
+
+private:
+    struct Token {
+        Kind kind = Kind::Number;
+        uint8_t op = 0;   // Operator and Function tokens
+        uint32_t begin = 0;
+        uint32_t length = 0;
+    };
+
+    // Unsigned integer for literal conversion, least significant limb first.
+    struct Digits {
+        vector<uint32_t> limbs;
+
+        constexpr bool isZero() const { return limbs.empty(); }
+
+        constexpr void mulAdd(uint32_t factor, uint32_t addend) {
+            uint64_t carry = addend;
+            for (uint32_t& limb : limbs) {
+                uint64_t t = uint64_t(limb) * factor + carry;
+                limb = static_cast<uint32_t>(t);
+                carry = t >> 32;
+            }
+            if (carry) limbs.push_back(static_cast<uint32_t>(carry));
+        }
+
+        constexpr size_t bitLength() const {
+            if (limbs.empty()) return 0;
+            return 32 * (limbs.size() - 1) + (32 - countl_zero(limbs.back()));
+        }
+
+        constexpr uint64_t low64() const {
+            uint64_t value = limbs.empty() ? 0 : limbs[0];
+            if (limbs.size() > 1) value |= uint64_t(limbs[1]) << 32;
+            return value;
+        }
+
+        constexpr void shiftLeft(size_t bits) {
+            if (limbs.empty()) return;
+            limbs.insert(limbs.begin(), bits / 32, 0);
+            if (bits % 32 == 0) return;
+            uint32_t carry = 0;
+            for (uint32_t& limb : limbs) {
+                uint32_t next = limb >> (32 - bits % 32);
+                limb = (limb << (bits % 32)) | carry;
+                carry = next;
+            }
+            if (carry) limbs.push_back(carry);
+        }
+
+        constexpr void shiftRight1() {
+            for (size_t i = 0; i < limbs.size(); ++i) {
+                limbs[i] >>= 1;
+                if (i + 1 < limbs.size()) limbs[i] |= limbs[i + 1] << 31;
+            }
+            while (!limbs.empty() && limbs.back() == 0) limbs.pop_back();
+        }
+
+        constexpr int compare(const Digits& other) const {
+            if (limbs.size() != other.limbs.size()) return limbs.size() < other.limbs.size() ? -1 : 1;
+            for (size_t i = limbs.size(); i-- > 0;) {
+                if (limbs[i] != other.limbs[i]) return limbs[i] < other.limbs[i] ? -1 : 1;
+            }
+            return 0;
+        }
+
+        constexpr void subtract(const Digits& other) {
+            int64_t borrow = 0;
+            for (size_t i = 0; i < limbs.size(); ++i) {
+                int64_t t = int64_t(limbs[i]) - (i < other.limbs.size() ? other.limbs[i] : 0) - borrow;
+                borrow = t < 0;
+                limbs[i] = static_cast<uint32_t>(t + (borrow << 32));
+            }
+            while (!limbs.empty() && limbs.back() == 0) limbs.pop_back();
+        }
+
+        // Binary long division for a quotient below 2^bits; the remainder
+        // stays in *this and `inexact` says whether it is nonzero.
+        constexpr uint64_t divide(Digits divisor, int bits, bool& inexact) {
+            divisor.shiftLeft(size_t(bits - 1));
+            uint64_t quotient = 0;
+            for (int i = bits - 1; i >= 0; --i) {
+                if (compare(divisor) >= 0) {
+                    subtract(divisor);
+                    quotient |= uint64_t(1) << i;
+                }
+                divisor.shiftRight1();
+            }
+            inexact = !isZero();
+            return quotient;
+        }
+    };
+
+    static constexpr uint8_t NONE = UINT8_MAX;
+
+    // Code of the symbol c with the given arity, or NONE.
+    static constexpr uint8_t symbolCode(char c, uint8_t arity) {
+        for (size_t i = 0; i < BUILTIN_OPERATOR_COUNT; ++i) {
+            const OperatorInfo& entry = BUILTIN_OPERATORS[i];
+            if (!entry.function && entry.arity == arity && entry.name[0] == c && entry.name[1] == '\0') {
+                return uint8_t(i);
+            }
+        }
+        return NONE;
+    }
+
+    static constexpr uint8_t functionCode(string_view name) {
+        for (size_t i = 0; i < BUILTIN_OPERATOR_COUNT; ++i) {
+            if (BUILTIN_OPERATORS[i].function && name == BUILTIN_OPERATORS[i].name) return uint8_t(i);
+        }
+        staticExpressionError("Error: Unknown function.");
+        return NONE;
+    }
+
+    static constexpr bool isLetter(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+    static constexpr bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    static constexpr size_t tokenize(string_view source, Token* tokens) {
+        size_t count = 0;
+        size_t p = 0;
+        while (p < source.size()) {
+            char c = source[p];
+            Kind kind = Kind::Number;
+            uint8_t op = symbolCode(c, 2);
+            switch (c) {
+                case '(': kind = Kind::LParen; break;
+                case ')': kind = Kind::RParen; break;
+                case ',': kind = Kind::Comma; break;
+                case ' ': case '\t': case '\r': case '\n':
+                    ++p;
+                    continue;
+                default: {
+                    if (op != NONE) {
+                        kind = Kind::Operator;
+                        break;
+                    }
+                    size_t start = p;
+                    if (isLetter(c)) {
+                        while (p < source.size() && (isLetter(source[p]) || isDigit(source[p]))) ++p;
+                        tokens[count++] = {Kind::Variable, 0, uint32_t(start), uint32_t(p - start)};
+                        continue;
+                    }
+                    size_t digits = 0, points = 0;
+                    for (; p < source.size() && (isDigit(source[p]) || source[p] == '.'); ++p) {
+                        if (source[p] == '.') ++points;
+                        else ++digits;
+                    }
+                    if (p == start) staticExpressionError("Error: Unexpected character.");
+                    if (digits == 0 || points > 1) staticExpressionError("Error: Invalid number.");
+                    tokens[count++] = {Kind::Number, 0, uint32_t(start), uint32_t(p - start)};
+                    continue;
+                }
+            }
+            tokens[count++] = {kind, kind == Kind::Operator ? op : uint8_t(0), uint32_t(p), 1};
+            ++p;
+        }
+        return count;
+    }
+
+    // The rules of AST::TokenClassifier: a minus is unary at the start or
+    // after an operator, "(" or ","; a name followed by "(" is a call.
+    static constexpr void handleUnaryOperators(string_view source, Token* tokens, size_t count) {
+        Kind prev = Kind::LParen;
+        for (size_t i = 0; i < count; ++i) {
+            Token& t = tokens[i];
+            if (t.kind == Kind::Variable && i + 1 < count && tokens[i + 1].kind == Kind::LParen) {
+                t.kind = Kind::Function;
+                t.op = functionCode(source.substr(t.begin, t.length));
+            } else if (t.kind == Kind::Operator && t.op == symbolCode('-', 2)
+                       && (prev == Kind::Operator || prev == Kind::LParen || prev == Kind::Comma)) {
+                t.op = symbolCode('-', 1);
+            }
+            prev = t.kind;
+        }
+    }
+
+    // The shunting-yard step of AST::OperatorStack.
+    static constexpr size_t infixToPostfix(const Token* tokens, size_t count, Token* postfix) {
+        struct Item {
+            Token token;       // Operator, Function or LParen
+            uint32_t commas;   // of an LParen, inside a call
+        };
+        vector<Item> opStack;
+        size_t length = 0;
+        auto pop = [&]() {
+            postfix[length++] = opStack.back().token;
+            opStack.pop_back();
+        };
+        for (size_t i = 0; i < count; ++i) {
+            const Token& part = tokens[i];
+            if (part.kind == Kind::Number || part.kind == Kind::Variable) {
+                postfix[length++] = part;
+            } else if (part.kind == Kind::Operator) {
+                // A prefix operator has no left operand to finish yet.
+                const OperatorInfo& entry = BUILTIN_OPERATORS[part.op];
+                while (entry.arity == 2 && !opStack.empty() && opStack.back().token.kind == Kind::Operator) {
+                    const OperatorInfo& top = BUILTIN_OPERATORS[opStack.back().token.op];
+                    if (top.precedence < entry.precedence
+                        || (top.precedence == entry.precedence && entry.rightAssociative)) break;
+                    pop();
+                }
+                opStack.push_back({part, 0});
+            } else if (part.kind == Kind::Function || part.kind == Kind::LParen) {
+                opStack.push_back({part, 0});
+            } else {
+                while (!opStack.empty() && opStack.back().token.kind == Kind::Operator) pop();
+                if (part.kind == Kind::Comma) {
+                    if (opStack.size() < 2 || opStack[opStack.size() - 2].token.kind != Kind::Function) {
+                        staticExpressionError("Error: Unexpected ',' outside a function call.");
+                    }
+                    ++opStack.back().commas;
+                    continue;
+                }
+                // A stray ")" is ignored.
+                if (opStack.empty()) continue;
+                size_t arguments = size_t(opStack.back().commas) + 1;
+                opStack.pop_back();
+                if (!opStack.empty() && opStack.back().token.kind == Kind::Function) {
+                    if (arguments != BUILTIN_OPERATORS[opStack.back().token.op].arity) {
+                        staticExpressionError("Error: Wrong number of function arguments.");
+                    }
+                    pop();
+                }
+            }
+        }
+        while (!opStack.empty()) {
+            if (opStack.back().token.kind != Kind::Operator) staticExpressionError("Error: Unmatched left parenthesis.");
+            pop();
+        }
+        return length;
+    }
+
+    static constexpr const char* missingOperands(uint8_t op) {
+        const OperatorInfo& entry = BUILTIN_OPERATORS[op];
+        if (entry.function) return entry.arity == 1 ? "Missing operand for a function" : "Missing operands for a function";
+        switch (entry.arity == 1 ? 'n' : entry.name[0]) {
+            case 'n': return "Missing operand for unary -";
+            case '+': return "Missing operands for +";
+            case '-': return "Missing operands for -";
+            case '*': return "Missing operands for *";
+            case '/': return "Missing operands for /";
+            case '%': return "Missing operands for %";
+            default: return "Missing operands for ^";
+        }
+    }
+
+    template <size_t Capacity>
+    static constexpr Tree<Capacity> buildTree(string_view source, const Token* postfix, size_t length) {
+        Tree<Capacity> tree;
+        if (length == 0) staticExpressionError("Error: Empty expression.");
+        vector<int> nodeStack;
+        for (size_t i = 0; i < length; ++i) {
+            const Token& part = postfix[i];
+            Node node;
+            node.kind = part.kind;
+            if (part.kind == Kind::Operator || part.kind == Kind::Function) {
+                uint8_t arity = BUILTIN_OPERATORS[part.op].arity;
+                if (nodeStack.size() < arity) staticExpressionError(missingOperands(part.op));
+                node.kind = Kind::Operator;
+                node.op = part.op;
+                node.right = nodeStack.back();
+                nodeStack.pop_back();
+                if (arity == 2) {
+                    node.left = nodeStack.back();
+                    nodeStack.pop_back();
+                }
+            } else if (part.kind == Kind::Variable) {
+                string_view name = source.substr(part.begin, part.length);
+                node.variable = 0;
+                while (node.variable < tree.variableCount
+                       && source.substr(tree.variableBegin[node.variable], tree.variableLength[node.variable]) != name) {
+                    ++node.variable;
+                }
+                if (node.variable == tree.variableCount) {
+                    tree.variableBegin[tree.variableCount] = part.begin;
+                    tree.variableLength[tree.variableCount] = part.length;
+                    ++tree.variableCount;
+                }
+            } else {
+                node.value = toDouble(source.substr(part.begin, part.length));
+            }
+            fold(tree, node);
+            tree.nodes[tree.count] = node;
+            nodeStack.push_back(tree.count++);
+        }
+        if (nodeStack.size() != 1) staticExpressionError("Error: Malformed expression.");
+        tree.root = nodeStack.back();
+        return tree;
+    }
+
+    // Replaces arithmetic over constants with its value, computed exactly as
+    // calculate() would at runtime. Operators with a function are left alone.
+    template <size_t Capacity>
+    static constexpr void fold(const Tree<Capacity>& tree, Node& node) {
+        if (node.kind != Kind::Operator) return;
+        const OperatorInfo& entry = BUILTIN_OPERATORS[node.op];
+        const Node& right = tree.nodes[node.right];
+        if (entry.name[0] == '/' && right.kind == Kind::Number && right.value == 0) staticExpressionError("Div by zero");
+        if (entry.unary || entry.binary || right.kind != Kind::Number) return;
+        if (entry.arity == 1) {
+            node = {Kind::Number, 0, -1, -1, -1, -right.value};
+            return;
+        }
+        const Node& left = tree.nodes[node.left];
+        if (left.kind != Kind::Number) return;
+        double value = 0;
+        switch (entry.name[0]) {
+            case '+': value = left.value + right.value; break;
+            case '-': value = left.value - right.value; break;
+            case '*': value = left.value * right.value; break;
+            default: value = left.value / right.value; break;
+        }
+        node = {Kind::Number, 0, -1, -1, -1, value};
+    }
+};
+
+template <FixedString Source>
+class StaticExpression {
+    using Kind = StaticParser::Kind;
+
+    static constexpr auto tree = StaticParser::parse<sizeof(Source.text)>(Source.view());
+
+    template <int I>
+    static constexpr double evaluateNode(const double* vars) {
+        constexpr StaticParser::Node node = tree.nodes[I];
+        if constexpr (node.kind == Kind::Number) {
+            return node.value;
+        } else if constexpr (node.kind == Kind::Variable) {
+            return vars[node.variable];
+        } else {
+            constexpr OperatorInfo entry = BUILTIN_OPERATORS[node.op];
+            if constexpr (entry.arity == 1) {
+                double right = evaluateNode<node.right>(vars);
+                if constexpr (entry.unary != nullptr) return entry.unary(right);
+                else return -right;
+            } else {
+                double left = evaluateNode<node.left>(vars);
+                double right = evaluateNode<node.right>(vars);
+                if constexpr (entry.binary != nullptr) return entry.binary(left, right);
+                else if constexpr (entry.name[0] == '+') return left + right;
+                else if constexpr (entry.name[0] == '-') return left - right;
+                else if constexpr (entry.name[0] == '*') return left * right;
+                else {
+                    if (right == 0) throw runtime_error("Div by zero");
+                    return left / right;
+                }
+            }
+        }
+    }
+
+public:
+    static constexpr size_t variableCount = size_t(tree.variableCount);
+    // True when the whole expression folded to a constant.
+    static constexpr bool isConstant = tree.nodes[tree.root].kind == Kind::Number;
+
+    // Name of variable i, in order of first appearance (as AST::getVariables).
+    static constexpr string_view variable(size_t i) {
+        return Source.view().substr(tree.variableBegin[i], tree.variableLength[i]);
+    }
+
+    // vars[i] is the value of variable i. Throws "Div by zero" like calculate().
+    constexpr double operator()(const double* vars) const {
+        return evaluateNode<tree.root>(vars);
+    }
+
+    template <typename... Values>
+        requires(sizeof...(Values) == variableCount && (is_convertible_v<Values, double> && ...))
+    constexpr double operator()(Values... values) const {
+        const double vars[] = {static_cast<double>(values)..., 0.0};
+        return evaluateNode<tree.root>(vars);
+    }
+};
+
+template <FixedString Source>
+inline constexpr StaticExpression<Source> staticExpression{};
+
+#endif
@@ -0,0 +1,181 @@
+#include "StreamingParser.h"
+#include "Cancellation.h"
+#include "Instrumentation.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+
+using namespace std;
+
+static bool isIdentifierStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool continuesToken(AST::TokenKind kind, char c) {
+    if (kind == AST::TokenKind::Number) return (c >= '0' && c <= '9') || c == '.';
+    return isIdentifierStart(c) || (c >= '0' && c <= '9');
+}
+
+StreamingParser::StreamingParser(size_t maxDepth)
+    : maxDepth(maxDepth), consumed(0), tokenCount(0), total(0), pendingKind(TokenKind::Number), holdingWord(false),
+      operators(maxDepth), nodes(make_shared<AST::NodeArena>()), tree(maxDepth) {}
+
+void StreamingParser::countToken() {
+    if ((++tokenCount & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(consumed, total);
+}
+
+// Postfix output goes straight into the tree.
+void StreamingParser::output(OpCode op) {
+    tree.apply(*nodes, op);
+}
+
+void StreamingParser::leaf(TokenKind kind, string_view text) {
+    if (holdingWord) resolveWord(false);
+    countToken();
+    if (kind == TokenKind::Variable) {
+        word.assign(text);
+        holdingWord = true;
+        return;
+    }
+    OpCode none = OpCode::Number;
+    classifier.read(kind, none, false);
+    double value = 0;
+    auto res = from_chars(text.data(), text.data() + text.size(), value);
+    if (res.ec != errc() || res.ptr != text.data() + text.size()) {
+        throw runtime_error("Error: Invalid number '" + string(text) + "'.");
+    }
+    if (labels.size() + text.size() > AST::NodeArena::NO_LABEL) throw runtime_error("Error: Expression is too large.");
+    uint32_t begin = static_cast<uint32_t>(labels.size());
+    labels.append(text);
+    tree.leaf(nodes->add(AST::OpCode::Number, AST::NO_NODE, AST::NO_NODE, value, begin,
+                         static_cast<uint32_t>(text.size())));
+}
+
+// Decides what the held name is once the token after it is known.
+void StreamingParser::resolveWord(bool parenFollows) {
+    OpCode op = OpCode::Variable;
+    if (classifier.read(TokenKind::Variable, op, parenFollows) == TokenKind::Function) {
+        holdingWord = false;
+        operators.read(TokenKind::Function, AST::functionCode(word), [this](OpCode ready) { output(ready); });
+    } else {
+        variable();
+    }
+}
+
+// Emits the held name as a variable leaf.
+void StreamingParser::variable() {
+    holdingWord = false;
+    // Every occurrence of a name shares the label stored for the first.
+    auto it = variableIds.find(word);
+    if (it == variableIds.end()) {
+        if (labels.size() + word.size() > AST::NodeArena::NO_LABEL) throw runtime_error("Error: Expression is too large.");
+        it = variableIds.emplace(word, static_cast<int>(names.size())).first;
+        names.push_back(word);
+        labelStarts.push_back(static_cast<uint32_t>(labels.size()));
+        labels.append(word);
+    }
+    int index = it->second;
+    tree.leaf(nodes->add(AST::OpCode::Variable, AST::NO_NODE, AST::NO_NODE, index,
+                         labelStarts[index], static_cast<uint32_t>(word.size())));
+}
+
+// One step of shunting-yard, the same as infixToPostfix().
+void StreamingParser::symbol(TokenKind kind, OpCode op) {
+    if (holdingWord) resolveWord(kind == TokenKind::LParen);
+    countToken();
+    kind = classifier.read(kind, op, false);
+    operators.read(kind, op, [this](OpCode ready) { output(ready); });
+}
+
+void StreamingParser::feed(string_view chunk) {
+    const char* p = chunk.data();
+    const char* end = p + chunk.size();
+
+    // Finish a token left over from the previous chunk.
+    if (!pending.empty()) {
+        const char* start = p;
+        while (p < end && continuesToken(pendingKind, *p)) ++p;
+        pending.append(start, p);
+        if (p == end) {
+            consumed += chunk.size();
+            return;
+        }
+        leaf(pendingKind, pending);
+        pending.clear();
+    }
+
+    while (p < end) {
+        char c = *p;
+        TokenKind kind = TokenKind::Operator;
+        OpCode op = OpCode::Number;
+        switch (c) {
+            case '+': op = OpCode::Add; break;
+            case '-': op = OpCode::Sub; break;
+            case '*': op = OpCode::Mul; break;
+            case '/': op = OpCode::Div; break;
+            case '%': op = OpCode::Mod; break;
+            case '^': op = OpCode::Pow; break;
+            case '(': kind = TokenKind::LParen; break;
+            case ')': kind = TokenKind::RParen; break;
+            case ',': kind = TokenKind::Comma; break;
+            case ' ': case '\t': case '\r': case '\n':
+                ++p;
+                continue;
+            default: {
+                const char* start = p;
+                TokenKind leafKind = isIdentifierStart(c) ? TokenKind::Variable : TokenKind::Number;
+                while (p < end && continuesToken(leafKind, *p)) ++p;
+                if (p == start) throw runtime_error(string("Error: Unexpected character '") + c + "'.");
+                if (p == end) {
+                    // The token may go on in the next chunk.
+                    pending.assign(start, p);
+                    pendingKind = leafKind;
+                } else {
+                    leaf(leafKind, string_view(start, p - start));
+                }
+                continue;
+            }
+        }
+        symbol(kind, op);
+        ++p;
+    }
+    consumed += chunk.size();
+}
+
+AST StreamingParser::finish() {
+    STC_TRACE_SCOPE("streamFinish");
+    if (!pending.empty()) {
+        leaf(pendingKind, pending);
+        pending.clear();
+    }
+    if (holdingWord) resolveWord(false);
+    operators.finish([this](OpCode ready) { output(ready); });
+    if (tree.size() == 0 && nodes->size() == 0) {
+        return AST(make_shared<AST::NodeArena>(), AST::NO_NODE, make_shared<const string>(), AST::noVariables(), maxDepth, true);
+    }
+    if (tree.size() != 1) throw runtime_error("Error: Malformed expression.");
+    STC_TRACE_COUNTER("nodes", nodes->size());
+    STC_TRACE_COUNTER("depth", tree.height());
+    labels.shrink_to_fit();
+    auto variables = names.empty() ? AST::noVariables() : make_shared<const vector<string>>(move(names));
+    return AST(move(nodes), tree.top(), make_shared<const string>(move(labels)), move(variables), maxDepth, true);
+}
+
+AST StreamingParser::parseFile(const string& path, size_t maxDepth) {
+    STC_TRACE_SCOPE("parseFile");
+    // Big enough to amortize the per-chunk work, small enough that only a
+    // few windows of the file are resident at once.
+    constexpr size_t WINDOW = size_t(1) << 20;
+
+    MappedFile file(path);
+    string_view text = file.view();
+    StreamingParser parser(maxDepth);
+    parser.total = text.size();
+    for (size_t offset = 0; offset < text.size(); offset += WINDOW) {
+        size_t length = min(WINDOW, text.size() - offset);
+        parser.feed(text.substr(offset, length));
+        file.discard(offset, length);
+    }
+    return parser.finish();
+}
@@ -0,0 +1,81 @@
+#ifndef STREAMINGPARSER_H
+#define STREAMINGPARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "AST.h"
+
+using namespace std;
+
+// Builds an AST from input that arrives in pieces. Tokens may span pieces.
+// Lexing, unary-minus resolution, shunting-yard and tree building all run
+// in one pass as the text streams by, so there is no copy of the source and
+// no token array. Besides the tree, the parser keeps only the operator and
+// operand stacks, which are bounded by nesting, and the text of the leaves,
+// which the tree needs for its labels.
+//
+// Accepts exactly what AST(string) accepts and builds the same tree. With
+// several errors in one input, the first one in text order is reported,
+// which may differ from the one AST(string) reports.
+class StreamingParser {
+public:
+    explicit StreamingParser(size_t maxDepth = AST::DEFAULT_MAX_DEPTH);
+
+    // Parses the next piece of the expression. Throws on the first error,
+    // after which the parser must not be used again.
+    void feed(string_view chunk);
+    // Ends the input and returns the tree. Call once.
+    AST finish();
+
+    // Streams a file through a memory map and drops each window from the
+    // working set once it has been parsed, so resident memory stays bounded
+    // by the tree rather than the file. Honors cancellation.
+    static AST parseFile(const string& path, size_t maxDepth = AST::DEFAULT_MAX_DEPTH);
+
+    size_t bytesConsumed() const { return consumed; }
+
+private:
+    using TokenKind = AST::TokenKind;
+    using OpCode = AST::OpCode;
+    using NodeId = AST::NodeId;
+
+    size_t maxDepth;
+    size_t consumed;
+    size_t tokenCount;
+    size_t total;   // expected input size for progress, 0 if unknown
+
+    // A number or identifier cut off by the end of the previous piece.
+    string pending;
+    TokenKind pendingKind;
+
+    // A name is a variable unless the next token is "(", so it waits here
+    // until that token arrives.
+    string word;
+    bool holdingWord;
+
+    // Shunting-yard state.
+    AST::TokenClassifier classifier;
+    AST::OperatorStack operators;
+
+    // Tree under construction.
+    shared_ptr<AST::NodeArena> nodes;
+    AST::TreeBuilder tree;
+    string labels;            // leaf texts; node labels are spans of it
+    vector<string> names;
+    vector<uint32_t> labelStarts;   // where each variable's name is in labels
+    unordered_map<string, int> variableIds;
+
+    void leaf(TokenKind kind, string_view text);
+    void resolveWord(bool parenFollows);
+    void variable();
+    void symbol(TokenKind kind, OpCode op);
+    void output(OpCode op);
+    void countToken();
+};
+
+#endif
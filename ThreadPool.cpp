@@ -0,0 +1,174 @@
+#include "ThreadPool.h"
+
+using namespace std;
+
+
+// Pool and queue of the worker running on this thread, if any.
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local size_t currentIndex = 0;
+
+static size_t sharedWorkers = ThreadPool::defaultWorkerCount();
+
+size_t ThreadPool::defaultWorkerCount() {
+    unsigned hw = thread::hardware_concurrency();
+    return hw > 1 ? hw - 1 : 0;
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(sharedWorkers);
+    return pool;
+}
+
+void ThreadPool::setSharedWorkerCount(size_t workers) {
+    sharedWorkers = workers;
+}
+
+ThreadPool::ThreadPool(size_t workers) : queued(0), stopping(false) {
+    for (size_t i = 0; i <= workers; ++i) queues.push_back(make_unique<Queue>());
+    threads.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        threads.emplace_back([this, i]() { workerLoop(i + 1); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t : threads) t.join();
+}
+
+size_t ThreadPool::currentQueue() const {
+    return currentPool == this ? currentIndex : 0;
+}
+
+void ThreadPool::push(Task task) {
+    Queue& q = *queues[currentQueue()];
+    {
+        lock_guard<mutex> guard(q.lock);
+        q.tasks.push_back(move(task));
+    }
+    queued.fetch_add(1);
+    // Taking the sleep lock orders this push before any worker's re-check.
+    { lock_guard<mutex> guard(sleepLock); }
+    wake.notify_one();
+}
+
+bool ThreadPool::tryRunOne(size_t self) {
+    Task task;
+    bool found = false;
+
+    // Own queue first (newest task, still hot in cache)...
+    {
+        Queue& own = *queues[self];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = move(own.tasks.back());
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    // ...then the oldest task of every other queue, injection queue included.
+    for (size_t i = 1; !found && i < queues.size(); ++i) {
+        Queue& victim = *queues[(self + i) % queues.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (!found) return false;
+
+    queued.fetch_sub(1);
+    try {
+        task.fn();
+    } catch (...) {
+        if (task.group) {
+            lock_guard<mutex> guard(task.group->errorMutex);
+            if (!task.group->error) task.group->error = current_exception();
+        }
+    }
+    if (task.group) task.group->pending.fetch_sub(1);
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t self) {
+    currentPool = this;
+    currentIndex = self;
+    while (true) {
+        if (tryRunOne(self)) continue;
+        unique_lock<mutex> guard(sleepLock);
+        wake.wait(guard, [&]() { return stopping || queued.load() > 0; });
+        if (stopping) return;
+    }
+}
+
+ThreadPool::TaskGroup::~TaskGroup() {
+    // Never leave tasks behind that point at this group.
+    while (pending.load() > 0) {
+        if (!pool.tryRunOne(pool.currentQueue())) this_thread::yield();
+    }
+}
+
+void ThreadPool::TaskGroup::run(function<void()> task) {
+    pending.fetch_add(1);
+    pool.push({move(task), this});
+}
+
+void ThreadPool::TaskGroup::wait() {
+    while (pending.load() > 0) {
+        if (!pool.tryRunOne(pool.currentQueue())) this_thread::yield();
+    }
+    if (error) {
+        exception_ptr e = error;
+        error = nullptr;
+        rethrow_exception(e);
+    }
+}
+
+void ThreadPool::post(function<void()> task) {
+    push({move(task), nullptr});
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const function<void(size_t, size_t)>& body) {
+    if (count == 0) return;
+    if (grain == 0) grain = 1;
+    size_t grains = (count + grain - 1) / grain;
+    if (grains == 1 || threads.empty()) {
+        body(0, count);
+        return;
+    }
+
+    // A few tasks per thread pull grains off a shared counter, so uneven
+    // grains still balance without one task per grain.
+    atomic<size_t> next(0);
+    atomic<bool> failed(false);
+    auto drain = [&]() {
+        while (!failed.load()) {
+            size_t begin = next.fetch_add(grain);
+            if (begin >= count) return;
+            try {
+                body(begin, min(begin + grain, count));
+            } catch (...) {
+                failed.store(true);
+                throw;
+            }
+        }
+    };
+
+    TaskGroup group(*this);
+    size_t tasks = min(grains, threadCount() * 2) - 1;
+    for (size_t i = 0; i < tasks; ++i) group.run(drain);
+    try {
+        drain();
+    } catch (...) {
+        // Let the other tasks finish before unwinding; the caller's error wins.
+        exception_ptr e = current_exception();
+        try { group.wait(); } catch (...) {}
+        rethrow_exception(e);
+    }
+    group.wait();
+}
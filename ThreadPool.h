@@ -0,0 +1,95 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Work-stealing pool. Each worker pushes and pops its own tasks at the back of
+// its deque and steals from the front of the others when it runs dry; other
+// threads submit through a shared injection queue. A thread waiting on a
+// TaskGroup runs queued tasks instead of blocking, so fork/join can nest
+// without deadlocking or oversubscribing cores.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t workers = defaultWorkerCount());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // One worker per hardware thread, minus the caller.
+    static size_t defaultWorkerCount();
+
+    // Process-wide pool shared by batch and parallel evaluation. The worker
+    // count can be changed until the first call to shared().
+    static ThreadPool& shared();
+    static void setSharedWorkerCount(size_t workers);
+
+    size_t threadCount() const { return threads.size() + 1; }
+
+    // A set of forked tasks that can be joined.
+    class TaskGroup {
+    public:
+        explicit TaskGroup(ThreadPool& pool) : pool(pool), pending(0) {}
+        ~TaskGroup();
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        void run(function<void()> task);
+        // Runs pool tasks until every task of this group has finished, then
+        // rethrows the first exception any of them raised.
+        void wait();
+
+    private:
+        friend class ThreadPool;
+        ThreadPool& pool;
+        atomic<size_t> pending;
+        exception_ptr error;
+        mutex errorMutex;
+    };
+
+    // Runs `task` on the pool without a group to join. Exceptions it throws
+    // are dropped, and tasks still queued when the pool is destroyed never run.
+    void post(function<void()> task);
+
+    // Calls body(begin, end) over [0, count) split into grains of `grain` items.
+    // Returns once every grain has finished; the first exception is rethrown.
+    void parallelFor(size_t count, size_t grain, const function<void(size_t, size_t)>& body);
+
+private:
+    struct Task {
+        function<void()> fn;
+        TaskGroup* group;   // null for posted tasks
+    };
+
+    struct Queue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    vector<thread> threads;
+    // queues[0] is the injection queue, queues[i] belongs to worker i.
+    vector<unique_ptr<Queue>> queues;
+    atomic<size_t> queued;
+    mutex sleepLock;
+    condition_variable wake;
+    bool stopping;
+
+    void push(Task task);
+    bool tryRunOne(size_t self);
+    void workerLoop(size_t self);
+    size_t currentQueue() const;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "TreeItem.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Below this on-screen node diameter the overview renderer takes over.
+static const double OVERVIEW_NODE_PX = 6;
+// Labels are only drawn once nodes are large enough to read them.
+static const double LABEL_NODE_PX = 14;
+// In the overview, subtrees narrower than this collapse into one glyph.
+static const double COLLAPSE_SLOT_PX = 24;
+
+TreeItem::TreeItem(std::shared_ptr<const TreeLayout> layout, const QFont &font)
+    : layout(std::move(layout)), font(font) {
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    updateBounds();
+}
+
+void TreeItem::setLayout(std::shared_ptr<const TreeLayout> newLayout) {
+    prepareGeometryChange();
+    layout = std::move(newLayout);
+    updateBounds();
+    update();
+}
+
+void TreeItem::updateBounds() {
+    double half = layout->largestNode() / 2 + 2;
+    bounds = QRectF(layout->left(), -half, layout->right() - layout->left(), layout->bottom() + 2 * half);
+}
+
+QRectF TreeItem::boundingRect() const {
+    return bounds;
+}
+
+void TreeItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *) {
+    if (layout->nodes().empty()) return;
+    double scale = option->levelOfDetailFromTransform(painter->worldTransform());
+    double nodePixels = TreeLayout::MIN_NODE_SIZE * scale;
+    if (nodePixels < OVERVIEW_NODE_PX) paintOverview(painter, option->exposedRect, scale);
+    else paintDetailed(painter, option->exposedRect, nodePixels >= LABEL_NODE_PX);
+}
+
+void TreeItem::paintDetailed(QPainter *painter, const QRectF &visible, bool labels) {
+    const std::vector<TreeLayout::Node> &nodes = layout->nodes();
+    const std::vector<uint32_t> &order = layout->rowNodes();
+    const double inf = std::numeric_limits<double>::infinity();
+    double half = layout->largestNode() / 2;
+    long rows = (long)layout->rowCount();
+    long firstRow = std::max(0L, (long)std::floor((visible.top() - half) / TreeLayout::ROW_HEIGHT));
+    long lastRow = std::min(rows - 1, (long)std::floor((visible.bottom() + half) / TreeLayout::ROW_HEIGHT));
+    if (firstRow > lastRow) return;
+
+    // Edges into row c. Along a row both the child and its parent move right,
+    // so the edges crossing [left, right] form one contiguous run.
+    painter->setPen(QPen(QColor("#555"), 2));
+    for (long c = std::max(1L, firstRow); c <= std::min(lastRow + 1, rows - 1); ++c) {
+        auto range = layout->rowRange(c, -inf, inf);
+        auto begin = order.begin() + range.first;
+        auto end = order.begin() + range.second;
+        auto lo = std::partition_point(begin, end, [&](uint32_t i) {
+            return std::max(nodes[i].x, nodes[nodes[i].parent].x) < visible.left();
+        });
+        auto hi = std::partition_point(lo, end, [&](uint32_t i) {
+            return std::min(nodes[i].x, nodes[nodes[i].parent].x) <= visible.right();
+        });
+        for (auto it = lo; it != hi; ++it) {
+            const TreeLayout::Node &child = nodes[*it];
+            const TreeLayout::Node &parent = nodes[child.parent];
+            painter->drawLine(QPointF(parent.x, parent.y + parent.size/2), QPointF(child.x, child.y - child.size/2));
+        }
+    }
+
+    painter->setFont(font);
+    for (long r = firstRow; r <= lastRow; ++r) {
+        auto range = layout->rowRange(r, visible.left(), visible.right());
+        for (size_t k = range.first; k < range.second; ++k) {
+            const TreeLayout::Node &node = nodes[order[k]];
+            QRectF circle(node.x - node.size/2, node.y - node.size/2, node.size, node.size);
+            painter->setBrush(QBrush(QColor("#00E5FF")));
+            painter->setPen(QPen(Qt::white, 2));
+            painter->drawEllipse(circle);
+            if (labels) {
+                painter->setPen(Qt::black);
+                painter->drawText(circle, Qt::AlignCenter, QString::fromStdString(node.label));
+            }
+        }
+    }
+}
+
+void TreeItem::paintOverview(QPainter *painter, const QRectF &visible, double scale) {
+    // Top-down from the first visible row: subtrees outside the view are
+    // skipped, narrow ones are drawn as a triangle covering their slot and
+    // height, and only wide ones are opened up. The work is bounded by what
+    // is on screen, even for very deep trees.
+    const std::vector<TreeLayout::Node> &nodes = layout->nodes();
+    const std::vector<uint32_t> &order = layout->rowNodes();
+    const double inf = std::numeric_limits<double>::infinity();
+    double half = layout->largestNode() / 2;
+    QPen edgePen(QColor("#555"), 0);
+    QBrush nodeBrush(QColor("#00E5FF"));
+    QBrush glyphBrush(QColor(0, 229, 255, 110));
+
+    long rows = (long)layout->rowCount();
+    long firstRow = std::max(0L, (long)std::floor((visible.top() - half) / TreeLayout::ROW_HEIGHT));
+    if (firstRow >= rows) return;
+
+    // Slots within a row are disjoint and sorted, so the ones overlapping
+    // the view are a contiguous run.
+    auto range = layout->rowRange(firstRow, -inf, inf);
+    auto begin = order.begin() + range.first;
+    auto end = order.begin() + range.second;
+    auto lo = std::partition_point(begin, end, [&](uint32_t i) { return nodes[i].x + nodes[i].slot/2 < visible.left(); });
+    auto hi = std::partition_point(lo, end, [&](uint32_t i) { return nodes[i].x - nodes[i].slot/2 <= visible.right(); });
+
+    std::vector<int32_t> pending;
+    painter->setPen(edgePen);
+    for (auto it = lo; it != hi; ++it) {
+        pending.push_back((int32_t)*it);
+        const TreeLayout::Node &node = nodes[*it];
+        if (node.parent >= 0) painter->drawLine(QPointF(nodes[node.parent].x, nodes[node.parent].y), QPointF(node.x, node.y));
+    }
+    while (!pending.empty()) {
+        const TreeLayout::Node &node = nodes[pending.back()];
+        pending.pop_back();
+
+        double bottom = node.y + node.rowsBelow * TreeLayout::ROW_HEIGHT;
+        QRectF extent(node.x - node.slot/2, node.y - half, node.slot, bottom - node.y + 2 * half);
+        if (!extent.intersects(visible)) continue;
+
+        if (node.rowsBelow > 0 && node.slot * scale < COLLAPSE_SLOT_PX) {
+            QPolygonF glyph;
+            glyph << QPointF(node.x, node.y) << QPointF(node.x - node.slot/2, bottom) << QPointF(node.x + node.slot/2, bottom);
+            painter->setPen(Qt::NoPen);
+            painter->setBrush(glyphBrush);
+            painter->drawPolygon(glyph);
+            continue;
+        }
+
+        painter->setPen(edgePen);
+        for (int32_t child : {node.left, node.right}) {
+            if (child < 0) continue;
+            painter->drawLine(QPointF(node.x, node.y), QPointF(nodes[child].x, nodes[child].y));
+            pending.push_back(child);
+        }
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(nodeBrush);
+        painter->drawEllipse(QPointF(node.x, node.y), node.size/2, node.size/2);
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef TREEITEM_H
+#define TREEITEM_H
+
+#include <QGraphicsItem>
+#include <QFont>
+#include <memory>
+#include "TreeLayout.h"
+
+// Draws a whole laid-out tree as a single scene item. Only nodes inside the
+// exposed rectangle are painted, found through the layout's per-row index.
+// When zoomed out far enough that nodes shrink to a few pixels, subtrees
+// narrower than a few pixels on screen are drawn as one collapsed glyph.
+class TreeItem : public QGraphicsItem {
+public:
+    TreeItem(std::shared_ptr<const TreeLayout> layout, const QFont &font);
+
+    // Swaps in another tree. The item stays in the scene, so the view keeps
+    // its position and only the exposed area is repainted.
+    void setLayout(std::shared_ptr<const TreeLayout> layout);
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+private:
+    std::shared_ptr<const TreeLayout> layout;
+    QFont font;
+    QRectF bounds;
+
+    void updateBounds();
+    void paintDetailed(QPainter *painter, const QRectF &visible, bool labels);
+    void paintOverview(QPainter *painter, const QRectF &visible, double scale);
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "TreeLayout.h"
+#include "Cancellation.h"
+#include <algorithm>
+
+using namespace std;
+
+
+TreeLayout::TreeLayout(const AST& tree, const function<double(const string&)>& textWidth)
+    : minX(0), maxX(0), maxY(0), spacing(MIN_SPACING), largest(MIN_NODE_SIZE) {
+    AST::NodeId root = tree.getRoot();
+    if (root == AST::NO_NODE) return;
+
+    // Children always have smaller ids than their parents, so a descending
+    // sweep finds every reachable node and an ascending one sees children
+    // before parents. Leaf counts and label widths are computed once per id.
+    vector<bool> reachable(root + 1, false);
+    reachable[root] = true;
+    for (AST::NodeId node = root + 1; node-- > 0;) {
+        if (!reachable[node]) continue;
+        if (tree.getLeft(node) != AST::NO_NODE) reachable[tree.getLeft(node)] = true;
+        if (tree.getRight(node) != AST::NO_NODE) reachable[tree.getRight(node)] = true;
+    }
+
+    vector<double> leaves(root + 1, 0);
+    vector<uint32_t> height(root + 1, 0);
+    vector<double> width(root + 1, 0);
+    vector<string> labels(root + 1);
+    double widest = 0;
+    for (AST::NodeId node = 0; node <= root; ++node) {
+        if ((node & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(node, size_t(root) + 1);
+        if (!reachable[node]) continue;
+        AST::NodeId left = tree.getLeft(node);
+        AST::NodeId right = tree.getRight(node);
+        if (left == AST::NO_NODE && right == AST::NO_NODE) leaves[node] = 1;
+        else leaves[node] = (left != AST::NO_NODE ? leaves[left] : 0) + (right != AST::NO_NODE ? leaves[right] : 0);
+        height[node] = 1 + max(left != AST::NO_NODE ? height[left] : 0, right != AST::NO_NODE ? height[right] : 0);
+        labels[node] = tree.getLabel(node);
+        width[node] = textWidth(labels[node]);
+        widest = max(widest, width[node]);
+    }
+    // Every column fits the widest label plus padding.
+    spacing = max(MIN_SPACING, widest + 50);
+
+    // Pre-order placement with an explicit stack; each entry carries the
+    // centre and row already decided by its parent.
+    struct Pending {
+        AST::NodeId id;
+        int32_t parent;
+        uint32_t row;
+        double x;
+    };
+    vector<Pending> pending;
+    placed.reserve(count(reachable.begin(), reachable.end(), true));
+    pending.push_back({root, -1, 0, 0});
+    minX = maxX = 0;
+    while (!pending.empty()) {
+        Pending p = pending.back();
+        pending.pop_back();
+
+        int32_t index = static_cast<int32_t>(placed.size());
+        if ((index & (CancellationScope::INTERVAL - 1)) == 0) CancellationScope::checkpoint(index, placed.capacity());
+        double y = p.row * ROW_HEIGHT;
+        double size = max(MIN_NODE_SIZE, width[p.id] + 20);
+        placed.push_back({p.id, p.parent, -1, -1, p.row, height[p.id] - 1, p.x, y, size,
+                          leaves[p.id] * spacing, labels[p.id]});
+        if (p.parent >= 0) {
+            // The left child, when there is one, is always placed first.
+            Node &parent = placed[p.parent];
+            if (parent.left < 0 && tree.getLeft(parent.id) != AST::NO_NODE) parent.left = index;
+            else parent.right = index;
+        }
+        minX = min(minX, p.x - spacing / 2);
+        maxX = max(maxX, p.x + spacing / 2);
+        maxY = max(maxY, y);
+        largest = max(largest, size);
+
+        AST::NodeId left = tree.getLeft(p.id);
+        AST::NodeId right = tree.getRight(p.id);
+        double leftWidth = left != AST::NO_NODE ? leaves[left] * spacing : 0;
+        double rightWidth = right != AST::NO_NODE ? leaves[right] * spacing : 0;
+        double start = p.x - (leftWidth + rightWidth) / 2;
+        // Right first, so the left child is placed next.
+        if (right != AST::NO_NODE) pending.push_back({right, index, p.row + 1, start + leftWidth + rightWidth / 2});
+        if (left != AST::NO_NODE) pending.push_back({left, index, p.row + 1, start + leftWidth / 2});
+    }
+
+    // Bucket nodes by row. Pre-order places a left subtree before its right
+    // sibling, so each row is already in ascending x order.
+    size_t rows = height[root];
+    rowStart.assign(rows + 1, 0);
+    for (const Node &node : placed) ++rowStart[node.row + 1];
+    for (size_t row = 0; row < rows; ++row) rowStart[row + 1] += rowStart[row];
+    rowOrder.resize(placed.size());
+    vector<size_t> cursor(rowStart.begin(), rowStart.end() - 1);
+    for (size_t i = 0; i < placed.size(); ++i) rowOrder[cursor[placed[i].row]++] = static_cast<uint32_t>(i);
+}
+
+pair<size_t, size_t> TreeLayout::rowRange(size_t row, double x0, double x1) const {
+    if (row >= rowCount()) return {0, 0};
+    auto begin = rowOrder.begin() + rowStart[row];
+    auto end = rowOrder.begin() + rowStart[row + 1];
+    // Circles are at most `largest` wide, so pad the query by half of that.
+    double pad = largest / 2;
+    auto first = partition_point(begin, end, [&](uint32_t i) { return placed[i].x < x0 - pad; });
+    auto last = partition_point(first, end, [&](uint32_t i) { return placed[i].x <= x1 + pad; });
+    return {size_t(first - rowOrder.begin()), size_t(last - rowOrder.begin())};
+}
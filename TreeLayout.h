@@ -0,0 +1,67 @@
+#ifndef TREELAYOUT_H
+#define TREELAYOUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "AST.h"
+
+using namespace std;
+
+// Node positions for drawing an AST, computed in O(n) without recursion.
+// Every subtree gets a horizontal slot proportional to its leaf count and a
+// parent is centred over its children's slots, one row per tree level. Label
+// widths are measured once per node through a caller-supplied function, so
+// the GUI can share a single set of font metrics.
+class TreeLayout {
+public:
+    struct Node {
+        AST::NodeId id;
+        int32_t parent;   // index into nodes(), -1 for the root
+        int32_t left;     // child indices, -1 if absent
+        int32_t right;
+        uint32_t row;     // tree level, 0 for the root
+        uint32_t rowsBelow;   // height of the subtree minus one
+        double x;         // centre of the node
+        double y;
+        double size;      // diameter of the node's circle
+        double slot;      // width reserved for the whole subtree, centred on x
+        string label;
+    };
+
+    static constexpr double MIN_SPACING = 70;
+    static constexpr double MIN_NODE_SIZE = 50;
+    static constexpr double ROW_HEIGHT = 100;
+
+    TreeLayout() : minX(0), maxX(0), maxY(0), spacing(MIN_SPACING), largest(MIN_NODE_SIZE) {}
+    TreeLayout(const AST& tree, const function<double(const string&)>& textWidth);
+
+    // Parents come before their children.
+    const vector<Node>& nodes() const { return placed; }
+    double left() const { return minX; }
+    double right() const { return maxX; }
+    double bottom() const { return maxY; }
+    double columnWidth() const { return spacing; }
+    double largestNode() const { return largest; }
+
+    // Spatial index: the nodes of each row, sorted by x. Returns the
+    // positions [first, last) in rowNodes() of the row's nodes whose circles
+    // overlap [x0, x1].
+    size_t rowCount() const { return rowStart.empty() ? 0 : rowStart.size() - 1; }
+    const vector<uint32_t>& rowNodes() const { return rowOrder; }
+    pair<size_t, size_t> rowRange(size_t row, double x0, double x1) const;
+
+private:
+    vector<Node> placed;
+    vector<size_t> rowStart;
+    vector<uint32_t> rowOrder;
+    double minX;
+    double maxX;
+    double maxY;
+    double spacing;
+    double largest;
+};
+
+#endif
@@ -0,0 +1,224 @@
+#include "AST.h"
+#include "ProgramLibrary.h"
+#include "ThreadPool.h"
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+// Headless batch evaluator: one expression per input line, one result per
+// output line, in input order. Lines are processed in blocks so memory stays
+// bounded no matter how large the input is.
+
+static const size_t BLOCK_LINES = 1 << 16;
+static const size_t GRAIN_LINES = 256;
+
+static void printUsage(const char* prog) {
+    cerr << "Usage: " << prog << " [-j threads] [-o output] [--max-depth n] [--exact]\n"
+         << "       [--library file] [--save-library file] [input | -]\n"
+         << "Evaluates one expression per line and prints one result per line.\n"
+         << "--exact evaluates over exact rationals and prints integers, terminating\n"
+         << "decimals or fractions such as 1/3.\n"
+         << "--save-library compiles every line that parses into a program library;\n"
+         << "--library evaluates lines found in one straight from the file instead\n"
+         << "of parsing them (not with --exact).\n"
+         << "Lines that fail to parse or evaluate print \"Error: <reason>\".\n";
+}
+
+static size_t maxDepth = AST::DEFAULT_MAX_DEPTH;
+static bool exact = false;
+static ProgramLibrary library;
+
+// A line compiled for --save-library.
+struct Compiled {
+    bool ok = false;
+    Program program;
+    vector<string> variables;
+};
+
+static void formatValue(double value, string& out) {
+    char buf[32];
+    auto res = to_chars(buf, buf + sizeof(buf), value);
+    out.assign(buf, res.ptr);
+}
+
+static void evaluateLine(const string& line, string& out, Compiled* compiled) {
+    if (compiled) compiled->ok = false;
+    try {
+        ProgramLibrary::Entry entry;
+        if (!exact && !compiled && library.find(line, entry)) {
+            formatValue(entry.evaluate(), out);
+            return;
+        }
+        AST tree(line, maxDepth);
+        if (compiled) {
+            // Anything that parses is kept, including formulas with variables.
+            try {
+                compiled->program = tree.compile();
+                compiled->variables = tree.getVariables();
+                compiled->ok = true;
+            } catch (const exception&) {}
+        }
+        if (exact) {
+            out = tree.calculateExact().toString();
+            return;
+        }
+        formatValue(tree.calculate(), out);
+    } catch (const exception& e) {
+        // Some parser messages already carry the prefix.
+        const char* what = e.what();
+        out = strncmp(what, "Error", 5) == 0 ? "" : "Error: ";
+        out += what;
+    }
+}
+
+// Splits a stream into lines through a large fread buffer.
+class LineReader {
+public:
+    explicit LineReader(FILE* f) : file(f), buffer(1 << 20), begin(0), end(0), eof(false) {}
+
+    bool next(string& line) {
+        line.clear();
+        while (true) {
+            if (begin == end) {
+                if (eof || !refill()) return !line.empty();
+            }
+            const char* start = buffer.data() + begin;
+            const char* nl = static_cast<const char*>(memchr(start, '\n', end - begin));
+            if (nl) {
+                line.append(start, nl - start);
+                begin += (nl - start) + 1;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                return true;
+            }
+            line.append(start, end - begin);
+            begin = end;
+        }
+    }
+
+private:
+    FILE* file;
+    vector<char> buffer;
+    size_t begin;
+    size_t end;
+    bool eof;
+
+    bool refill() {
+        begin = 0;
+        end = fread(buffer.data(), 1, buffer.size(), file);
+        if (end < buffer.size()) eof = true;
+        return end > 0;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    size_t threads = 0;
+    const char* inputPath = nullptr;
+    const char* outputPath = nullptr;
+    const char* libraryPath = nullptr;
+    const char* saveLibraryPath = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--max-depth") && i + 1 < argc) {
+            maxDepth = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--exact")) {
+            exact = true;
+        } else if (!strcmp(argv[i], "--library") && i + 1 < argc) {
+            libraryPath = argv[++i];
+        } else if (!strcmp(argv[i], "--save-library") && i + 1 < argc) {
+            saveLibraryPath = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            printUsage(argv[0]);
+            return 0;
+        } else if (!inputPath) {
+            inputPath = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (libraryPath) {
+        try {
+            library = ProgramLibrary(libraryPath);
+        } catch (const exception& e) {
+            cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    FILE* in = stdin;
+    if (inputPath && strcmp(inputPath, "-") != 0) {
+        in = fopen(inputPath, "rb");
+        if (!in) { perror(inputPath); return 1; }
+    }
+    FILE* out = stdout;
+    if (outputPath) {
+        out = fopen(outputPath, "wb");
+        if (!out) { perror(outputPath); return 1; }
+    }
+    setvbuf(out, nullptr, _IOFBF, 1 << 20);
+
+    // -j counts the calling thread as well, which also runs loop iterations.
+    if (threads) ThreadPool::setSharedWorkerCount(threads - 1);
+    ThreadPool& pool = ThreadPool::shared();
+    LineReader reader(in);
+
+    vector<string> lines(BLOCK_LINES);
+    vector<string> results(BLOCK_LINES);
+    vector<Compiled> compiled(saveLibraryPath ? BLOCK_LINES : 0);
+    ProgramLibraryWriter writer;
+    unordered_set<string> saved;
+    size_t total = 0, errors = 0;
+    bool more = true;
+
+    while (more) {
+        size_t count = 0;
+        while (count < BLOCK_LINES && reader.next(lines[count])) ++count;
+        more = count == BLOCK_LINES;
+        if (count == 0) break;
+
+        pool.parallelFor(count, GRAIN_LINES, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) evaluateLine(lines[i], results[i], saveLibraryPath ? &compiled[i] : nullptr);
+        });
+        if (saveLibraryPath) {
+            for (size_t i = 0; i < count; ++i) {
+                if (compiled[i].ok && saved.insert(lines[i]).second) {
+                    writer.add(lines[i], move(compiled[i].program), move(compiled[i].variables));
+                }
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            const string& r = results[i];
+            if (r.compare(0, 6, "Error:") == 0) ++errors;
+            fwrite(r.data(), 1, r.size(), out);
+            fputc('\n', out);
+        }
+        total += count;
+    }
+
+    if (in != stdin) fclose(in);
+    if (out != stdout) fclose(out);
+    cerr << total << " expressions, " << errors << " errors\n";
+    if (saveLibraryPath) {
+        try {
+            writer.save(saveLibraryPath);
+        } catch (const exception& e) {
+            cerr << e.what() << "\n";
+            return 1;
+        }
+        cerr << writer.size() << " programs saved to " << saveLibraryPath << "\n";
+    }
+    return 0;
+}
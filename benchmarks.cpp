@@ -0,0 +1,397 @@
+#include "AST.h"
+#include "JitProgram.h"
+#include "Program.h"
+#include "ProgramLibrary.h"
+#include "StreamingParser.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Benchmark suite: generates reproducible expression corpora, times every
+// construction and evaluation stage separately and prints one JSON document,
+// so runs from different commits can be diffed or compared by a script.
+
+// Friend of AST: runs the private construction stages one at a time.
+struct AstStages {
+    static void setSource(AST& ast, const string& text) { ast.source = make_shared<const string>(text); }
+    static void tokenize(AST& ast, AST::TokenArray& tokens) { ast.tokenize(*ast.source, tokens); }
+    static void handleUnaryOperators(AST& ast, AST::TokenArray& tokens) { ast.handleUnaryOperators(tokens); }
+    static void infixToPostfix(AST& ast, const AST::TokenArray& tokens) { ast.infixToPostfix(tokens); }
+    static void buildTree(AST& ast) { ast.buildTree(); }
+};
+
+// --- Corpora ---------------------------------------------------------------
+// Every generator is seeded from the corpus name and size alone, so the same
+// arguments always produce byte-identical input.
+
+static string deepCorpus(size_t tokens, mt19937_64&) {
+    // (((1+1)+1)+1)... nested one parenthesis per four tokens.
+    size_t levels = max<size_t>(tokens / 4, 1);
+    string s(levels, '(');
+    s += '1';
+    for (size_t i = 0; i < levels; ++i) s += "+1)";
+    return s;
+}
+
+static string wideCorpus(size_t tokens, mt19937_64& rng) {
+    size_t terms = max<size_t>(tokens / 2, 1);
+    string s;
+    s.reserve(terms * 3);
+    for (size_t i = 0; i < terms; ++i) {
+        if (i) s += '+';
+        s += char('1' + rng() % 9);
+    }
+    return s;
+}
+
+static string literalCorpus(size_t tokens, mt19937_64& rng) {
+    size_t terms = max<size_t>(tokens / 2, 1);
+    string s;
+    s.reserve(terms * 28);
+    for (size_t i = 0; i < terms; ++i) {
+        if (i) s += (rng() % 2) ? '+' : '*';
+        s += char('1' + rng() % 9);
+        for (int d = 0; d < 17; ++d) s += char('0' + rng() % 10);
+        s += '.';
+        for (int d = 0; d < 8; ++d) s += char('0' + rng() % 10);
+    }
+    return s;
+}
+
+static string unaryCorpus(size_t tokens, mt19937_64& rng) {
+    string s;
+    s.reserve(tokens + 16);
+    size_t count = 0;
+    while (count + 6 <= tokens || count == 0) {
+        if (count) { s += (rng() % 2) ? '+' : '*'; ++count; }
+        size_t minuses = 1 + rng() % 4;
+        s.append(minuses, '-');
+        s += char('1' + rng() % 9);
+        count += minuses + 1;
+    }
+    return s;
+}
+
+// Random binary tree over `leaves` literals. Divisors are always nonzero
+// literals so evaluation never throws. Uniform splits keep the expected
+// depth logarithmic, which bounds this generator's own recursion.
+static void randomExpression(size_t leaves, mt19937_64& rng, string& out) {
+    if (leaves == 1) {
+        if (rng() % 6 == 0) out += '-';
+        out += char('1' + rng() % 9);
+        if (rng() % 4 == 0) { out += '.'; out += char('0' + rng() % 10); }
+        return;
+    }
+    static const char ops[] = {'+', '-', '*', '/'};
+    char op = ops[rng() % 4];
+    size_t left = op == '/' ? leaves - 1 : 1 + rng() % (leaves - 1);
+    bool parens = rng() % 2 == 0;
+    if (parens) out += '(';
+    randomExpression(left, rng, out);
+    out += op;
+    randomExpression(leaves - left, rng, out);
+    if (parens) out += ')';
+}
+
+static string randomCorpus(size_t tokens, mt19937_64& rng) {
+    string s;
+    s.reserve(tokens * 2);
+    randomExpression(max<size_t>(tokens / 3, 1), rng, s);
+    return s;
+}
+
+struct Corpus {
+    const char* name;
+    string (*generate)(size_t tokens, mt19937_64& rng);
+};
+
+static const Corpus CORPORA[] = {
+    {"deep", deepCorpus},
+    {"wide", wideCorpus},
+    {"literals", literalCorpus},
+    {"unary", unaryCorpus},
+    {"random", randomCorpus},
+};
+
+// --- Timing ----------------------------------------------------------------
+
+enum Stage { Tokenize, Unary, Postfix, Build, StreamParse, Calculate, CalculateExact, Compile, Evaluate, JitCompile, EvaluateJit,
+             LoadLibrary, Walkthrough, Copy, Destroy, STAGE_COUNT };
+
+static const char* const STAGE_NAMES[STAGE_COUNT] = {
+    "tokenize", "handleUnaryOperators", "infixToPostfix", "buildTree", "streamParse", "calculate", "calculateExact",
+    "compile", "evaluateBytecode", "jitCompile", "evaluateJit", "loadLibrary", "simplifyWalkthrough", "copy", "destroy",
+};
+
+struct StageTimes {
+    double best = numeric_limits<double>::infinity();
+    double total = 0;
+
+    void add(double ns) {
+        best = min(best, ns);
+        total += ns;
+    }
+};
+
+typedef chrono::steady_clock Clock;
+
+static double elapsedNs(Clock::time_point start) {
+    return chrono::duration<double, nano>(Clock::now() - start).count();
+}
+
+struct Options {
+    size_t minTokens = 100;
+    size_t maxTokens = 10000000;
+    size_t reps = 0;          // 0: scale with corpus size
+    // Walk-throughs stop after this many steps, or once path copying has
+    // grown the arena past 4M nodes and fourfold (chains copy their whole
+    // spine every step).
+    size_t walkSteps = 100;
+    // Exact results of long products grow with the input, so exact
+    // evaluation is only timed up to this size.
+    size_t exactMaxTokens = 100000;
+    const char* only = nullptr;
+};
+
+struct Result {
+    size_t tokens = 0;
+    size_t nodes = 0;
+    size_t reps = 0;
+    size_t walkSteps = 0;
+    bool walkComplete = false;
+    double value = 0;
+    StageTimes stages[STAGE_COUNT];
+};
+
+static Result measure(const string& text, const Options& options, size_t targetTokens) {
+    Result result;
+    result.reps = options.reps ? options.reps : clamp<size_t>(1000000 / targetTokens, 1, 1000);
+    volatile double sink = 0;
+
+    for (size_t rep = 0; rep < result.reps; ++rep) {
+        auto ast = make_unique<AST>("", numeric_limits<size_t>::max());
+        AstStages::setSource(*ast, text);
+        AST::TokenArray tokens;
+
+        auto start = Clock::now();
+        AstStages::tokenize(*ast, tokens);
+        result.stages[Tokenize].add(elapsedNs(start));
+
+        start = Clock::now();
+        AstStages::handleUnaryOperators(*ast, tokens);
+        result.stages[Unary].add(elapsedNs(start));
+
+        start = Clock::now();
+        AstStages::infixToPostfix(*ast, tokens);
+        result.stages[Postfix].add(elapsedNs(start));
+        result.tokens = tokens.size;
+        tokens.clear();
+
+        start = Clock::now();
+        AstStages::buildTree(*ast);
+        result.stages[Build].add(elapsedNs(start));
+        result.nodes = ast->nodeCount();
+
+        // The whole parse again, streamed in 64 KiB pieces.
+        start = Clock::now();
+        StreamingParser streaming(numeric_limits<size_t>::max());
+        for (size_t offset = 0; offset < text.size(); offset += 1 << 16) {
+            streaming.feed(string_view(text).substr(offset, 1 << 16));
+        }
+        AST streamed = streaming.finish();
+        result.stages[StreamParse].add(elapsedNs(start));
+
+        start = Clock::now();
+        result.value = ast->calculate();
+        result.stages[Calculate].add(elapsedNs(start));
+        double streamedValue = streamed.calculate();
+        if (memcmp(&streamedValue, &result.value, sizeof streamedValue) != 0
+            && !(isnan(streamedValue) && isnan(result.value))) {
+            fprintf(stderr, "Streaming parse mismatch: %.17g, calculate() gave %.17g\n", streamedValue, result.value);
+            exit(1);
+        }
+
+        if (targetTokens <= options.exactMaxTokens) {
+            start = Clock::now();
+            Rational exact = ast->calculateExact();
+            result.stages[CalculateExact].add(elapsedNs(start));
+            sink = sink + exact.isZero();
+        }
+
+        start = Clock::now();
+        Program program = ast->compile();
+        result.stages[Compile].add(elapsedNs(start));
+
+        start = Clock::now();
+        sink = sink + program.evaluate();
+        result.stages[Evaluate].add(elapsedNs(start));
+
+        start = Clock::now();
+        JitProgram jit(program);
+        result.stages[JitCompile].add(elapsedNs(start));
+
+        start = Clock::now();
+        double native = jit.evaluate();
+        result.stages[EvaluateJit].add(elapsedNs(start));
+        // Generated code must agree with the tree walk bit for bit.
+        if (memcmp(&native, &result.value, sizeof native) != 0 && !(isnan(native) && isnan(result.value))) {
+            fprintf(stderr, "JIT mismatch: %.17g, calculate() gave %.17g\n", native, result.value);
+            exit(1);
+        }
+
+        // Saved once, then mapped, validated and evaluated in place.
+        {
+            string path = (filesystem::temp_directory_path() / "stc_benchmark.stclib").string();
+            ProgramLibraryWriter writer;
+            writer.add("expression", program, {});
+            writer.save(path);
+            start = Clock::now();
+            double mapped = ProgramLibrary(path).at(0).evaluate();
+            result.stages[LoadLibrary].add(elapsedNs(start));
+            filesystem::remove(path);
+            if (memcmp(&mapped, &result.value, sizeof mapped) != 0 && !(isnan(mapped) && isnan(result.value))) {
+                fprintf(stderr, "Program library mismatch: %.17g, calculate() gave %.17g\n", mapped, result.value);
+                exit(1);
+            }
+        }
+
+        start = Clock::now();
+        {
+            AST steps(*ast);
+            size_t budget = max<size_t>(steps.nodeCount() * 4, 1 << 22);
+            size_t taken = 0;
+            bool complete = true;
+            while (steps.simplifyLowestLevel()) {
+                if (++taken == options.walkSteps || steps.nodeCount() > budget) {
+                    if (steps.simplifyLowestLevel()) { ++taken; complete = false; }
+                    break;
+                }
+            }
+            result.walkSteps = taken;
+            result.walkComplete = complete;
+        }
+        result.stages[Walkthrough].add(elapsedNs(start));
+
+        start = Clock::now();
+        auto copy = make_unique<AST>(*ast);
+        result.stages[Copy].add(elapsedNs(start));
+        copy.reset();
+
+        start = Clock::now();
+        ast.reset();
+        result.stages[Destroy].add(elapsedNs(start));
+    }
+    return result;
+}
+
+// --- Driver ----------------------------------------------------------------
+
+static void printUsage(const char* prog) {
+    cerr << "Usage: " << prog << " [--min-tokens n] [--max-tokens n] [--reps n] [--walk-steps n]\n"
+         << "       [--exact-max-tokens n] [--corpus deep|wide|literals|unary|random] [-o output.json]\n"
+         << "Times each parsing and evaluation stage over generated corpora of\n"
+         << "10^k tokens and writes the results as JSON (stdout by default).\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    const char* outputPath = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--min-tokens") && i + 1 < argc) {
+            options.minTokens = max<size_t>(strtoull(argv[++i], nullptr, 10), 1);
+        } else if (!strcmp(argv[i], "--max-tokens") && i + 1 < argc) {
+            options.maxTokens = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+            options.reps = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--walk-steps") && i + 1 < argc) {
+            options.walkSteps = max<size_t>(strtoull(argv[++i], nullptr, 10), 1);
+        } else if (!strcmp(argv[i], "--exact-max-tokens") && i + 1 < argc) {
+            options.exactMaxTokens = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--corpus") && i + 1 < argc) {
+            options.only = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            printUsage(argv[0]);
+            return 0;
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    FILE* out = stdout;
+    if (outputPath) {
+        out = fopen(outputPath, "wb");
+        if (!out) { perror(outputPath); return 1; }
+    }
+
+#if defined(__clang__)
+    const char* compiler = "clang " __clang_version__;
+#elif defined(__GNUC__)
+    const char* compiler = "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    const char* compiler = "msvc";
+#else
+    const char* compiler = "unknown";
+#endif
+
+    fprintf(out, "{\n  \"schema\": 1,\n  \"compiler\": \"%s\",\n  \"simd\": \"%s\",\n  \"lexer\": \"%s\",\n  \"hardware_threads\": %u,\n  \"results\": [",
+            compiler, Program::columnKernelName(), AST::lexerName(), thread::hardware_concurrency());
+
+    bool first = true;
+    for (const Corpus& corpus : CORPORA) {
+        if (options.only && strcmp(options.only, corpus.name) != 0) continue;
+        for (size_t target = 100; target <= options.maxTokens; target *= 10) {
+            if (target < options.minTokens) continue;
+            mt19937_64 rng(target * 31 + strlen(corpus.name));
+            string text = corpus.generate(target, rng);
+            cerr << corpus.name << " " << target << " tokens..." << endl;
+
+            fprintf(out, "%s\n    {\"corpus\": \"%s\", \"target_tokens\": %zu, \"bytes\": %zu",
+                    first ? "" : ",", corpus.name, target, text.size());
+            first = false;
+            try {
+                Result r = measure(text, options, target);
+                // JSON has no inf or nan; overflowing corpora report null.
+                char value[32] = "null";
+                if (isfinite(r.value)) snprintf(value, sizeof(value), "%.17g", r.value);
+                fprintf(out, ", \"tokens\": %zu, \"nodes\": %zu, \"reps\": %zu, \"value\": %s,\n"
+                             "     \"walkthrough_steps\": %zu, \"walkthrough_complete\": %s,\n     \"stages\": {",
+                        r.tokens, r.nodes, r.reps, value, r.walkSteps, r.walkComplete ? "true" : "false");
+                for (int s = 0; s < STAGE_COUNT; ++s) {
+                    // Stages skipped at this size report null.
+                    if (!isfinite(r.stages[s].best)) {
+                        fprintf(out, "%s\n       \"%s\": null", s ? "," : "", STAGE_NAMES[s]);
+                        continue;
+                    }
+                    fprintf(out, "%s\n       \"%s\": {\"best_ns\": %.0f, \"mean_ns\": %.0f}", s ? "," : "",
+                            STAGE_NAMES[s], r.stages[s].best, r.stages[s].total / r.reps);
+                }
+                fprintf(out, "\n     }}");
+            } catch (const exception& e) {
+                // Messages are fixed parser/evaluator strings without quotes.
+                fprintf(out, ", \"error\": \"%s\"}", e.what());
+            }
+            fflush(out);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) fclose(out);
+    return 0;
+}
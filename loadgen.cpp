@@ -0,0 +1,318 @@
+#include "AST.h"
+#include "ServerProtocol.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Load generator for Syntax_Tree_Server. Each connection keeps a fixed
+// number of batches in flight and times every one from send to response.
+// Every result is checked against local evaluation, so a run doubles as an
+// end-to-end test. Prints throughput and latency percentiles.
+
+typedef chrono::steady_clock Clock;
+
+struct Options {
+    long port = 7878;
+    const char* unixPath = nullptr;
+    size_t connections = 4;
+    size_t pipeline = 8;       // batches in flight per connection
+    size_t batch = 16;         // expressions per batch
+    double seconds = 5;
+    size_t distinct = 1000;    // size of the generated expression pool
+    const char* input = nullptr;
+};
+
+static void printUsage(const char* prog) {
+    cerr << "Usage: " << prog << " [--port n | --unix path] [-c connections] [-p pipeline] [-b batch]\n"
+         << "       [-t seconds] [--distinct n] [expressions.txt]\n"
+         << "Sends batches of expressions to Syntax_Tree_Server, checks every result\n"
+         << "against local evaluation and reports throughput and latency.\n"
+         << "Without a file, a pool of random expressions is generated.\n";
+}
+
+static void randomExpression(size_t leaves, mt19937_64& rng, string& out) {
+    if (leaves <= 1) {
+        switch (rng() % 8) {
+            case 0: out += to_string(rng() % 10) + "." + to_string(rng() % 100); break;
+            case 1: out += "0"; break;   // exercises division by zero
+            default: out += to_string(rng() % 1000); break;
+        }
+        return;
+    }
+    size_t left = 1 + rng() % (leaves - 1);
+    bool parens = rng() % 3 == 0;
+    if (rng() % 10 == 0) out += '-';
+    if (parens) out += '(';
+    randomExpression(left, rng, out);
+    out += "+-*/"[rng() % 4];
+    randomExpression(leaves - left, rng, out);
+    if (parens) out += ')';
+}
+
+static vector<string> loadExpressions(const Options& options) {
+    vector<string> pool;
+    if (options.input) {
+        FILE* in = fopen(options.input, "rb");
+        if (!in) throw runtime_error(string("Error: Cannot open '") + options.input + "'.");
+        string line;
+        int c;
+        while ((c = fgetc(in)) != EOF) {
+            if (c == '\n') {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                pool.push_back(move(line));
+                line.clear();
+            } else {
+                line += char(c);
+            }
+        }
+        if (!line.empty()) pool.push_back(move(line));
+        fclose(in);
+    } else {
+        mt19937_64 rng(42);
+        for (size_t i = 0; i < options.distinct; ++i) {
+            string e;
+            randomExpression(2 + rng() % 24, rng, e);
+            pool.push_back(move(e));
+        }
+    }
+    if (pool.empty()) throw runtime_error("Error: No expressions.");
+    return pool;
+}
+
+static int connectTo(const Options& options) {
+    int fd;
+    if (options.unixPath) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, options.unixPath, sizeof addr.sun_path - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(options.port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+            close(fd);
+            fd = -1;
+        }
+        int one = 1;
+        if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    }
+    if (fd < 0) throw runtime_error(string("Error: Cannot connect: ") + strerror(errno));
+    return fd;
+}
+
+static void sendAll(int fd, const string& data) {
+    for (size_t sent = 0; sent < data.size();) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw runtime_error("Error: Connection lost.");
+        sent += size_t(n);
+    }
+}
+
+// What the server must answer for one expression.
+struct Expected {
+    bool ok;
+    double value;
+    string error;
+};
+
+static bool matches(const ServerProtocol::Result& got, const Expected& want) {
+    if (got.ok != want.ok) return false;
+    if (!got.ok) return got.error == want.error;
+    return memcmp(&got.value, &want.value, sizeof(double)) == 0 || (isnan(got.value) && isnan(want.value));
+}
+
+struct ClientStats {
+    vector<double> latencies;   // microseconds per batch
+    size_t expressions = 0;
+    size_t errors = 0;          // results the server reported as errors
+    size_t mismatches = 0;
+};
+
+static void runClient(const Options& options, const vector<string>& pool, const vector<Expected>& expected,
+                      size_t seed, Clock::time_point deadline, ClientStats& stats) {
+    int fd = connectTo(options);
+    mt19937_64 rng(seed);
+    // Ring of in-flight batches: which pool entries and when each was sent.
+    vector<vector<size_t>> picks(options.pipeline);
+    vector<Clock::time_point> sentAt(options.pipeline);
+    uint32_t nextId = 0;
+    size_t inFlight = 0;
+
+    auto sendBatch = [&]() {
+        uint32_t id = nextId++;
+        vector<size_t>& pick = picks[id % options.pipeline];
+        vector<string_view> batch;
+        pick.clear();
+        for (size_t i = 0; i < options.batch; ++i) {
+            pick.push_back(rng() % pool.size());
+            batch.push_back(pool[pick.back()]);
+        }
+        string frame;
+        ServerProtocol::appendRequest(frame, id, batch);
+        sentAt[id % options.pipeline] = Clock::now();
+        sendAll(fd, frame);
+        ++inFlight;
+    };
+
+    string buffer;
+    size_t start = 0;
+    vector<ServerProtocol::Result> results;
+    char chunk[64 * 1024];
+    for (size_t i = 0; i < options.pipeline; ++i) sendBatch();
+    while (inFlight > 0) {
+        size_t size = ServerProtocol::frameSize(buffer.data() + start, buffer.size() - start);
+        if (size == 0 || size > buffer.size() - start) {
+            if (start > 0) {
+                buffer.erase(0, start);
+                start = 0;
+            }
+            ssize_t n = recv(fd, chunk, sizeof chunk, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw runtime_error("Error: Connection lost.");
+            buffer.append(chunk, size_t(n));
+            continue;
+        }
+        Clock::time_point now = Clock::now();
+        uint32_t id;
+        ServerProtocol::parseResponse(string_view(buffer).substr(start + ServerProtocol::HEADER_BYTES,
+                                                                 size - ServerProtocol::HEADER_BYTES), id, results);
+        start += size;
+        --inFlight;
+
+        size_t slot = id % options.pipeline;
+        stats.latencies.push_back(chrono::duration<double, micro>(now - sentAt[slot]).count());
+        const vector<size_t>& pick = picks[slot];
+        if (results.size() != pick.size()) throw runtime_error("Error: Wrong number of results.");
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (!results[i].ok) ++stats.errors;
+            if (!matches(results[i], expected[pick[i]])) {
+                if (stats.mismatches++ == 0) {
+                    cerr << "Mismatch for '" << pool[pick[i]] << "': got "
+                         << (results[i].ok ? to_string(results[i].value) : results[i].error) << "\n";
+                }
+            }
+        }
+        stats.expressions += results.size();
+        if (now < deadline) sendBatch();
+    }
+    close(fd);
+}
+
+static double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = min(sorted.size() - 1, static_cast<size_t>(p / 100 * sorted.size()));
+    return sorted[index];
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+            options.port = strtol(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--unix") && i + 1 < argc) {
+            options.unixPath = argv[++i];
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            options.connections = max<size_t>(strtoull(argv[++i], nullptr, 10), 1);
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            options.pipeline = max<size_t>(strtoull(argv[++i], nullptr, 10), 1);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            options.batch = max<size_t>(strtoull(argv[++i], nullptr, 10), 1);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            options.seconds = strtod(argv[++i], nullptr);
+        } else if (!strcmp(argv[i], "--distinct") && i + 1 < argc) {
+            options.distinct = max<size_t>(strtoull(argv[++i], nullptr, 10), 1);
+        } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            printUsage(argv[0]);
+            return 0;
+        } else if (!options.input && argv[i][0] != '-') {
+            options.input = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    try {
+        vector<string> pool = loadExpressions(options);
+        // Answers from AST::calculate(), formatted the way Syntax_Tree_Batch
+        // prints them, so the server is checked against the tree walk rather
+        // than against its own cache and bytecode.
+        vector<Expected> expected;
+        for (const string& e : pool) {
+            try {
+                AST tree(e);
+                expected.push_back({true, tree.calculate(), string()});
+            } catch (const exception& ex) {
+                string message = ex.what();
+                expected.push_back({false, 0, message.compare(0, 5, "Error") == 0 ? message : "Error: " + message});
+            }
+        }
+
+        vector<ClientStats> stats(options.connections);
+        vector<thread> clients;
+        vector<string> failures(options.connections);
+        Clock::time_point begin = Clock::now();
+        Clock::time_point deadline = begin + chrono::duration_cast<Clock::duration>(chrono::duration<double>(options.seconds));
+        for (size_t i = 0; i < options.connections; ++i) {
+            clients.emplace_back([&, i]() {
+                try {
+                    runClient(options, pool, expected, i + 1, deadline, stats[i]);
+                } catch (const exception& e) {
+                    failures[i] = e.what();
+                }
+            });
+        }
+        for (auto& t : clients) t.join();
+        double elapsed = chrono::duration<double>(Clock::now() - begin).count();
+
+        for (const string& f : failures) {
+            if (!f.empty()) throw runtime_error(f);
+        }
+        vector<double> latencies;
+        size_t expressions = 0, errors = 0, mismatches = 0;
+        for (const ClientStats& s : stats) {
+            latencies.insert(latencies.end(), s.latencies.begin(), s.latencies.end());
+            expressions += s.expressions;
+            errors += s.errors;
+            mismatches += s.mismatches;
+        }
+        sort(latencies.begin(), latencies.end());
+
+        printf("connections %zu, pipeline %zu, batch %zu, %.1f s\n", options.connections, options.pipeline,
+               options.batch, elapsed);
+        printf("batches %zu, expressions %zu, error results %zu, mismatches %zu\n", latencies.size(), expressions,
+               errors, mismatches);
+        printf("throughput %.0f expressions/s, %.0f batches/s\n", expressions / elapsed, latencies.size() / elapsed);
+        printf("batch latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", percentile(latencies, 50),
+               percentile(latencies, 99), percentile(latencies, 99.9), latencies.empty() ? 0.0 : latencies.back());
+        return mismatches ? 1 : 0;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -1,4 +1,5 @@
 #include "mainwindow.h"
+#include "TreeItem.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QGridLayout>
@@ -9,6 +10,12 @@
 #include <QGraphicsLineItem>
 #include <QStandardPaths>
 #include <QDir>
+#include <QSignalBlocker>
+#include <QFileDialog>
+#include <QHeaderView>
+#include <QMetaObject>
+#include <QListView>
+#include "HistoryModel.h"
 
 
 ZoomableView::ZoomableView(QGraphicsScene *scene) : QGraphicsView(scene) {
@@ -41,7 +48,8 @@ CalcButton::CalcButton(const QString &text, const QString &color) : QPushButton(
 }
 
 
-MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), currentStepIndex(-1) {
+MainWindow::MainWindow(QWidget *parent)
+    : QMainWindow(parent), treeItem(nullptr), jobGeneration(0), currentStepIndex(-1), nodeFont("Arial", 12, QFont::Bold) {
     // Load version from resource (if available)
     QString versionStr;
     QFile vfile(":/version.txt");
@@ -51,6 +59,17 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), currentStepIndex(
         vfile.close();
     }
 
+    // Calculation log in the per-user AppData location.
+    QString appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(appData);
+    QString historyPath = QDir::toNativeSeparators(QDir(appData).filePath("calc_history.txt"));
+    historyStore = std::make_unique<HistoryStore>(historyPath.toLocal8Bit().toStdString());
+    // Appends are batched and written once calculations pause.
+    historyFlushTimer = new QTimer(this);
+    historyFlushTimer->setSingleShot(true);
+    historyFlushTimer->setInterval(2000);
+    connect(historyFlushTimer, &QTimer::timeout, this, &MainWindow::flushHistory);
+
     QString title = "Data Structure SyntaxTree Calculator";
     if (!versionStr.isEmpty()) title += " — v" + versionStr;
 
@@ -67,12 +86,24 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), currentStepIndex(
 
     // Display Area
     display = new QLineEdit;
-    display->setPlaceholderText("Enter expression (e.g. 5+3*2)");
+    display->setPlaceholderText("Enter expression (e.g. 5+3*2 or x*2+y)");
     display->setAlignment(Qt::AlignRight);
     display->setStyleSheet("QLineEdit { background-color: #1E1E1E; color: #00E5FF; font-size: 36px; border: 1px solid #333; border-radius: 10px; padding: 10px; }");
-    display->setValidator(new QRegularExpressionValidator(QRegularExpression("[0-9+\\-*/().]+"), this));
+    display->setValidator(new QRegularExpressionValidator(QRegularExpression("[0-9A-Za-z_+\\-*/%^(),. ]+"), this));
     mainLayout->addWidget(display);
 
+    // Live result under the display, updated once typing pauses.
+    previewLabel = new QLabel;
+    previewLabel->setAlignment(Qt::AlignRight);
+    previewLabel->setStyleSheet("color: #9E9E9E; font-size: 18px;");
+    mainLayout->addWidget(previewLabel);
+    previewTimer = new QTimer(this);
+    previewTimer->setSingleShot(true);
+    previewTimer->setInterval(150);
+    connect(previewTimer, &QTimer::timeout, this, &MainWindow::updatePreview);
+    // textEdited skips programmatic changes such as showing a result.
+    connect(display, &QLineEdit::textEdited, this, &MainWindow::onDisplayEdited);
+
     // --- Control Buttons Layout ---
     QHBoxLayout *stepLayout = new QHBoxLayout();
 
@@ -82,6 +113,13 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), currentStepIndex(
     connect(btnHistory, &QPushButton::clicked, this, &MainWindow::showHistory);
     stepLayout->addWidget(btnHistory);
 
+    // Exact mode: evaluate with rationals instead of doubles.
+    btnExact = new QPushButton("Exact");
+    btnExact->setCheckable(true);
+    btnExact->setStyleSheet("QPushButton { background-color: #424242; color: white; padding: 10px; border-radius: 5px; font-weight: bold; }"
+                            "QPushButton:checked { background-color: #7B1FA2; }");
+    stepLayout->addWidget(btnExact);
+
     // Undo/Expand Button
     btnStepBack = new QPushButton("Expand (Undo)");
     btnStepBack->setStyleSheet("background-color: #D32F2F; color: white; padding: 10px; border-radius: 5px; font-weight: bold;");
@@ -98,12 +136,84 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), currentStepIndex(
 
     mainLayout->addLayout(stepLayout);
 
+    // Step slider: jump straight to any simplification step.
+    QHBoxLayout *sliderLayout = new QHBoxLayout();
+    stepSlider = new QSlider(Qt::Horizontal);
+    stepSlider->setRange(0, 0);
+    stepSlider->setEnabled(false);
+    connect(stepSlider, &QSlider::valueChanged, this, &MainWindow::onStepSliderMoved);
+    sliderLayout->addWidget(stepSlider);
+
+    stepLabel = new QLabel("Step 0 / 0");
+    stepLabel->setStyleSheet("color: #EEE; font-weight: bold;");
+    sliderLayout->addWidget(stepLabel);
+    mainLayout->addLayout(sliderLayout);
+
+    // Progress of background work, shown once a job has run for a moment.
+    progressPanel = new QWidget;
+    QHBoxLayout *progressLayout = new QHBoxLayout(progressPanel);
+    progressLayout->setContentsMargins(0, 0, 0, 0);
+    progressLabel = new QLabel;
+    progressLabel->setStyleSheet("color: #EEE;");
+    progressLabel->setMinimumWidth(90);
+    progressLayout->addWidget(progressLabel);
+    progressBar = new QProgressBar;
+    progressBar->setRange(0, 1000);
+    progressBar->setTextVisible(false);
+    progressLayout->addWidget(progressBar);
+    QPushButton *btnCancel = new QPushButton("Cancel");
+    btnCancel->setStyleSheet("background-color: #D32F2F; color: white; padding: 6px; border-radius: 5px; font-weight: bold;");
+    connect(btnCancel, &QPushButton::clicked, this, &MainWindow::onCancelPressed);
+    progressLayout->addWidget(btnCancel);
+    progressPanel->setVisible(false);
+    mainLayout->addWidget(progressPanel);
+
+    progressTimer = new QTimer(this);
+    progressTimer->setInterval(100);
+    connect(progressTimer, &QTimer::timeout, this, &MainWindow::updateProgress);
+
     // Graphics View (The Tree)
     scene = new QGraphicsScene;
+    scene->setItemIndexMethod(QGraphicsScene::NoIndex);   // a single TreeItem per tree
     view = new ZoomableView(scene);
     view->setStyleSheet("border: 1px solid #333; border-radius: 10px;");
     mainLayout->addWidget(view);
 
+    // Stats panel (collapsed by default)
+    statsToggle = new QToolButton;
+    statsToggle->setText("Performance Stats");
+    statsToggle->setCheckable(true);
+    statsToggle->setArrowType(Qt::RightArrow);
+    statsToggle->setToolButtonStyle(Qt::ToolButtonTextBesideIcon);
+    statsToggle->setStyleSheet("QToolButton { color: #EEE; font-weight: bold; border: none; }");
+    mainLayout->addWidget(statsToggle);
+
+    statsPanel = new QWidget;
+    QVBoxLayout *statsLayout = new QVBoxLayout(statsPanel);
+    statsLayout->setContentsMargins(0, 0, 0, 0);
+    statsTree = new QTreeWidget;
+    statsTree->setColumnCount(4);
+    statsTree->setHeaderLabels({"Phase", "Calls", "Time (ms)", "Allocations"});
+    statsTree->setRootIsDecorated(false);
+    statsTree->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+    statsTree->setMinimumHeight(160);
+    statsTree->setStyleSheet("QTreeWidget { background-color: #1E1E1E; color: #EEE; border: 1px solid #333; }");
+    statsLayout->addWidget(statsTree);
+
+    QPushButton *btnExportTrace = new QPushButton("Export Trace (JSON)");
+    btnExportTrace->setStyleSheet("background-color: #1976D2; color: white; padding: 6px; border-radius: 5px;");
+    btnExportTrace->setEnabled(TraceSession::enabled);
+    connect(btnExportTrace, &QPushButton::clicked, this, &MainWindow::exportTrace);
+    statsLayout->addWidget(btnExportTrace);
+
+    statsPanel->setVisible(false);
+    mainLayout->addWidget(statsPanel);
+    connect(statsToggle, &QToolButton::toggled, this, [this](bool open) {
+        statsToggle->setArrowType(open ? Qt::DownArrow : Qt::RightArrow);
+        statsPanel->setVisible(open);
+    });
+    refreshStats();
+
     // Keypad
     QWidget *keypadWidget = new QWidget;
     QGridLayout *gridLayout = new QGridLayout(keypadWidget);
@@ -111,6 +221,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), currentStepIndex(
     struct BtnDef { QString label; QString color; };
     QList<QList<BtnDef>> rows = {
         {{"AC", "#D32F2F"}, {"DEL", "#C62828"}, {"(", "#424242"}, {")", "#424242"}},
+        {{"sqrt(", "#424242"}, {",", "#424242"}, {"%", "#1976D2"}, {"^", "#1976D2"}},
         {{"7", "#303030"}, {"8", "#303030"}, {"9", "#303030"}, {"/", "#1976D2"}},
         {{"4", "#303030"}, {"5", "#303030"}, {"6", "#303030"}, {"*", "#1976D2"}},
         {{"1", "#303030"}, {"2", "#303030"}, {"3", "#303030"}, {"-", "#1976D2"}},
@@ -125,6 +236,8 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), currentStepIndex(
 
             if (text == "AC") connect(btn, &QPushButton::clicked, this, [this](){
                 display->clear();
+                previewTimer->stop();
+                previewLabel->clear();
                 clearHistory();
                 display->setFocus();
             });
@@ -142,34 +255,46 @@ MainWindow::~MainWindow() {
 }
 
 void MainWindow::clearHistory() {
+    stopJob();
+    resetSteps();
+    scene->clear();
+    treeItem = nullptr;
+}
+
+void MainWindow::resetSteps() {
     for(auto tree : history) delete tree;
     history.clear();
+    layouts.clear();
+    schedule = AST::ReductionSchedule();
     currentStepIndex = -1;
-    scene->clear();
     btnStepBack->setEnabled(false);
     btnStepForward->setEnabled(false);
+
+    QSignalBlocker block(stepSlider);
+    stepSlider->setRange(0, 0);
+    stepSlider->setEnabled(false);
+    stepLabel->setText("Step 0 / 0");
 }
 
 
 void MainWindow::saveToHistory(const QString &expression, const QString &result) {
-    // Use per-user AppData location for history
-    QString appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
-    QDir().mkpath(appData);
-    QString historyPath = QDir(appData).filePath("calc_history.txt");
-
-    QFile file(historyPath);
-    if (file.open(QIODevice::Append | QIODevice::Text)) {
-        QTextStream out(&file);
-        QString timestamp = QDateTime::currentDateTime().toString("yyyy-MM-dd HH:mm:ss");
-        out << "[" << timestamp << "] " << expression << " = " << result << "\n";
-        file.close();
+    QString timestamp = QDateTime::currentDateTime().toString("yyyy-MM-dd HH:mm:ss");
+    try {
+        historyStore->append(timestamp.toStdString(), expression.toStdString(), result.toStdString());
+    } catch (const std::exception &) {
+        // History is best effort; a failed write must not interrupt a calculation.
     }
+    historyFlushTimer->start();
 }
 
-void MainWindow::showHistory() {
-    QString appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
-    QString historyPath = QDir(appData).filePath("calc_history.txt");
+void MainWindow::flushHistory() {
+    try {
+        historyStore->flush();
+    } catch (const std::exception &) {
+    }
+}
 
+void MainWindow::showHistory() {
     QDialog historyDlg(this);
     historyDlg.setWindowTitle("Calculation History");
     historyDlg.resize(400, 500);
@@ -177,190 +302,418 @@ void MainWindow::showHistory() {
 
     QVBoxLayout *layout = new QVBoxLayout(&historyDlg);
 
-    QTextEdit *historyText = new QTextEdit;
-    historyText->setReadOnly(true);
-    historyText->setStyleSheet("background-color: #1E1E1E; color: #00E5FF; font-size: 14px; border: 1px solid #333;");
-    layout->addWidget(historyText);
-
-    // Read File
-    QFile file(historyPath);
-    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QTextStream in(&file);
-        historyText->setText(in.readAll());
-        file.close();
-    } else {
-        historyText->setText("No history found.");
+    // Substring search plus an optional date range; a partial date such as
+    // "2026-10" matches the whole month.
+    QString editStyle = "QLineEdit { background-color: #1E1E1E; color: #EEE; border: 1px solid #333; padding: 4px; }";
+    QLineEdit *searchEdit = new QLineEdit;
+    searchEdit->setPlaceholderText("Search");
+    searchEdit->setStyleSheet(editStyle);
+    layout->addWidget(searchEdit);
+    QHBoxLayout *rangeLayout = new QHBoxLayout();
+    QLineEdit *fromEdit = new QLineEdit;
+    fromEdit->setPlaceholderText("From (yyyy-MM-dd)");
+    fromEdit->setStyleSheet(editStyle);
+    rangeLayout->addWidget(fromEdit);
+    QLineEdit *toEdit = new QLineEdit;
+    toEdit->setPlaceholderText("To (yyyy-MM-dd)");
+    toEdit->setStyleSheet(editStyle);
+    rangeLayout->addWidget(toEdit);
+    layout->addLayout(rangeLayout);
+
+    // Rows come from the memory-mapped log as they scroll into view.
+    HistoryModel *model = new HistoryModel(*historyStore, &historyDlg);
+    QListView *historyList = new QListView;
+    historyList->setModel(model);
+    historyList->setUniformItemSizes(true);
+    historyList->setStyleSheet("background-color: #1E1E1E; color: #00E5FF; font-size: 14px; border: 1px solid #333;");
+    layout->addWidget(historyList);
+
+    QLabel *countLabel = new QLabel;
+    layout->addWidget(countLabel);
+    auto showCount = [model, countLabel, historyList]() {
+        int rows = model->rowCount();
+        countLabel->setText(rows ? QString("%1 entries").arg(rows) : QString("No history found."));
+        historyList->scrollToBottom();
+    };
+    showCount();
+
+    // Filter once typing pauses rather than on every keystroke.
+    QTimer *filterTimer = new QTimer(&historyDlg);
+    filterTimer->setSingleShot(true);
+    filterTimer->setInterval(200);
+    connect(filterTimer, &QTimer::timeout, &historyDlg, [=]() {
+        model->setFilter(searchEdit->text(), fromEdit->text().trimmed(), toEdit->text().trimmed());
+        showCount();
+    });
+    for (QLineEdit *edit : {searchEdit, fromEdit, toEdit}) {
+        connect(edit, &QLineEdit::textChanged, filterTimer, qOverload<>(&QTimer::start));
     }
 
     QPushButton *btnClear = new QPushButton("Clear Log");
     btnClear->setStyleSheet("background-color: #D32F2F; color: white; padding: 8px;");
-    connect(btnClear, &QPushButton::clicked, [historyPath, historyText](){
-        QFile f(historyPath);
-        if (f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-            f.close();
+    connect(btnClear, &QPushButton::clicked, &historyDlg, [this, model, showCount](){
+        try {
+            historyStore->clear();
+        } catch (const std::exception &e) {
+            QMessageBox::critical(this, "Calculation History", e.what());
         }
-        historyText->clear();
+        model->reload();
+        showCount();
     });
     layout->addWidget(btnClear);
 
     historyDlg.exec();
 }
 
+// Runs on the worker thread, so it measures labels with its own metrics.
+// Widths are remembered across trees, since most labels recur.
+static std::shared_ptr<const TreeLayout> buildLayout(const AST &tree, const QFont &font,
+                                                     std::unordered_map<std::string, double> &widths) {
+    STC_TRACE_SCOPE("layout");
+    QFontMetrics metrics(font);
+    if (widths.size() > (1 << 16)) widths.clear();
+    return std::make_shared<const TreeLayout>(tree, [&metrics, &widths](const std::string &label) {
+        auto [it, inserted] = widths.try_emplace(label, 0.0);
+        if (inserted) it->second = (double)metrics.horizontalAdvance(QString::fromStdString(label));
+        return it->second;
+    });
+}
+
 void MainWindow::onEqualPressed() {
     std::string text = display->text().toStdString();
     if (text.empty()) return;
 
-    try {
-        clearHistory();
-
-        AST* initialTree = new AST(text);
-        initialTree->buildTree();
+    previewTimer->stop();
+    clearHistory();
+    // One trace per expression; stepping through it records into the same one.
+    trace.reset();
+    trace = std::make_unique<TraceSession>();
+
+    QFont font = nodeFont;
+    bool exact = btnExact->isChecked();
+    startJob([this, text, font, exact](CancellationToken &token) -> std::function<void()> {
+        token.setPhase("Parsing");
+        // Nearly free when the live preview has just parsed the same text.
+        auto tree = std::make_shared<AST>(liveParser.parse(text));
+        token.setPhase("Scheduling");
+        auto steps = std::make_shared<AST::ReductionSchedule>(tree->reductionSchedule());
+        token.setPhase("Layout");
+        std::shared_ptr<const TreeLayout> layout = buildLayout(*tree, font, labelWidths);
+
+        // Formulas with variables can be drawn and stepped, but have no value.
+        bool hasValue = tree->getVariables().empty();
+        std::string result;
+        std::string error;
+        if (hasValue) {
+            token.setPhase("Evaluating");
+            try {
+                result = exact ? tree->calculateExact().toString() : QString::number(tree->calculate()).toStdString();
+            } catch (const OperationCancelled &) {
+                throw;
+            } catch (const std::exception &e) {
+                error = e.what();   // the tree is still drawn
+            }
+        }
 
-        history.push_back(initialTree);
-        currentStepIndex = 0;
+        return [this, text, tree, steps, layout, hasValue, result, error]() {
+            schedule = std::move(*steps);
+            history.assign(schedule.steps() + 1, nullptr);
+            layouts.assign(schedule.steps() + 1, nullptr);
+            history[0] = new AST(*tree);
+            layouts[0] = layout;
+            currentStepIndex = 0;
+
+            {
+                QSignalBlocker block(stepSlider);
+                stepSlider->setRange(0, (int)schedule.steps());
+                stepSlider->setValue(0);
+                stepSlider->setEnabled(schedule.steps() > 0);
+            }
+
+            updateVisualization();
+            previewLabel->clear();
+
+            if (!error.empty()) {
+                refreshStats();
+                display->setText("Error");
+                QMessageBox::critical(this, "Calculation Error", QString::fromStdString(error));
+            } else if (hasValue) {
+                QString resStr = QString::fromStdString(result);
+                display->setText(resStr);
+                saveToHistory(QString::fromStdString(text), resStr);
+            }
+        };
+    });
+}
 
-        updateVisualization();
+void MainWindow::onDisplayEdited() {
+    previewTimer->start();
+}
 
-        double result = initialTree->calculate();
-        QString resStr = QString::number(result);
-        display->setText(resStr);
+void MainWindow::updatePreview() {
+    std::string text = display->text().toStdString();
+    if (text.empty()) {
+        clearHistory();
+        previewLabel->clear();
+        return;
+    }
+    trace.reset();
+    trace = std::make_unique<TraceSession>();
+
+    QFont font = nodeFont;
+    bool exact = btnExact->isChecked();
+    startJob([this, text, font, exact](CancellationToken &token) -> std::function<void()> {
+        token.setPhase("Parsing");
+        std::shared_ptr<AST> tree;
+        try {
+            tree = std::make_shared<AST>(liveParser.parse(text));
+        } catch (const OperationCancelled &) {
+            throw;
+        } catch (const std::exception &e) {
+            // Half-typed input is expected here: keep the last tree and say why.
+            QString message = QString::fromStdString(e.what());
+            return [this, message]() { setPreview(message, true); };
+        }
+        token.setPhase("Layout");
+        std::shared_ptr<const TreeLayout> layout = buildLayout(*tree, font, labelWidths);
+
+        QString value;
+        bool failed = false;
+        if (tree->getVariables().empty() && tree->getRoot() != AST::NO_NODE) {
+            token.setPhase("Evaluating");
+            try {
+                value = "= " + (exact ? QString::fromStdString(tree->calculateExact().toString())
+                                      : QString::number(tree->calculate()));
+            } catch (const OperationCancelled &) {
+                throw;
+            } catch (const std::exception &e) {
+                value = QString::fromStdString(e.what());
+                failed = true;
+            }
+        }
 
-        // Save to file
-        saveToHistory(QString::fromStdString(text), resStr);
+        return [this, tree, layout, value, failed]() {
+            // The preview is step 0 with no schedule yet; "=" works out the steps.
+            resetSteps();
+            history.assign(1, new AST(*tree));
+            layouts.assign(1, layout);
+            currentStepIndex = 0;
+            drawTree(layout, false);
+            setPreview(value, failed);
+        };
+    });
+}
 
-    } catch (const std::exception &e) {
-         display->setText("Error");
-         QMessageBox::critical(this, "Calculation Error", e.what());
-    }
+void MainWindow::setPreview(const QString &text, bool failed) {
+    previewLabel->setStyleSheet(failed ? "color: #EF5350; font-size: 18px;" : "color: #9E9E9E; font-size: 18px;");
+    previewLabel->setText(text);
 }
 
 void MainWindow::onStepForward() {
     if (currentStepIndex < 0 || currentStepIndex >= (int)history.size()) return;
 
-    AST* currentTree = history[currentStepIndex];
-    AST* nextTree = new AST(*currentTree);
-
-    bool changed = nextTree->simplifyLowestLevel();
-
-    if (changed) {
-        while ((int)history.size() > currentStepIndex + 1) {
-            delete history.back();
-            history.pop_back();
-        }
-        history.push_back(nextTree);
-        currentStepIndex++;
-        updateVisualization();
+    if (currentStepIndex + 1 < (int)history.size()) {
+        showStep(currentStepIndex + 1);
+    } else if (schedule.failingStep) {
+        QMessageBox::critical(this, "Calculation Error", "Div by zero");
     } else {
-        delete nextTree;
         QMessageBox::information(this, "Finished", "The expression is fully simplified!");
     }
 }
 
 void MainWindow::onStepBack() {
     if (currentStepIndex > 0) {
-        currentStepIndex--;
-        updateVisualization();
+        showStep(currentStepIndex - 1);
     }
 }
 
-
-int MainWindow::getLeafCount(AST::BNode* node) {
-    if (!node) return 0;
-    if (!node->left && !node->right) return 1;
-    return (node->left ? getLeafCount(node->left) : 0) + (node->right ? getLeafCount(node->right) : 0);
+void MainWindow::onStepSliderMoved(int step) {
+    if (currentStepIndex < 0 || step == currentStepIndex) return;
+    showStep(step);
 }
 
-int MainWindow::calculateMaxNodeWidth(AST::BNode* node) {
-    if (!node) return 0;
-
-    QFont font("Arial", 12, QFont::Bold);
-    QFontMetrics fm(font);
-
-    QString labelStr;
-    if (node->data == "_NEG_") labelStr = "-";
-    else labelStr = QString::fromStdString(node->data);
+void MainWindow::showStep(int step) {
+    if (step < 0 || step >= (int)history.size()) return;
 
-    // Calculate text width + padding
-    int thisNodeWidth = fm.horizontalAdvance(labelStr) + 30;
+    stopJob();
+    if (history[step] && layouts[step]) {
+        currentStepIndex = step;
+        updateVisualization();
+        refreshStats();
+        return;
+    }
 
-    // Recurse
-    int maxChildWidth = 0;
-    if (node->left) maxChildWidth = std::max(maxChildWidth, calculateMaxNodeWidth(node->left));
-    if (node->right) maxChildWidth = std::max(maxChildWidth, calculateMaxNodeWidth(node->right));
+    // The worker only reads these; nothing else touches them until the job
+    // has finished or been stopped.
+    const AST *cached = history[step];
+    const AST *previous = step > 0 ? history[step - 1] : nullptr;
+    const AST *original = history[0];
+    const AST::ReductionSchedule *steps = &schedule;
+    std::shared_ptr<const TreeLayout> cachedLayout = layouts[step];
+    QFont font = nodeFont;
+
+    startJob([this, step, cached, previous, original, steps, cachedLayout, font](CancellationToken &token) -> std::function<void()> {
+        std::shared_ptr<AST> tree;
+        bool jumped = false;
+        if (!cached) {
+            token.setPhase("Simplifying");
+            if (previous) {
+                // Neighbouring step: path-copy from the cached tree.
+                tree = std::make_shared<AST>(*previous);
+                tree->simplifyLowestLevel();
+            } else {
+                // A jump: build the target straight from the schedule.
+                tree = std::make_shared<AST>(original->treeAtStep(*steps, step));
+                jumped = true;
+            }
+        }
+        std::shared_ptr<const TreeLayout> layout = cachedLayout;
+        if (!layout) {
+            token.setPhase("Layout");
+            layout = buildLayout(cached ? *cached : *tree, font, labelWidths);
+        }
 
-    return std::max(thisNodeWidth, maxChildWidth);
+        return [this, step, tree, jumped, layout]() {
+            if (jumped) {
+                // Drop cached steps other than the original.
+                for (int i = 1; i < (int)history.size(); ++i) {
+                    delete history[i];
+                    history[i] = nullptr;
+                }
+            }
+            if (tree) history[step] = new AST(*tree);
+            layouts[step] = layout;
+            currentStepIndex = step;
+            updateVisualization();
+        };
+    });
 }
 
-void MainWindow::updateVisualization() {
-    if (currentStepIndex < 0) return;
+void MainWindow::startJob(Job job) {
+    stopJob();
+    auto token = std::make_shared<CancellationToken>();
+    jobToken = token;
+    unsigned generation = ++jobGeneration;
+    TraceSession *session = trace.get();
+
+    worker = std::thread([this, token, generation, session, job = std::move(job)]() {
+        std::function<void()> apply;
+        std::string error;
+        try {
+            CancellationScope cancellation(*token);
+            TraceAttach attach(session);
+            apply = job(*token);
+        } catch (const OperationCancelled &) {
+        } catch (const std::exception &e) {
+            error = e.what();
+        }
+        // The window outlives the worker (stopJob joins it), so `this` is safe here.
+        QMetaObject::invokeMethod(this, [this, generation, apply, error]() {
+            finishJob(generation, apply, error);
+        }, Qt::QueuedConnection);
+    });
+    progressTimer->start();
+}
 
-    scene->clear();
-    AST* activeTree = history[currentStepIndex];
+void MainWindow::stopJob() {
+    if (jobToken) jobToken->cancel();
+    if (worker.joinable()) worker.join();
+    jobToken.reset();
+    ++jobGeneration;   // drops a result that is already queued
+    progressTimer->stop();
+    progressPanel->setVisible(false);
+}
 
-    int maxNodeW = calculateMaxNodeWidth(activeTree->getRoot());
-    double dynamicSpacing = std::max(70, maxNodeW + 20);
-    drawTreeRecursive(activeTree->getRoot(), 0, 0, dynamicSpacing);
-    view->centerOn(0, 0);
+void MainWindow::finishJob(unsigned generation, const std::function<void()> &apply, const std::string &error) {
+    if (generation != jobGeneration) return;
+    if (worker.joinable()) worker.join();
+    jobToken.reset();
+    progressTimer->stop();
+    progressPanel->setVisible(false);
+
+    if (!error.empty()) {
+        refreshStats();
+        display->setText("Error");
+        QMessageBox::critical(this, "Calculation Error", QString::fromStdString(error));
+        return;
+    }
+    if (apply) apply();   // null when the job was cancelled
+    refreshStats();
+}
 
-    btnStepBack->setEnabled(currentStepIndex > 0);
-    btnStepForward->setEnabled(true);
+void MainWindow::onCancelPressed() {
+    if (jobToken) jobToken->cancel();
 }
 
-void MainWindow::drawTreeRecursive(AST::BNode* node, double x, double y, double spacing) {
-    if (!node) return;
+void MainWindow::updateProgress() {
+    if (!jobToken) return;
+    progressPanel->setVisible(true);
+    progressLabel->setText(jobToken->phase());
+    // An empty range shows a busy bar until the phase reports progress.
+    double fraction = jobToken->progress();
+    progressBar->setRange(0, fraction > 0 ? 1000 : 0);
+    progressBar->setValue((int)(fraction * 1000));
+}
 
-    QString labelStr;
-    if (node->data == "_NEG_") {
-        labelStr = "-";
-    } else {
-        labelStr = QString::fromStdString(node->data);
+void MainWindow::refreshStats() {
+    statsTree->clear();
+    if (!TraceSession::enabled) {
+        new QTreeWidgetItem(statsTree, {"Instrumentation is disabled in this build"});
+        return;
     }
+    if (!trace) return;
 
-    QFont font("Arial", 12, QFont::Bold);
-    QFontMetrics fm(font);
-    int textWidth = fm.horizontalAdvance(labelStr);
-
-    // Dynamic Circle Size
-    int nodeSize = std::max(50, textWidth + 20);
-    int verticalGap = 100;
-
-    // --- Children Layout ---
-    std::vector<AST::BNode*> children;
-    if (node->left) children.push_back(node->left);
-    if (node->right) children.push_back(node->right);
-
-    double totalWidth = 0;
-    std::vector<double> childWidths;
-    for (auto child : children) {
-        double w = getLeafCount(child) * spacing;
-        if (w < spacing) w = spacing;
-        childWidths.push_back(w);
-        totalWidth += w;
+    for (const TraceSession::Summary &phase : trace->summary()) {
+        QString name = QString(phase.level * 2, ' ') + phase.name;
+        new QTreeWidgetItem(statsTree, {name, QString::number(phase.calls),
+                                        QString::number(phase.totalNs / 1e6, 'f', 3),
+                                        QString::number(phase.allocations)});
+    }
+    // Counters describe the tree that was parsed.
+    for (const char *counter : {"nodes", "depth", "steps"}) {
+        double value = trace->counterValue(counter, -1);
+        if (value >= 0) new QTreeWidgetItem(statsTree, {QString(counter), "", QString::number(value, 'f', 0), ""});
     }
+}
 
-    double currentChildX = x - (totalWidth / 2.0);
-    for (int i = 0; i < children.size(); ++i) {
-        double childRealX = currentChildX + (childWidths[i] / 2.0);
+void MainWindow::exportTrace() {
+    if (!trace) {
+        QMessageBox::information(this, "Export Trace", "Evaluate an expression first.");
+        return;
+    }
+    QString path = QFileDialog::getSaveFileName(this, "Export Trace", "stc-trace.json", "Chrome trace (*.json)");
+    if (path.isEmpty()) return;
+    try {
+        trace->writeChromeTrace(path.toStdString());
+    } catch (const std::exception &e) {
+        QMessageBox::critical(this, "Export Trace", e.what());
+    }
+}
 
-        QGraphicsLineItem *line = scene->addLine(x, y + nodeSize/2, childRealX, y + verticalGap - nodeSize/2);
-        line->setPen(QPen(QColor("#555"), 2));
-        line->setZValue(0);
 
-        drawTreeRecursive(children[i], childRealX, y + verticalGap, spacing);
-        currentChildX += childWidths[i];
+void MainWindow::drawTree(const std::shared_ptr<const TreeLayout> &layout, bool recentre) {
+    // One item paints the whole tree, drawing only what is in view. It is
+    // reused for the next tree, which repaints in place.
+    if (treeItem) {
+        treeItem->setLayout(layout);
+    } else {
+        treeItem = new TreeItem(layout, nodeFont);
+        scene->addItem(treeItem);
     }
+    scene->setSceneRect(treeItem->boundingRect());
+    if (recentre) view->centerOn(0, 0);
+}
 
-    QGraphicsEllipseItem *circle = scene->addEllipse(x - nodeSize/2, y - nodeSize/2, nodeSize, nodeSize);
-    circle->setBrush(QBrush(QColor("#00E5FF")));
-    circle->setPen(QPen(Qt::white, 2));
-    circle->setZValue(10);
+void MainWindow::updateVisualization() {
+    if (currentStepIndex < 0 || !layouts[currentStepIndex]) return;
+    STC_TRACE_SCOPE("updateVisualization");
 
-    QGraphicsTextItem *text = scene->addText(labelStr);
-    text->setDefaultTextColor(Qt::black);
-    text->setFont(font);
+    drawTree(layouts[currentStepIndex], true);
 
-    QRectF textRect = text->boundingRect();
-    text->setPos(x - textRect.width()/2, y - textRect.height()/2);
-    text->setZValue(11);
-}
+    btnStepBack->setEnabled(currentStepIndex > 0);
+    btnStepForward->setEnabled(true);
 
+    QSignalBlocker block(stepSlider);
+    stepSlider->setValue(currentStepIndex);
+    stepLabel->setText(QString("Step %1 / %2").arg(currentStepIndex).arg(schedule.steps()));
+}
@@ -0,0 +1,461 @@
+#include "ExpressionCache.h"
+#include "ServerProtocol.h"
+#include "ThreadPool.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Local evaluation server. One epoll loop owns every socket; each request
+// frame is evaluated on the thread pool and its response is queued back to
+// the loop through an eventfd. Expressions are compiled once and shared
+// across clients through an ExpressionCache. See ServerProtocol.h for the
+// wire format.
+
+static const size_t READ_CHUNK = 64 * 1024;
+// A connection stops being read while this many frames are in flight or
+// this many response bytes are unsent, so a fast sender cannot exhaust memory.
+static const size_t MAX_PIPELINE = 1024;
+static const size_t MAX_BUFFERED_OUTPUT = 16 << 20;
+static const size_t GRAIN_EXPRESSIONS = 256;
+
+// epoll user data for the non-connection descriptors.
+static const uint64_t LISTENER_ID = 0, WAKE_ID = 1, SIGNAL_ID = 2, FIRST_CONNECTION_ID = 3;
+
+static void printUsage(const char* prog) {
+    cerr << "Usage: " << prog << " [--port n | --unix path] [-j threads] [--cache entries] [--max-depth n]\n"
+         << "Evaluates length-prefixed batches of expressions for local clients.\n"
+         << "Listens on 127.0.0.1:7878 by default; stop with Ctrl+C.\n";
+}
+
+static sigset_t stopSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    return signals;
+}
+
+// A request being evaluated; the response is complete once `done` is set.
+struct Frame {
+    string payload;
+    string response;
+    atomic<bool> done{false};
+};
+
+struct Connection {
+    int fd = -1;
+    string input;
+    size_t inputStart = 0;      // bytes of `input` already consumed
+    string output;
+    size_t outputSent = 0;
+    deque<shared_ptr<Frame>> inFlight;   // request order
+    uint32_t events = 0;        // current epoll interest
+    bool readClosed = false;
+};
+
+class Server {
+public:
+    Server(size_t workers, size_t cacheEntries, size_t maxDepth)
+        : cache(cacheEntries, maxDepth), nextId(FIRST_CONNECTION_ID), outstanding(0),
+          connectionsServed(0), framesServed(0), expressionsServed(0), pool(workers) {}
+
+    ~Server() {
+        // run() may have thrown with frames in flight; workers still write to wakeFd.
+        while (outstanding.load() > 0) this_thread::sleep_for(chrono::milliseconds(1));
+        for (auto& [id, conn] : connections) close(conn->fd);
+        if (listener >= 0) close(listener);
+        if (wakeFd >= 0) close(wakeFd);
+        if (signalFd >= 0) close(signalFd);
+        if (epollFd >= 0) close(epollFd);
+    }
+
+    void listenTcp(uint16_t port) {
+        listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listener < 0) throw runtime_error(string("Error: socket: ") + strerror(errno));
+        int one = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+            throw runtime_error("Error: Cannot bind 127.0.0.1:" + to_string(port) + ": " + strerror(errno));
+        }
+        tcp = true;
+        startListening();
+    }
+
+    void listenUnix(const string& path) {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof addr.sun_path) throw runtime_error("Error: Socket path too long.");
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listener < 0) throw runtime_error(string("Error: socket: ") + strerror(errno));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        unlink(path.c_str());
+        if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+            throw runtime_error("Error: Cannot bind '" + path + "': " + strerror(errno));
+        }
+        startListening();
+    }
+
+    // Serves until SIGINT or SIGTERM.
+    void run() {
+        epoll_event events[256];
+        bool stopping = false;
+        while (!stopping) {
+            int ready = epoll_wait(epollFd, events, 256, -1);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error(string("Error: epoll_wait: ") + strerror(errno));
+            }
+            for (int i = 0; i < ready; ++i) {
+                uint64_t id = events[i].data.u64;
+                if (id == LISTENER_ID) acceptAll();
+                else if (id == WAKE_ID) deliverCompleted();
+                else if (id == SIGNAL_ID) stopping = true;
+                else serviceConnection(id, events[i].events);
+            }
+        }
+        // Workers still refer to the cache; let them finish first.
+        while (outstanding.load() > 0) this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    void printStats() const {
+        cerr << connectionsServed << " connections, " << framesServed << " frames, " << expressionsServed
+             << " expressions, cache " << cache.hits() << " hits / " << cache.misses() << " misses\n";
+    }
+
+private:
+    ExpressionCache cache;
+    int epollFd = -1, listener = -1, wakeFd = -1, signalFd = -1;
+    bool tcp = false;
+    unordered_map<uint64_t, unique_ptr<Connection>> connections;
+    uint64_t nextId;
+    atomic<size_t> outstanding;
+
+    // Connections with newly finished frames, filled by workers.
+    mutex completedLock;
+    vector<uint64_t> completed;
+
+    // Workers count frames under statsLock; the totals are read once the loop stops.
+    mutex statsLock;
+    size_t connectionsServed, framesServed, expressionsServed;
+
+    // Declared last, so its workers are joined before the members they use
+    // are destroyed.
+    ThreadPool pool;
+
+    void startListening() {
+        if (listen(listener, SOMAXCONN) != 0) throw runtime_error(string("Error: listen: ") + strerror(errno));
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        sigset_t signals = stopSignals();
+        signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0 || signalFd < 0) throw runtime_error(string("Error: ") + strerror(errno));
+        watch(listener, EPOLLIN, LISTENER_ID, EPOLL_CTL_ADD);
+        watch(wakeFd, EPOLLIN, WAKE_ID, EPOLL_CTL_ADD);
+        watch(signalFd, EPOLLIN, SIGNAL_ID, EPOLL_CTL_ADD);
+    }
+
+    void watch(int fd, uint32_t events, uint64_t id, int op) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = id;
+        if (epoll_ctl(epollFd, op, fd, &ev) != 0) throw runtime_error(string("Error: epoll_ctl: ") + strerror(errno));
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;   // EAGAIN, or a connection that went away
+            if (tcp) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            }
+            auto conn = make_unique<Connection>();
+            conn->fd = fd;
+            conn->events = EPOLLIN;
+            uint64_t id = nextId++;
+            watch(fd, conn->events, id, EPOLL_CTL_ADD);
+            connections.emplace(id, move(conn));
+            ++connectionsServed;
+        }
+    }
+
+    void serviceConnection(uint64_t id, uint32_t events) {
+        auto it = connections.find(id);
+        if (it == connections.end()) return;
+        Connection& conn = *it->second;
+        // A hung-up peer can no longer receive responses.
+        if (events & (EPOLLERR | EPOLLHUP)) return closeConnection(id);
+        if (events & EPOLLIN) {
+            if (!readInput(id, conn)) return closeConnection(id);
+        }
+        if (!writeOutput(conn)) return closeConnection(id);
+        updateInterest(id, conn);
+    }
+
+    // Reads what is available and dispatches complete frames; false on a
+    // protocol error.
+    bool readInput(uint64_t id, Connection& conn) {
+        char buffer[READ_CHUNK];
+        while (!conn.readClosed && wantsInput(conn)) {
+            ssize_t n = read(conn.fd, buffer, sizeof buffer);
+            if (n > 0) {
+                conn.input.append(buffer, size_t(n));
+                if (!dispatchFrames(id, conn)) return false;
+            } else if (n == 0) {
+                conn.readClosed = true;
+            } else {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool wantsInput(const Connection& conn) const {
+        return conn.inFlight.size() < MAX_PIPELINE && conn.output.size() - conn.outputSent < MAX_BUFFERED_OUTPUT;
+    }
+
+    bool dispatchFrames(uint64_t id, Connection& conn) {
+        while (true) {
+            const char* data = conn.input.data() + conn.inputStart;
+            size_t available = conn.input.size() - conn.inputStart;
+            size_t size;
+            try {
+                size = ServerProtocol::frameSize(data, available);
+            } catch (const exception&) {
+                return false;
+            }
+            if (size == 0 || size > available) break;
+
+            auto frame = make_shared<Frame>();
+            frame->payload.assign(data + ServerProtocol::HEADER_BYTES, size - ServerProtocol::HEADER_BYTES);
+            conn.inputStart += size;
+            conn.inFlight.push_back(frame);
+            outstanding.fetch_add(1);
+            pool.post([this, id, frame]() { evaluate(id, *frame); });
+        }
+        // Drop consumed bytes once they dominate the buffer.
+        if (conn.inputStart > conn.input.size() / 2) {
+            conn.input.erase(0, conn.inputStart);
+            conn.inputStart = 0;
+        }
+        return true;
+    }
+
+    // Runs on a worker.
+    void evaluate(uint64_t id, Frame& frame) {
+        uint32_t requestId = 0;
+        vector<string_view> expressions;
+        bool valid = true;
+        try {
+            ServerProtocol::parseRequest(frame.payload, requestId, expressions);
+        } catch (const exception&) {
+            valid = false;
+        }
+
+        if (valid) {
+            // Results are serialized per grain and concatenated in order.
+            size_t grains = (expressions.size() + GRAIN_EXPRESSIONS - 1) / GRAIN_EXPRESSIONS;
+            vector<string> parts(grains);
+            pool.parallelFor(expressions.size(), GRAIN_EXPRESSIONS, [&](size_t begin, size_t end) {
+                string& out = parts[begin / GRAIN_EXPRESSIONS];
+                for (size_t i = begin; i < end; ++i) appendResult(out, expressions[i]);
+            });
+            size_t start = ServerProtocol::beginResponse(frame.response, requestId, uint32_t(expressions.size()));
+            for (const string& part : parts) frame.response += part;
+            ServerProtocol::finishFrame(frame.response, start);
+            framesDone(expressions.size());
+        }
+        // An empty response on a malformed frame tells the loop to close.
+        frame.payload = string();
+        frame.done.store(true, memory_order_release);
+        {
+            lock_guard<mutex> guard(completedLock);
+            completed.push_back(id);
+        }
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof one);
+        (void)ignored;
+        outstanding.fetch_sub(1);
+    }
+
+    void appendResult(string& out, string_view expression) {
+        shared_ptr<const ExpressionCache::Entry> entry = cache.get(expression);
+        string message = entry->error;
+        if (entry->program && !entry->variables.empty()) {
+            // Requests carry no values; report it as AST::calculate() does.
+            message = "Error: Unbound variable '" + entry->variables[0] + "'.";
+        } else if (entry->program) {
+            try {
+                ServerProtocol::appendValue(out, entry->program->evaluate());
+                return;
+            } catch (const exception& e) {
+                message = e.what();
+            }
+        }
+        // Same text as Syntax_Tree_Batch prints.
+        if (message.compare(0, 5, "Error") == 0) ServerProtocol::appendError(out, message);
+        else ServerProtocol::appendError(out, "Error: " + message);
+    }
+
+    void framesDone(size_t expressions) {
+        lock_guard<mutex> guard(statsLock);
+        ++framesServed;
+        expressionsServed += expressions;
+    }
+
+    void deliverCompleted() {
+        uint64_t count;
+        ssize_t ignored = read(wakeFd, &count, sizeof count);
+        (void)ignored;
+        vector<uint64_t> ids;
+        {
+            lock_guard<mutex> guard(completedLock);
+            ids.swap(completed);
+        }
+        for (uint64_t id : ids) {
+            auto it = connections.find(id);
+            if (it == connections.end()) continue;
+            Connection& conn = *it->second;
+            bool broken = false;
+            while (!conn.inFlight.empty() && conn.inFlight.front()->done.load(memory_order_acquire)) {
+                Frame& frame = *conn.inFlight.front();
+                if (frame.response.empty()) broken = true;
+                conn.output += frame.response;
+                conn.inFlight.pop_front();
+            }
+            if (broken || !writeOutput(conn)) {
+                closeConnection(id);
+                continue;
+            }
+            // Reading may have paused for backpressure; pick it up again.
+            if (!readInput(id, conn) || !writeOutput(conn)) {
+                closeConnection(id);
+                continue;
+            }
+            updateInterest(id, conn);
+        }
+    }
+
+    // Writes as much pending output as the socket takes; false on error.
+    bool writeOutput(Connection& conn) {
+        while (conn.outputSent < conn.output.size()) {
+            ssize_t n = send(conn.fd, conn.output.data() + conn.outputSent, conn.output.size() - conn.outputSent,
+                             MSG_NOSIGNAL);
+            if (n > 0) {
+                conn.outputSent += size_t(n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return true;
+            } else {
+                return false;
+            }
+        }
+        conn.output.clear();
+        conn.outputSent = 0;
+        return true;
+    }
+
+    void updateInterest(uint64_t id, Connection& conn) {
+        bool unsent = conn.outputSent < conn.output.size();
+        if (conn.readClosed && conn.inFlight.empty() && !unsent) return closeConnection(id);
+        uint32_t events = 0;
+        if (!conn.readClosed && wantsInput(conn)) events |= EPOLLIN;
+        if (unsent) events |= EPOLLOUT;
+        if (events != conn.events) {
+            watch(conn.fd, events, id, EPOLL_CTL_MOD);
+            conn.events = events;
+        }
+    }
+
+    void closeConnection(uint64_t id) {
+        auto it = connections.find(id);
+        if (it == connections.end()) return;
+        // Frames still on the pool finish into shared Frames nobody reads.
+        close(it->second->fd);
+        connections.erase(it);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    size_t threads = 0;
+    size_t cacheEntries = 1 << 16;
+    size_t maxDepth = AST::DEFAULT_MAX_DEPTH;
+    long port = 7878;
+    const char* unixPath = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+            port = strtol(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--unix") && i + 1 < argc) {
+            unixPath = argv[++i];
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--cache") && i + 1 < argc) {
+            cacheEntries = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--max-depth") && i + 1 < argc) {
+            maxDepth = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            printUsage(argv[0]);
+            return 0;
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (port <= 0 || port > 65535) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    // Blocked before any worker starts, so the stop signals only ever arrive
+    // through the loop's signalfd.
+    sigset_t signals = stopSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    // The loop thread only does I/O, so every worker evaluates.
+    size_t workers = threads ? threads : ThreadPool::defaultWorkerCount() + 1;
+    try {
+        Server server(workers, cacheEntries, maxDepth);
+        if (unixPath) server.listenUnix(unixPath);
+        else server.listenTcp(static_cast<uint16_t>(port));
+        cerr << "Listening on " << (unixPath ? string(unixPath) : "127.0.0.1:" + to_string(port)) << " with "
+             << workers << " workers\n";
+        server.run();
+        server.printStats();
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    if (unixPath) unlink(unixPath);
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include "AST.h"
+#include "JitProgram.h"
+#include "Program.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Generates random expressions and checks that JitProgram, the bytecode
+// interpreter and AST::calculate() agree bit for bit, for the parsed tree and
+// for its optimize() result. Run with an optional seed and iteration count.
+
+static const char* const NUMBERS[] = {"0", "1", "2", "0.5", "3.25", "100", "0.1"};
+static const char* const NAMES[] = {"x", "y", "z", "w"};
+static const double VALUES[] = {0.0, 1.0, -2.0, 0.5, 3.0, 1e300, -0.0};
+
+struct Generator {
+    mt19937_64 rng;
+    vector<string> shared;   // earlier subexpressions, repeated for optimize()
+
+    explicit Generator(uint64_t seed) : rng(seed) {}
+
+    string leaf() {
+        if (rng() % 2) return NUMBERS[rng() % size(NUMBERS)];
+        return NAMES[rng() % size(NAMES)];
+    }
+
+    // A right-nested chain such as a-(b*(c+(...))) keeps one value per level
+    // on the stack, deep enough to spill out of the registers.
+    string chain(size_t length) {
+        string s, close;
+        for (size_t i = 0; i < length; ++i) {
+            s += leaf();
+            s += "+-*/"[rng() % 4];
+            s += '(';
+            close += ')';
+        }
+        return s + leaf() + close;
+    }
+
+    string expression(int depth) {
+        if (depth <= 0) return leaf();
+        switch (rng() % 12) {
+            case 0: return leaf();
+            case 1: return "-" + expression(depth - 1);
+            case 2: return "(" + expression(depth - 1) + ")";
+            case 3:
+                if (!shared.empty()) return "(" + shared[rng() % shared.size()] + ")";
+                return leaf();
+            case 4:
+                if (rng() % 4 == 0) return chain(10 + rng() % 20);
+                return leaf();
+            case 5:
+                // Calls are interpreted even when the rest could be native.
+                if (rng() % 4 == 0) {
+                    static const char* const CALLS[] = {"sqrt(", "abs(", "min(", "max("};
+                    size_t which = rng() % size(CALLS);
+                    string arguments = expression(depth - 1);
+                    if (which >= 2) arguments += "," + expression(depth - 1);
+                    return CALLS[which] + arguments + ")";
+                }
+                return expression(depth - 1) + (rng() % 2 ? "%" : "^") + leaf();
+            default: {
+                string s = expression(depth - 1) + "+-*/"[rng() % 4] + expression(depth - 1);
+                if (rng() % 3 == 0) {
+                    if (shared.size() == 8) shared[rng() % 8] = s;
+                    else shared.push_back(s);
+                }
+                return s;
+            }
+        }
+    }
+};
+
+// What a single evaluation produced: a value or an error message.
+struct Outcome {
+    double value = 0;
+    string error;
+
+    bool operator==(const Outcome& other) const {
+        if (error != other.error) return false;
+        if (!error.empty()) return true;
+        return memcmp(&value, &other.value, sizeof value) == 0 || (isnan(value) && isnan(other.value));
+    }
+};
+
+template <typename Evaluate>
+static Outcome outcome(Evaluate&& evaluate) {
+    Outcome result;
+    try {
+        result.value = evaluate();
+    } catch (const exception& e) {
+        result.error = e.what();
+    }
+    return result;
+}
+
+static string describe(const Outcome& o) {
+    if (!o.error.empty()) return o.error;
+    char text[64];
+    snprintf(text, sizeof text, "%.17g", o.value);
+    return text;
+}
+
+// Paths of the generated code the corpus has to reach.
+struct Coverage {
+    size_t native = 0;
+    size_t variables = 0;     // LoadVar
+    size_t temporaries = 0;   // Store and LoadTemp
+    size_t spills = 0;        // deeper than the register stack
+    size_t nanExits = 0;      // division by zero re-run by the interpreter
+    size_t calls = 0;         // interpreted because of a call
+};
+
+static bool check(const AST& tree, const double* values, const string& text, const char* what, Coverage& coverage) {
+    AST copy(tree);
+    Outcome expected = outcome([&] { return copy.calculate(values); });
+    Program program = tree.compile();
+    JitProgram jit(program);
+    Outcome interpreted = outcome([&] { return program.evaluate(values); });
+    Outcome generated = outcome([&] { return jit.evaluate(values); });
+    if (!(interpreted == expected) || !(generated == expected)) {
+        fprintf(stderr, "FAIL (%s) %s\n  calculate()  %s\n  interpreter  %s\n  JIT (%s)   %s\n", what, text.c_str(),
+                describe(expected).c_str(), describe(interpreted).c_str(), jit.isNative() ? "native" : "interpreted",
+                describe(generated).c_str());
+        return false;
+    }
+
+    bool calls = false;
+    for (const Program::Instr& in : program.code()) {
+        calls = calls || in.op == Program::Op::Call1 || in.op == Program::Op::Call2;
+    }
+    if (calls) {
+        ++coverage.calls;
+        if (jit.isNative()) {
+            fprintf(stderr, "FAIL (%s) %s\n  a program with calls was compiled to native code\n", what, text.c_str());
+            return false;
+        }
+    }
+    if (!jit.isNative()) return true;
+    ++coverage.native;
+    if (program.variables()) ++coverage.variables;
+    if (program.temporaries()) ++coverage.temporaries;
+    if (program.stackDepth() - program.temporaries() > 14) ++coverage.spills;
+    if (expected.error == "Div by zero") {
+        // The generated function cannot throw; it returns NaN instead.
+        double raw = jit.function()(values);
+        if (!isnan(raw)) {
+            fprintf(stderr, "FAIL (%s) %s\n  native code returned %.17g for a division by zero\n", what, text.c_str(), raw);
+            return false;
+        }
+        ++coverage.nanExits;
+    }
+    return true;
+}
+
+// Values in the order of tree.getVariables().
+static vector<double> valuesFor(const AST& tree, const double* byName) {
+    vector<double> values;
+    for (const string& name : tree.getVariables()) {
+        for (size_t i = 0; i < size(NAMES); ++i) {
+            if (name == NAMES[i]) values.push_back(byName[i]);
+        }
+    }
+    return values;
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t seed = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1;
+    size_t iterations = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000;
+
+    Generator generator(seed);
+    Coverage coverage;
+    size_t failures = 0;
+    for (size_t i = 0; i < iterations && failures < 10; ++i) {
+        string text = generator.expression(1 + generator.rng() % 6);
+        double byName[size(NAMES)];
+        for (double& v : byName) v = VALUES[generator.rng() % size(VALUES)];
+
+        AST tree(text);
+        if (!check(tree, valuesFor(tree, byName).data(), text, "parsed", coverage)) ++failures;
+        AST optimized = tree.optimize();
+        if (!check(optimized, valuesFor(optimized, byName).data(), text, "optimized", coverage)) ++failures;
+    }
+
+    printf("%zu expressions, %zu native: %zu with variables, %zu with temporaries, %zu spilling, "
+           "%zu division-by-zero exits, %zu interpreted for calls\n",
+           iterations, coverage.native, coverage.variables, coverage.temporaries, coverage.spills,
+           coverage.nanExits, coverage.calls);
+    if (failures) {
+        fprintf(stderr, "%zu mismatches\n", failures);
+        return 1;
+    }
+    if (JitProgram::supported() && (!coverage.variables || !coverage.temporaries || !coverage.spills
+                                    || !coverage.nanExits || !coverage.calls)) {
+        fprintf(stderr, "The corpus missed a code path of the JIT; raise the iteration count.\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include "AST.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Tokenizes random and edge-case inputs under each STC_SIMD cap and checks
+// that the scalar, SSE2 and AVX2 lexers agree on every token's kind,
+// operator, span and value bits, and on the error text. The lexer is picked
+// once per process, so the test reruns itself with --dump under each cap.
+// Run with an optional seed and count of random inputs.
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+static void setCap(const char* cap) { _putenv_s("STC_SIMD", cap); }
+#else
+static void setCap(const char* cap) { setenv("STC_SIMD", cap, 1); }
+#endif
+
+// AST::tokenize is private; AST befriends this name for the benchmarks.
+struct AstStages {
+    static void tokenize(string_view text, AST::TokenArray& tokens) { AST::tokenize(text, tokens); }
+};
+
+static const char* const CAPS[] = {"scalar", "sse2", "avx2"};
+
+// Tokens that must survive being cut by a 16- or 32-byte load, a 64-byte
+// block or a batch of blocks.
+static const char* const PIECES[] = {"12345.678", "abc_DEF9", "max(x,y)", "1.2.3", "2^-3%4", "$", "\x80", "\xff"};
+static const size_t BOUNDARIES[] = {16, 32, 48, 64, 128, 4096};
+static const char* const INVALID[] = {"$", "#", "@", "~", "\"", "\x80", "\xff", "\x01"};
+
+// Mostly well-formed tokens, with blank runs that shift them across the
+// boundaries and the odd stray byte that makes a malformed number.
+static string randomToken(mt19937_64& rng) {
+    static const char LETTERS[] = "abcxyzXZ_";
+    static const char ANY[] = "0123456789.abcxyzXZ_+-*/%^(),";
+    string token;
+    switch (rng() % 16) {
+        case 0: case 1:
+            token.assign(1 + rng() % (rng() % 8 ? 8 : 40), '0');
+            for (char& c : token) c += char(rng() % 10);
+            if (rng() % 2) token.insert(rng() % (token.size() + 1), ".");
+            return rng() % 4 ? token + " " : token;
+        case 2:
+            for (size_t n = 1 + rng() % 6; n--;) token += LETTERS[rng() % (sizeof(LETTERS) - 1)];
+            if (rng() % 2) token += char('0' + rng() % 10);
+            return token;
+        case 3: case 4: case 5: case 6: case 7: case 8:
+            return string(1, "+-*/%^(),"[rng() % 9]);
+        case 9: case 10:
+            return string(rng() % 2 ? 1 : rng() % 70, " \t\n\r"[rng() % 4]);
+        case 11: case 12: case 13: case 14:
+            return " ";
+        default:
+            return string(1, ANY[rng() % (sizeof(ANY) - 1)]);
+    }
+}
+
+static vector<string> corpus(uint64_t seed, size_t randomInputs) {
+    vector<string> inputs = {"", " ", "1", "x", ".", "..", "_", "1.", ".5", "1.2.3", "a1b2", "1e5", "sin(x)", " \t\r\n",
+                             "((((((((((((((((((((((((((((((((", "-1--2", "x,y", string(1, '\0'), string("1\0" "2", 3)};
+    for (size_t boundary : BOUNDARIES) {
+        for (size_t at = boundary - 9; at <= boundary + 1; ++at) {
+            for (const char* piece : PIECES) {
+                inputs.push_back(string(at, ' ') + piece + " 1");
+                string busy;
+                while (busy.size() < at) busy += "a+";
+                busy.resize(at);
+                inputs.push_back(busy + piece);
+            }
+        }
+    }
+
+    // Digit runs around the 15-digit fast path of parseNumber() and past a block.
+    for (size_t n : {14, 15, 16, 17, 18, 22, 31, 32, 33, 63, 64, 65, 100, 4100}) {
+        string digits(n, '7');
+        inputs.push_back(digits);
+        inputs.push_back("1." + digits);
+        inputs.push_back(digits + ".5");
+        inputs.push_back("0." + string(n, '0') + "1");
+        inputs.push_back(string(n / 2, ' ') + digits + "+x");
+        string dotted = digits;
+        dotted[n / 2] = '.';
+        inputs.push_back(dotted);
+        dotted[n / 3] = '.';
+        inputs.push_back(dotted);
+    }
+
+    mt19937_64 rng(seed);
+    for (size_t i = 0; i < randomInputs; ++i) {
+        size_t length = i % 50 == 0 ? 4000 + rng() % 300 : rng() % 300;
+        string s;
+        while (s.size() < length) s += randomToken(rng);
+        if (rng() % 4 == 0) s.insert(rng() % (s.size() + 1), INVALID[rng() % size(INVALID)]);
+        inputs.push_back(s);
+    }
+    return inputs;
+}
+
+// Printable ASCII only, so the dumps compare as lines of text.
+static string escape(string_view text) {
+    string out;
+    for (unsigned char c : text) {
+        if (c >= 0x20 && c < 0x7f && c != '\\') {
+            out += char(c);
+        } else {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\x%02x", c);
+            out += hex;
+        }
+    }
+    return out;
+}
+
+// One line per input: its tokens, or the error it threw.
+static int dump(const vector<string>& inputs) {
+    printf("%s\n", AST::lexerName());
+    for (const string& input : inputs) {
+        AST::TokenArray tokens;
+        try {
+            AstStages::tokenize(input, tokens);
+        } catch (const exception& e) {
+            printf("error %s\n", escape(e.what()).c_str());
+            continue;
+        }
+        for (size_t i = 0; i < tokens.size; ++i) {
+            const AST::Token& t = tokens.data[i];
+            uint64_t bits;
+            memcpy(&bits, &t.value, sizeof(bits));
+            printf("%d:%d:%zu:%zu:%llx ", int(t.kind), int(t.op), size_t(t.text.data() - input.data()), t.text.size(),
+                   (unsigned long long)bits);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+static bool run(const string& command, const char* cap, vector<string>& lines) {
+    setCap(cap);
+    FILE* out = popen(command.c_str(), "r");
+    if (!out) return false;
+    string line;
+    for (int c; (c = fgetc(out)) != EOF;) {
+        if (c != '\n') {
+            line += char(c);
+        } else {
+            lines.push_back(move(line));
+            line.clear();
+        }
+    }
+    return pclose(out) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    bool dumping = argc > 1 && strcmp(argv[1], "--dump") == 0;
+    int first = dumping ? 2 : 1;
+    uint64_t seed = argc > first ? strtoull(argv[first], nullptr, 10) : 1;
+    size_t randomInputs = argc > first + 1 ? strtoull(argv[first + 1], nullptr, 10) : 5000;
+    vector<string> inputs = corpus(seed, randomInputs);
+    if (dumping) return dump(inputs);
+
+    string command = string("\"") + argv[0] + "\" --dump " + to_string(seed) + " " + to_string(randomInputs);
+    vector<string> dumps[size(CAPS)];
+    for (size_t i = 0; i < size(CAPS); ++i) {
+        if (!run(command, CAPS[i], dumps[i]) || dumps[i].size() != inputs.size() + 1) {
+            fprintf(stderr, "FAIL STC_SIMD=%s: the --dump run did not finish\n", CAPS[i]);
+            return 1;
+        }
+    }
+
+    size_t failures = 0, errors = 0;
+    for (size_t k = 0; k < inputs.size(); ++k) {
+        const string& expected = dumps[0][k + 1];
+        if (expected.compare(0, 6, "error ") == 0) ++errors;
+        for (size_t i = 1; i < size(CAPS) && failures < 10; ++i) {
+            const string& actual = dumps[i][k + 1];
+            if (actual == expected) continue;
+            ++failures;
+            fprintf(stderr, "FAIL (%s lexer) %s\n  scalar: %s\n  %s: %s\n", dumps[i][0].c_str(),
+                    escape(inputs[k].substr(0, 200)).c_str(), expected.substr(0, 400).c_str(), dumps[i][0].c_str(),
+                    actual.substr(0, 400).c_str());
+        }
+    }
+
+    printf("%zu inputs, %zu errors, lexers %s/%s/%s\n", inputs.size(), errors, dumps[0][0].c_str(),
+           dumps[1][0].c_str(), dumps[2][0].c_str());
+    if (failures) {
+        fprintf(stderr, "%zu mismatches\n", failures);
+        return 1;
+    }
+    return 0;
+}
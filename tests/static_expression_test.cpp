@@ -0,0 +1,111 @@
+#include "AST.h"
+#include "StaticExpression.h"
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+
+using namespace std;
+
+// StaticExpression.h is header-only, so this file is what compiles it in the
+// build. Most checks are static_asserts; main() compares the runtime
+// evaluators with AST::calculate().
+
+// True if the literal parses at compile time; a malformed one is a
+// substitution failure here instead of a hard error.
+template <FixedString Source>
+concept Parses = requires {
+    typename integral_constant<int, (StaticParser::parse<sizeof(Source.text)>(Source.view()), 0)>;
+};
+
+template <FixedString Source>
+constexpr bool isConstant = decltype(staticExpression<Source>)::isConstant;
+
+// Precedence and associativity.
+static_assert(staticExpression<"1+2*3">() == 7);
+static_assert(staticExpression<"(1+2)*3">() == 9);
+static_assert(staticExpression<"10-4-3">() == 3);
+static_assert(staticExpression<"8/4/2">() == 1);
+static_assert(staticExpression<"2*3-8/4">() == 4);
+
+// Unary minus.
+static_assert(staticExpression<"-2*3">() == -6);
+static_assert(staticExpression<"2*-3">() == -6);
+static_assert(staticExpression<"--5">() == 5);
+static_assert(staticExpression<"-(1+2)">() == -3);
+static_assert(staticExpression<"1--1">() == 2);
+
+// Literals round like from_chars.
+static_assert(staticExpression<"0.1">() == 0.1);
+static_assert(staticExpression<".5+3.">() == 3.5);
+static_assert(staticExpression<"0.1+0.2">() == 0.1 + 0.2);
+
+// Folding and variables.
+static_assert(isConstant<"2*3+1">);
+static_assert(!isConstant<"x*(2+3)">);
+static_assert(decltype(staticExpression<"b+a*b">)::variableCount == 2);
+static_assert(decltype(staticExpression<"b+a*b">)::variable(0) == "b");
+static_assert(decltype(staticExpression<"b+a*b">)::variable(1) == "a");
+static_assert(staticExpression<"w*h/2">(3.0, 4.0) == 6);
+static_assert(staticExpression<"x-(1+1)">(5) == 3);
+
+// Rejected at compile time.
+static_assert(Parses<"1+2">);
+static_assert(!Parses<"">);
+static_assert(!Parses<"1+">);
+static_assert(!Parses<"(1+2">);
+static_assert(!Parses<"1..2">);
+static_assert(!Parses<"1$2">);
+static_assert(!Parses<"1/0">);
+static_assert(!Parses<"x/(2-2)">);
+static_assert(!Parses<"foo(1)">);
+static_assert(!Parses<"min(1)">);
+static_assert(!Parses<"sqrt(1,2)">);
+static_assert(!Parses<"1,2">);
+static_assert(!Parses<"sqrt()">);
+
+// %, ^ and functions parse, but only run at runtime: libm is not constexpr.
+static_assert(Parses<"2^3^2">);
+static_assert(Parses<"7%3+sqrt(x)*min(x,2)">);
+static_assert(!isConstant<"2^3">);
+static_assert(!isConstant<"sqrt(4)">);
+static_assert(decltype(staticExpression<"max(b,a)^b">)::variable(1) == "a");
+
+template <FixedString Source, typename... Values>
+static bool matches(Values... values) {
+    double vars[] = {static_cast<double>(values)..., 0.0};
+    AST tree{string(Source.view())};
+    string expected, actual;
+    double want = 0, got = 0;
+    try {
+        want = tree.calculate(vars);
+    } catch (const exception& e) {
+        expected = e.what();
+    }
+    try {
+        got = staticExpression<Source>(values...);
+    } catch (const exception& e) {
+        actual = e.what();
+    }
+    if (expected == actual && (!expected.empty() || memcmp(&want, &got, sizeof want) == 0)) return true;
+    fprintf(stderr, "FAIL %s: calculate() %s%.17g, static %s%.17g\n", Source.text, expected.c_str(), want,
+            actual.c_str(), got);
+    return false;
+}
+
+int main() {
+    bool ok = true;
+    ok &= matches<"w*h/2">(3.0, 4.0);
+    ok &= matches<"x/y+0.1*x">(1.0, 3.0);
+    ok &= matches<"x/y">(1.0, 0.0);
+    ok &= matches<"-x*-(y-0.3)">(0.7, 1e-17);
+    ok &= matches<"a/b/c-a*b">(1e308, 1e-308, 3.0);
+    ok &= matches<"2^3^2">();
+    ok &= matches<"-2^2+-x^0.5">(2.0);
+    ok &= matches<"x%3*2^-1">(7.5);
+    ok &= matches<"sqrt(x)+sin(x)*cos(x)-tan(x)/exp(x)+ln(x)">(0.3);
+    ok &= matches<"abs(-x)-min(x,1)*max(2,x)">(2.5);
+    ok &= matches<"min(x/(x-x),1)">(4.0);
+    ok &= matches<"-max(-x, -(1.5+2)*2)%(4-1.5)">(9.25);
+    return ok ? 0 : 1;
+}